@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+// Threads
+#include <pthread.h>
+#include <sched.h>
+
+#include "ring.h"
+#include "credentials.h"
+#include "auth.h"
+
+struct ring auth_queue;                 // The logins waiting to be checked
+pthread_t* auth_threads = NULL;         // The threads checking the logins
+int auth_num_threads = 0;
+int auth_running = 0;                   // Set while the threads are taking logins off the queue
+int auth_submitting = 0;                // How many threads are in the middle of queueing a login, so stopping can wait for them
+
+struct auth_stats auth_stats = {0};
+
+/**
+ * Get the current time in microseconds
+ **/
+long auth_now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000L;
+}
+
+/**
+ * Raise one of the counters to value if it is lower
+ **/
+void auth_stats_max(unsigned long* counter, unsigned long value) {
+    unsigned long current = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    while(value > current &&
+          !__atomic_compare_exchange_n(counter, &current, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * Check a login and hand the request back to its owner
+ **/
+void auth_check(struct auth_request* request) {
+    request->verified = credentials_check(request->username, request->password);
+    request->done(request);
+}
+
+/**
+ * The main function of each authentication thread. Sleeps until logins are queued, then takes as many as fit in
+ * a batch so that a burst of logins costs a single wake up.
+ **/
+void* auth_loop(void* arg) {
+    struct auth_request* batch[AUTH_BATCH_SIZE];
+    long value;
+
+    while(ring_pop_wait(&auth_queue, &value, -1)) {
+        int size = 0;
+        batch[size++] = (struct auth_request*)value;
+        while(size < AUTH_BATCH_SIZE && ring_pop(&auth_queue, &value)) {
+            batch[size++] = (struct auth_request*)value;
+        }
+
+        long now = auth_now_us();
+        unsigned long waited_us = 0;
+        for(int i = 0; i < size; i++) {
+            unsigned long waited = now - batch[i]->submitted_us;
+            waited_us += waited;
+            auth_stats_max(&auth_stats.max_wait_us, waited);
+        }
+        __atomic_add_fetch(&auth_stats.requests, size, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&auth_stats.batches, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&auth_stats.wait_us, waited_us, __ATOMIC_RELAXED);
+
+        for(int i = 0; i < size; i++) {
+            auth_check(batch[i]);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Wakes up the thread sleeping in auth_wait
+ **/
+void auth_wake(struct auth_request* request) {
+    __atomic_store_n(&request->finished, 1, __ATOMIC_SEQ_CST);
+    ring_futex_wake(&request->finished, 1);
+}
+
+/**
+ * Start the threads that check the logins
+ **/
+void auth_start(int num_threads) {
+    ring_init(&auth_queue, AUTH_QUEUE_CAPACITY);
+
+    auth_threads = calloc(num_threads, sizeof(pthread_t));
+    if(!auth_threads) {
+        perror("Error creating the authentication threads: out of memory");
+        exit(1);
+    }
+    auth_num_threads = num_threads;
+    __atomic_store_n(&auth_running, 1, __ATOMIC_SEQ_CST);
+
+    for(int i = 0; i < num_threads; i++) {
+        if(pthread_create(&auth_threads[i], NULL, auth_loop, NULL) != 0) {
+            perror("Error creating the authentication threads");
+            exit(1);
+        }
+    }
+}
+
+/**
+ * Stop the threads. Every request already submitted is checked and handed back before this returns, and the
+ * requests submitted afterwards are checked straight away by whoever submits them.
+ **/
+void auth_stop() {
+    // Once no thread is in the middle of queueing a login, nothing else will be queued
+    __atomic_store_n(&auth_running, 0, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&auth_submitting, __ATOMIC_SEQ_CST) > 0) {
+        sched_yield();
+    }
+
+    ring_close(&auth_queue);
+    for(int i = 0; i < auth_num_threads; i++) {
+        pthread_join(auth_threads[i], NULL);
+    }
+
+    // The threads can give up while logins are still queued
+    long value;
+    while(ring_pop(&auth_queue, &value)) {
+        auth_check((struct auth_request*)value);
+    }
+
+    auth_stats.queued_high_water = ring_high_water(&auth_queue);
+    ring_free(&auth_queue);
+    free(auth_threads);
+    auth_threads = NULL;
+    auth_num_threads = 0;
+}
+
+/**
+ * Queue a login to be checked. Never blocks: if the queue is full the login is checked on the calling thread.
+ * The request's done function is called once it has been checked, possibly before this returns.
+ **/
+void auth_submit(struct auth_request* request) {
+    request->pending = 1;
+    request->submitted_us = auth_now_us();
+
+    __atomic_add_fetch(&auth_submitting, 1, __ATOMIC_SEQ_CST);
+    int queued = __atomic_load_n(&auth_running, __ATOMIC_SEQ_CST) && ring_push(&auth_queue, (long)request) > 0;
+    __atomic_sub_fetch(&auth_submitting, 1, __ATOMIC_SEQ_CST);
+
+    if(!queued) {
+        __atomic_add_fetch(&auth_stats.overflows, 1, __ATOMIC_RELAXED);
+        auth_check(request);
+    }
+}
+
+/**
+ * Queue a login to be checked and sleep until it has been. For threads that only drive a single session.
+ *
+ * Returns 1 if the username and password matched
+ **/
+int auth_wait(struct auth_request* request) {
+    request->done = auth_wake;
+    request->finished = 0;
+    auth_submit(request);
+
+    while(!__atomic_load_n(&request->finished, __ATOMIC_SEQ_CST)) {
+        ring_futex_wait(&request->finished, 0, -1);
+    }
+    request->pending = 0;
+    return request->verified;
+}
+
+/**
+ * Get a copy of the counters
+ **/
+void auth_stats_get(struct auth_stats* stats) {
+    stats->requests = __atomic_load_n(&auth_stats.requests, __ATOMIC_RELAXED);
+    stats->batches = __atomic_load_n(&auth_stats.batches, __ATOMIC_RELAXED);
+    stats->overflows = __atomic_load_n(&auth_stats.overflows, __ATOMIC_RELAXED);
+    stats->queued_high_water = __atomic_load_n(&auth_running, __ATOMIC_SEQ_CST) ?
+                               ring_high_water(&auth_queue) : auth_stats.queued_high_water;
+    stats->wait_us = __atomic_load_n(&auth_stats.wait_us, __ATOMIC_RELAXED);
+    stats->max_wait_us = __atomic_load_n(&auth_stats.max_wait_us, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,75 @@
+#ifndef AUTH_H
+#define AUTH_H
+
+/**
+ * The authentication stage checks the usernames and passwords sent by the clients on a small pool of threads of
+ * its own, so a slow check never holds up the threads driving the games.
+ *
+ * Whoever drives a session submits a request and carries on with its other clients. The requests wait on a
+ * lock-free ring, and each authentication thread takes them off in batches, checks them and hands every request
+ * back through its done function, which passes the session back to the thread that owns it.
+ **/
+
+#define AUTH_THREADS_DEFAULT    2       // How many threads check the logins
+#define AUTH_QUEUE_CAPACITY     1024    // How many logins can wait before they are checked by whoever submits them
+#define AUTH_BATCH_SIZE         32      // The most logins a thread takes off the queue at once
+
+/**
+ * A login waiting to be checked. Each session has its own, so submitting one never allocates.
+ **/
+struct auth_request {
+    const char* username;
+    const char* password;
+    int verified;                                   // Set if the username and password matched
+    int pending;                                    // Set from when the request is submitted until its owner has the result
+    void (*done)(struct auth_request* request);     // Called once the request was checked, from the thread that checked it
+    void* owner;                                    // Whoever drives the session (eg. a reactor)
+    void* data;                                     // The session the login belongs to
+    struct auth_request* next;                      // Lets the owner keep a list of the requests handed back to it
+
+    long submitted_us;                              // When the request was submitted, to measure how long it waited
+    unsigned int finished;                          // Set once checked when waiting with auth_wait. Also the futex it sleeps on
+};
+
+/**
+ * Counters that show how the stage is coping with the logins
+ **/
+struct auth_stats {
+    unsigned long requests;     // How many logins were checked by the stage's threads
+    unsigned long batches;      // How many batches the threads took off the queue
+    unsigned long overflows;    // How many logins were checked by whoever submitted them as the stage was full or stopped
+    int queued_high_water;      // The most logins that have waited at once
+    unsigned long wait_us;      // The total time logins waited to be checked
+    unsigned long max_wait_us;  // The longest a login waited to be checked
+};
+
+/**
+ * Start the threads that check the logins
+ **/
+void auth_start(int num_threads);
+
+/**
+ * Stop the threads. Every request already submitted is checked and handed back before this returns, and the
+ * requests submitted afterwards are checked straight away by whoever submits them.
+ **/
+void auth_stop();
+
+/**
+ * Queue a login to be checked. Never blocks: if the queue is full the login is checked on the calling thread.
+ * The request's done function is called once it has been checked, possibly before this returns.
+ **/
+void auth_submit(struct auth_request* request);
+
+/**
+ * Queue a login to be checked and sleep until it has been. For threads that only drive a single session.
+ *
+ * Returns 1 if the username and password matched
+ **/
+int auth_wait(struct auth_request* request);
+
+/**
+ * Get a copy of the counters
+ **/
+void auth_stats_get(struct auth_stats* stats);
+
+#endif // AUTH_H
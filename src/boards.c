@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Threads
+#include <pthread.h>
+
+#include "ring.h"
+#include "minesweeper.h"
+#include "boards.h"
+
+#define BOARDS_SIZES    3       // How many sizes of field are pooled
+
+/**
+ * The fields of one size kept ready for the games
+ **/
+struct board_pool {
+    FieldSize size;
+    Field* slab;                // The fields, one per slot
+    struct ring free;           // The slots waiting to be filled by the generator
+    struct ring ready;          // The slots holding a field no game has started on yet
+};
+
+struct board_pool boards_pools[BOARDS_SIZES];
+int boards_num_pools = 0;
+pthread_t boards_thread;                // The generator
+FieldRandom boards_random;              // Only used by the generator
+int boards_running = 0;                 // Set while the pools can be taken from
+int boards_stopping = 0;                // Set when the generator should stop
+unsigned int boards_wanted = 0;         // Changes every time a slot is freed or the pool stops. Also the futex the generator sleeps on
+int boards_waiting = 0;                 // Set while the generator is sleeping on the futex
+
+struct boards_stats boards_stats = {0};
+
+/**
+ * Get the pool that holds fields of a size, or NULL if the size isn't pooled
+ **/
+struct board_pool* boards_pool(FieldSize size) {
+    for(int i = 0; i < boards_num_pools; i++) {
+        FieldSize pooled = boards_pools[i].size;
+        if(pooled.width == size.width && pooled.height == size.height && pooled.num_mines == size.num_mines) {
+            return &boards_pools[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Fill a free slot of every pool that has one, so every size is topped up evenly
+ *
+ * Returns how many slots were filled
+ **/
+int boards_fill() {
+    int filled = 0;
+    for(int i = 0; i < boards_num_pools; i++) {
+        struct board_pool* pool = &boards_pools[i];
+        long slot;
+        if(ring_pop(&pool->free, &slot)) {
+            field_generate(&pool->slab[slot], pool->size, &boards_random);
+            ring_push(&pool->ready, slot);
+            filled++;
+        }
+    }
+    return filled;
+}
+
+/**
+ * The main function of the generator. Fills slots until every one is ready, then sleeps until a game takes one.
+ **/
+void* boards_loop(void* arg) {
+    while(!__atomic_load_n(&boards_stopping, __ATOMIC_SEQ_CST)) {
+        // Read the futex before looking at the slots, so a slot freed after we looked changes it and we don't sleep
+        unsigned int wanted = __atomic_load_n(&boards_wanted, __ATOMIC_SEQ_CST);
+        int filled = boards_fill();
+        if(filled > 0) {
+            __atomic_add_fetch(&boards_stats.generated, filled, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        __atomic_store_n(&boards_waiting, 1, __ATOMIC_SEQ_CST);
+        ring_futex_wait(&boards_wanted, wanted, -1);
+        __atomic_store_n(&boards_waiting, 0, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&boards_stats.wakeups, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+/**
+ * Start the generator thread with pools of pool_size fields of each size. Its generator is seeded with seed.
+ **/
+void boards_start(int pool_size, uint64_t seed) {
+    FieldSize sizes[BOARDS_SIZES] = {FIELD_BEGINNER, FIELD_INTERMEDIATE, FIELD_EXPERT};
+    for(int i = 0; i < BOARDS_SIZES; i++) {
+        struct board_pool* pool = &boards_pools[i];
+        pool->size = sizes[i];
+        pool->slab = malloc(pool_size * sizeof(Field));
+        if(!pool->slab) {
+            perror("Error creating the board pool: out of memory");
+            exit(1);
+        }
+        ring_init(&pool->free, pool_size);
+        ring_init(&pool->ready, pool_size);
+        for(long slot = 0; slot < pool_size; slot++) {
+            ring_push(&pool->free, slot);
+        }
+    }
+    boards_num_pools = BOARDS_SIZES;
+    field_random_seed(&boards_random, seed);
+
+    __atomic_store_n(&boards_stopping, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&boards_running, 1, __ATOMIC_SEQ_CST);
+    if(pthread_create(&boards_thread, NULL, boards_loop, NULL) != 0) {
+        perror("Error creating the board generator");
+        exit(1);
+    }
+}
+
+/**
+ * Stop the generator thread and deallocate the pools. Must be called once no more games can start.
+ **/
+void boards_stop() {
+    if(!__atomic_load_n(&boards_running, __ATOMIC_SEQ_CST)) {
+        return;
+    }
+    __atomic_store_n(&boards_running, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&boards_stopping, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&boards_wanted, 1, __ATOMIC_SEQ_CST);
+    ring_futex_wake(&boards_wanted, 1);
+    pthread_join(boards_thread, NULL);
+
+    for(int i = 0; i < boards_num_pools; i++) {
+        ring_free(&boards_pools[i].free);
+        ring_free(&boards_pools[i].ready);
+        free(boards_pools[i].slab);
+        boards_pools[i].slab = NULL;
+    }
+    boards_num_pools = 0;
+}
+
+/**
+ * Copy a ready field of the given size from the pool. Never blocks.
+ *
+ * Returns 1 if a field was copied, 0 if the size isn't pooled or none of its fields are ready
+ **/
+int boards_take(Field* field, FieldSize size) {
+    if(!__atomic_load_n(&boards_running, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    struct board_pool* pool = boards_pool(size);
+    if(pool == NULL) {
+        return 0;
+    }
+    long slot;
+    if(!ring_pop(&pool->ready, &slot)) {
+        __atomic_add_fetch(&boards_stats.misses, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    memcpy(field, &pool->slab[slot], sizeof(Field));
+    __atomic_add_fetch(&boards_stats.taken, 1, __ATOMIC_RELAXED);
+
+    // Hand the slot back to be filled, and only make the system call if the generator is asleep
+    ring_push(&pool->free, slot);
+    __atomic_add_fetch(&boards_wanted, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&boards_waiting, __ATOMIC_SEQ_CST)) {
+        ring_futex_wake(&boards_wanted, 1);
+    }
+    return 1;
+}
+
+/**
+ * Get a copy of the counters
+ **/
+void boards_stats_get(struct boards_stats* stats) {
+    stats->generated = __atomic_load_n(&boards_stats.generated, __ATOMIC_RELAXED);
+    stats->taken = __atomic_load_n(&boards_stats.taken, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&boards_stats.misses, __ATOMIC_RELAXED);
+    stats->wakeups = __atomic_load_n(&boards_stats.wakeups, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,54 @@
+#ifndef BOARDS_H
+#define BOARDS_H
+
+#include <stdint.h>
+
+#include "minesweeper.h"
+
+/**
+ * The board pool keeps fields of each size that can be picked from the menu ready ahead of the games, so starting
+ * one of those games only copies a field rather than placing the mines and counting them on the thread that is
+ * talking to the player.
+ *
+ * The fields of each size live in a slab allocated up front. Two lock-free rings hold the indexes of its slots:
+ * the free ring those waiting to be filled and the ready ring those holding a fresh field. A single generator
+ * thread takes free slots, fills them and makes them ready, then sleeps once every slot is full. Starting a game
+ * takes a ready slot, copies its field and gives the slot back to be filled again, waking the generator if it
+ * sleeps. If no field is ready the game makes its own, so a burst of games is never held up by the pool.
+ **/
+
+#define BOARDS_POOL_DEFAULT     32      // How many fields of each size are kept ready
+
+/**
+ * Counters that show how the pool is keeping up with the games
+ **/
+struct boards_stats {
+    unsigned long generated;    // How many fields the generator made
+    unsigned long taken;        // How many games started on a field from the pool
+    unsigned long misses;       // How many games had to make their own field as none of their size was ready
+    unsigned long wakeups;      // How many times the generator was woken up to fill slots
+};
+
+/**
+ * Start the generator thread with pools of pool_size fields of each size. Its generator is seeded with seed.
+ **/
+void boards_start(int pool_size, uint64_t seed);
+
+/**
+ * Stop the generator thread and deallocate the pools. Must be called once no more games can start.
+ **/
+void boards_stop();
+
+/**
+ * Copy a ready field of the given size from the pool. Never blocks.
+ *
+ * Returns 1 if a field was copied, 0 if the size isn't pooled or none of its fields are ready
+ **/
+int boards_take(Field* field, FieldSize size);
+
+/**
+ * Get a copy of the counters
+ **/
+void boards_stats_get(struct boards_stats* stats);
+
+#endif // BOARDS_H
@@ -9,6 +9,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <poll.h>
 
 #include "message.h"
 
@@ -18,6 +19,14 @@ int sockfd;
 // Controls when the client should exit from its infinite loop
 int client_keep_alive = 1;
 
+// Set once the server has been asked for protocol v2 (see message.h)
+int hello_sent = 0;
+
+// The copy of the Minesweeper field kept by the client (see MSGC_BOARD in message.h)
+char* board = NULL;                 // The sprite of every tile, row by row
+int board_width = 0;
+int board_height = 0;
+
 /**
 * Error catching code.
 **/
@@ -56,6 +65,216 @@ void print_message(int sockfd, char* message) {
     }
 }
 
+/**
+ * Tells the server that a message was received. The first message is answered with a hello instead, which
+ * asks the server to switch to protocol v2.
+ **/
+void acknowledge(int sockfd) {
+    if(!hello_sent) {
+        char hello[2] = {MSGC_HELLO, '0' + PROTOCOL_V2};
+        send(sockfd, hello, sizeof(hello), 0);
+        hello_sent = 1;
+    } else {
+        send_message(sockfd, MSGC_ACK, "");
+    }
+}
+
+/**
+ * Sends every complete line in the input buffer to the server. Anything left over is moved to the start of the buffer.
+ * If the buffer is full without a new line, everything in it is sent. The buffer holds at most FRAME_DATA_MAX_SIZE
+ * bytes, so every frame fits in the server's inbox.
+ *
+ * Returns how many bytes are left in the buffer
+ **/
+int send_input_lines(int sockfd, char* input, int input_len, int input_size) {
+    char line[FRAME_DATA_MAX_SIZE + 1];
+    int start = 0;
+    for(int i = 0; i < input_len; i++) {
+        if(input[i] == '\n' || (i == input_size - 1)) {
+            int line_len = i - start + 1;
+            memcpy(line, input + start, line_len);
+            line[line_len] = '\0';
+            send_frame(sockfd, MSGC_DATA, line);
+            start = i + 1;
+        }
+    }
+
+    memmove(input, input + start, input_len - start);
+    return input_len - start;
+}
+
+/**
+ * Prints the client's copy of the Minesweeper field the same way the server draws it for older clients
+ **/
+void print_board() {
+    // The tens of the column numbers go on a line of their own once there are 10 columns or more
+    if(board_width >= 10) {
+        printf("   ");
+        for(int x = 0; x < board_width; x++) {
+            printf(" %c", (x + 1 >= 10) ? '0' + ((x + 1) / 10) : ' ');
+        }
+        printf("\n");
+    }
+    printf("   ");
+    for(int x = 0; x < board_width; x++) {
+        printf(" %d", (x + 1) % 10);
+    }
+    printf("\n");
+    for(int i = 0; i < 4 + (board_width * 2) - 1; i++) {
+        putchar('-');
+    }
+    printf("\n");
+
+    for(int y = 0; y < board_height; y++) {
+        printf("%c | ", 'A' + y);
+        for(int x = 0; x < board_width; x++) {
+            printf("%c ", board[(y * board_width) + x]);
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+/**
+ * Replaces or patches the client's copy of the Minesweeper field with a MSGC_BOARD or MSGC_BOARD_DELTA message
+ * and prints it. Messages that don't match the field are ignored.
+ **/
+void update_board(char code, char* msg, int msg_size) {
+    // Make the message a string so it can be parsed
+    char* text = malloc(msg_size + 1);
+    if(!text) {
+        error("Error receiving from the server: out of memory");
+    }
+    memcpy(text, msg, msg_size);
+    text[msg_size] = '\0';
+
+    if(code == MSGC_BOARD) {
+        // The sprites of hidden tiles are spaces, so only the single space after the height is skipped
+        int width, height, offset;
+        if(sscanf(text, "%d %d%n", &width, &height, &offset) == 2 && width > 0 && height > 0 &&
+           (msg_size - offset - 1) == width * height) {
+            offset++;
+            free(board);
+            board = malloc(width * height);
+            if(!board) {
+                error("Error receiving from the server: out of memory");
+            }
+            memcpy(board, text + offset, width * height);
+            board_width = width;
+            board_height = height;
+        }
+    } else {
+        // Apply each "<x>,<y>,<sprite>;" entry
+        int x, y, offset;
+        char sprite;
+        char* entry = text;
+        while(1) {
+            offset = 0;
+            if(sscanf(entry, "%d,%d,%c;%n", &x, &y, &sprite, &offset) != 3 || offset == 0) {
+                break;
+            }
+            if(x >= 0 && x < board_width && y >= 0 && y < board_height) {
+                board[(y * board_width) + x] = sprite;
+            }
+            entry += offset;
+        }
+    }
+
+    free(text);
+    print_board();
+}
+
+/**
+ * The main loop used once the server agrees to protocol v2. Every frame received is printed as soon as it
+ * arrives and every line the user types is sent straight away, without waiting for the server to prompt for it
+ * or for ACKs. Any bytes received after the server's hello are passed in as leftover.
+ **/
+void client_loop_v2(int sockfd, char* leftover, int leftover_size) {
+    // Holds the frames received from the server. Grows when a frame doesn't fit.
+    int inbox_size = MESSAGE_MAX_SIZE;
+    char* inbox = malloc(inbox_size);
+    if(!inbox) {
+        error("Error receiving from the server: out of memory");
+    }
+    memcpy(inbox, leftover, leftover_size);
+    int inbox_len = leftover_size;
+
+    // Holds what the user has typed that hasn't been sent yet
+    char input[FRAME_DATA_MAX_SIZE];
+    int input_len = 0;
+
+    struct pollfd fds[2];
+    fds[0].fd = sockfd;
+    fds[0].events = POLLIN;
+    fds[1].fd = STDIN_FILENO;
+    fds[1].events = POLLIN;
+
+    while(client_keep_alive) {
+        // Handle every complete frame received from the server
+        int size;
+        while((size = frame_size(inbox, inbox_len)) > 0) {
+            char code = inbox[FRAME_HEADER_SIZE - 1];
+            if(code == MSGC_PRINT || code == MSGC_INPUT || code == MSGC_EXIT) {
+                fwrite(inbox + FRAME_HEADER_SIZE, 1, size - FRAME_HEADER_SIZE, stdout);
+                fflush(stdout);
+            } else if(code == MSGC_BOARD || code == MSGC_BOARD_DELTA) {
+                update_board(code, inbox + FRAME_HEADER_SIZE, size - FRAME_HEADER_SIZE);
+            }
+            if(code == MSGC_EXIT) {
+                free(inbox);
+                close(sockfd);
+                exit(0);
+            }
+
+            inbox_len -= size;
+            memmove(inbox, inbox + size, inbox_len);
+        }
+        if(size < 0) {
+            printf("Received a message that is too large. Disconnecting...\n");
+            break;
+        }
+
+        // Make space for the rest of a frame that doesn't fit in the inbox
+        if(inbox_len == inbox_size) {
+            inbox_size *= 2;
+            char* larger_inbox = realloc(inbox, inbox_size);
+            if(!larger_inbox) {
+                error("Error receiving from the server: out of memory");
+            }
+            inbox = larger_inbox;
+        }
+
+        // Wait until the server sends something or the user types something
+        if(poll(fds, 2, -1) == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            error("Error waiting for input");
+        }
+
+        if(fds[0].revents) {
+            int received = recv(sockfd, inbox + inbox_len, inbox_size - inbox_len, 0);
+            if(received <= 0) {
+                printf("Lost connection to the server. Disconnecting...\n");
+                break;
+            }
+            inbox_len += received;
+        }
+
+        if(fds[1].revents) {
+            int typed = read(STDIN_FILENO, input + input_len, sizeof(input) - input_len);
+            if(typed <= 0) {
+                // Nothing more will be typed, keep printing what the server sends
+                fds[1].fd = -1;
+            } else {
+                input_len = send_input_lines(sockfd, input, input_len + typed, sizeof(input));
+            }
+        }
+    }
+
+    free(inbox);
+}
+
 /**
  * Attempts to connect to the server and then will open the main loop where it will attempt to play
  * minesweeper through the connection to the server
@@ -123,23 +342,30 @@ int main(int argc, char *argv[]) {
                 // Print the message to the console
                 print_message(sockfd, server_msg);
                 // Sends an ACK to the server so that the next line - if any - can be sent
-                send_message(sockfd, MSGC_ACK, "");
+                acknowledge(sockfd);
                 break;
             case MSGC_INPUT:
                 // Print the message to the console and then waits for input to send to the server
                 print_message(sockfd, server_msg);
                 // Sends an ACK to the server so that the next line - if any - can be sent
-                send_message(sockfd, MSGC_ACK, "");
+                acknowledge(sockfd);
                 send_input(sockfd);
                 break;
             case MSGC_EXIT:
                 // Print the message to the console and then exit out of the program
                 print_message(sockfd, server_msg);
                 // Sends an ACK to the server so that the next line - if any - can be sent
-                send_message(sockfd, MSGC_ACK, "");
+                acknowledge(sockfd);
                 close(sockfd);
                 exit(0);
                 break;
+            case MSGC_HELLO:
+                // The server agreed to use protocol v2, everything after the hello is framed
+                if(server_msg[0] - '0' >= PROTOCOL_V2) {
+                    client_loop_v2(sockfd, buffer + 2, msg_size - 2);
+                    client_keep_alive = 0;
+                }
+                break;
             default:
                 break;
         }
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Threads
+#include <pthread.h>
+#include <sched.h>
+// Files
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "ring.h"
+#include "credentials.h"
+
+#define CREDENTIALS_SEPARATORS  " \t\r\n"   // What separates the usernames and passwords in the file
+
+/**
+ * A slot of the index. Empty slots have no username.
+ **/
+struct credential {
+    unsigned long hash;         // The hash of the username
+    const char* username;
+    const char* password;
+};
+
+/**
+ * The index built from one version of the file. Never changes once it is built.
+ **/
+struct credentials {
+    char* text;                 // The contents of the file, cut up into the strings the slots point to
+    struct credential* slots;   // Open addressing table, searched linearly from the slot the hash points to
+    unsigned long mask;         // The number of slots minus 1 (it is a power of 2)
+    int users;                  // How many username-password pairs are in the table
+
+    struct timespec mtime;      // When the file was modified, to notice it has changed
+    off_t size;
+};
+
+struct credentials* credentials_current = NULL;     // The index logins are checked against
+unsigned int credentials_epoch = 0;                 // Picks which of the reader counters new logins use
+int credentials_readers[2] = {0, 0};                // How many logins are reading an index, by epoch
+
+char* credentials_path = NULL;                      // The authentication file
+pthread_t credentials_thread;                       // Reloads the index when the file changes
+unsigned int credentials_stopping = 0;              // Set when the watcher thread should stop. Also the futex it sleeps on
+
+struct credentials_stats credentials_stats = {0};
+
+/**
+ * Hashes a username (FNV-1a)
+ **/
+unsigned long credentials_hash(const char* username) {
+    unsigned long hash = 14695981039346656037UL;
+    for(const unsigned char* c = (const unsigned char*)username; *c != '\0'; c++) {
+        hash ^= *c;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+/**
+ * Deallocate an index
+ **/
+void credentials_free(struct credentials* index) {
+    if(index != NULL) {
+        free(index->slots);
+        free(index->text);
+        free(index);
+    }
+}
+
+/**
+ * Read the whole file and build an index of it. The first line of the file is a header.
+ *
+ * Returns NULL if the file couldn't be read
+ **/
+struct credentials* credentials_build(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if(fp == NULL) {
+        return NULL;
+    }
+
+    struct credentials* index = calloc(1, sizeof(struct credentials));
+    if(!index) {
+        perror("Error loading the credentials: out of memory");
+        exit(1);
+    }
+
+    struct stat file_stat;
+    if(fstat(fileno(fp), &file_stat) == -1) {
+        fclose(fp);
+        free(index);
+        return NULL;
+    }
+    index->mtime = file_stat.st_mtim;
+    index->size = file_stat.st_size;
+
+    // Read the file in one go, the strings are kept in place
+    index->text = malloc(file_stat.st_size + 1);
+    if(!index->text) {
+        perror("Error loading the credentials: out of memory");
+        exit(1);
+    }
+    size_t size = fread(index->text, 1, file_stat.st_size, fp);
+    index->text[size] = '\0';
+    fclose(fp);
+
+    // Count the words to size the table so it is never more than half full
+    unsigned long words = 0;
+    int in_word = 0;
+    for(size_t i = 0; i < size; i++) {
+        int separator = strchr(CREDENTIALS_SEPARATORS, index->text[i]) != NULL;
+        if(!separator && !in_word) {
+            words++;
+        }
+        in_word = !separator;
+    }
+    unsigned long capacity = 16;
+    while(capacity < words) {
+        capacity *= 2;
+    }
+    index->slots = calloc(capacity, sizeof(struct credential));
+    if(!index->slots) {
+        perror("Error loading the credentials: out of memory");
+        exit(1);
+    }
+    index->mask = capacity - 1;
+
+    // Skip the header, then add every username-password pair
+    char* save;
+    char* username = strtok_r(index->text, CREDENTIALS_SEPARATORS, &save);
+    char* password = strtok_r(NULL, CREDENTIALS_SEPARATORS, &save);
+    while((username = strtok_r(NULL, CREDENTIALS_SEPARATORS, &save)) != NULL &&
+          (password = strtok_r(NULL, CREDENTIALS_SEPARATORS, &save)) != NULL) {
+        unsigned long hash = credentials_hash(username);
+        unsigned long i = hash & index->mask;
+        while(index->slots[i].username != NULL) {
+            i = (i + 1) & index->mask;
+        }
+        index->slots[i].hash = hash;
+        index->slots[i].username = username;
+        index->slots[i].password = password;
+        index->users++;
+    }
+
+    return index;
+}
+
+/**
+ * Look for a pair in an index. A username can be in the file more than once, so every slot holding it is checked.
+ *
+ * Returns 1 if there is a match
+ **/
+int credentials_find(struct credentials* index, const char* username, const char* password) {
+    unsigned long hash = credentials_hash(username);
+    for(unsigned long i = hash & index->mask; index->slots[i].username != NULL; i = (i + 1) & index->mask) {
+        struct credential* slot = &index->slots[i];
+        if(slot->hash == hash && strcmp(slot->username, username) == 0 && strcmp(slot->password, password) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Wait until no login can still be reading the index that was just replaced. A login that got hold of the old
+ * index announced itself on the counter of the epoch it saw before the swap, which is either the current epoch
+ * or the one before it. The counter of the previous epoch is drained first, then the epoch moves on so that new
+ * logins use the other counter and the counter of the current epoch drains as well.
+ **/
+void credentials_synchronize() {
+    unsigned int epoch = __atomic_load_n(&credentials_epoch, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&credentials_readers[(epoch + 1) & 1], __ATOMIC_SEQ_CST) > 0) {
+        sched_yield();
+    }
+    __atomic_store_n(&credentials_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&credentials_readers[epoch & 1], __ATOMIC_SEQ_CST) > 0) {
+        sched_yield();
+    }
+}
+
+/**
+ * The main function of the watcher thread. Checks the file every CREDENTIALS_POLL_MS and swaps in a new index
+ * when its modification time or size has changed.
+ **/
+void* credentials_watch(void* arg) {
+    while(!__atomic_load_n(&credentials_stopping, __ATOMIC_SEQ_CST)) {
+        ring_futex_wait(&credentials_stopping, 0, CREDENTIALS_POLL_MS);
+        if(__atomic_load_n(&credentials_stopping, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+
+        struct credentials* current = credentials_current;
+        struct stat file_stat;
+        if(stat(credentials_path, &file_stat) == -1 || (file_stat.st_size == current->size &&
+           file_stat.st_mtim.tv_sec == current->mtime.tv_sec && file_stat.st_mtim.tv_nsec == current->mtime.tv_nsec)) {
+            continue;
+        }
+
+        struct credentials* index = credentials_build(credentials_path);
+        if(index == NULL) {
+            // Keep the old index until the file can be read again
+            continue;
+        }
+        __atomic_store_n(&credentials_current, index, __ATOMIC_SEQ_CST);
+        credentials_synchronize();
+        credentials_free(current);
+
+        __atomic_add_fetch(&credentials_stats.reloads, 1, __ATOMIC_RELAXED);
+        printf("Reloaded the credentials. Users: %d.\n", index->users);
+    }
+
+    return NULL;
+}
+
+/**
+ * Build the index from the file and start the thread that reloads it when the file changes
+ *
+ * Returns -1 if the file couldn't be read, in which case nothing was started
+ **/
+int credentials_start(const char* path) {
+    credentials_current = credentials_build(path);
+    if(credentials_current == NULL) {
+        return -1;
+    }
+
+    credentials_path = strdup(path);
+    if(!credentials_path) {
+        perror("Error loading the credentials: out of memory");
+        exit(1);
+    }
+    if(pthread_create(&credentials_thread, NULL, credentials_watch, NULL) != 0) {
+        perror("Error creating the credentials watcher");
+        exit(1);
+    }
+
+    return 0;
+}
+
+/**
+ * Stop the watcher thread and free the index
+ **/
+void credentials_stop() {
+    __atomic_store_n(&credentials_stopping, 1, __ATOMIC_SEQ_CST);
+    ring_futex_wake(&credentials_stopping, 1);
+    pthread_join(credentials_thread, NULL);
+
+    struct credentials* current = credentials_current;
+    __atomic_store_n(&credentials_current, NULL, __ATOMIC_SEQ_CST);
+    credentials_synchronize();
+    credentials_free(current);
+    free(credentials_path);
+    credentials_path = NULL;
+}
+
+/**
+ * Check if the file holds a line with this username and password. Never blocks.
+ *
+ * Returns 1 if there is a match
+ **/
+int credentials_check(const char* username, const char* password) {
+    // Announce the read before getting hold of the index, so it isn't freed while being read
+    unsigned int epoch = __atomic_load_n(&credentials_epoch, __ATOMIC_SEQ_CST);
+    int* readers = &credentials_readers[epoch & 1];
+    __atomic_add_fetch(readers, 1, __ATOMIC_SEQ_CST);
+
+    struct credentials* index = __atomic_load_n(&credentials_current, __ATOMIC_SEQ_CST);
+    int found = (index != NULL) && credentials_find(index, username, password);
+
+    __atomic_sub_fetch(readers, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&credentials_stats.lookups, 1, __ATOMIC_RELAXED);
+    return found;
+}
+
+/**
+ * Get a copy of the counters
+ **/
+void credentials_stats_get(struct credentials_stats* stats) {
+    // The watcher frees the old index on every reload, so the index is read like a login reads it
+    unsigned int epoch = __atomic_load_n(&credentials_epoch, __ATOMIC_SEQ_CST);
+    int* readers = &credentials_readers[epoch & 1];
+    __atomic_add_fetch(readers, 1, __ATOMIC_SEQ_CST);
+
+    struct credentials* index = __atomic_load_n(&credentials_current, __ATOMIC_SEQ_CST);
+    stats->users = (index != NULL) ? index->users : 0;
+
+    __atomic_sub_fetch(readers, 1, __ATOMIC_SEQ_CST);
+    stats->reloads = __atomic_load_n(&credentials_stats.reloads, __ATOMIC_RELAXED);
+    stats->lookups = __atomic_load_n(&credentials_stats.lookups, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,48 @@
+#ifndef CREDENTIALS_H
+#define CREDENTIALS_H
+
+/**
+ * An in-memory index of the username-password pairs in the authentication file.
+ *
+ * The file is read once into an immutable hash index. A watcher thread checks the file every few seconds and,
+ * when it has changed, builds a new index and swaps it in. Logins look the username up without taking any lock:
+ * they only announce themselves on one of two reader counters so that the watcher knows when nobody can still be
+ * reading the index it replaced and it can be freed.
+ **/
+
+#define CREDENTIALS_POLL_MS     2000    // How often the watcher checks if the file has changed
+
+/**
+ * Counters that show what the index holds and how often it was rebuilt
+ **/
+struct credentials_stats {
+    int users;                  // How many username-password pairs are in the current index
+    unsigned long reloads;      // How many times the index was rebuilt after the file changed
+    unsigned long lookups;      // How many logins were checked
+};
+
+/**
+ * Build the index from the file and start the thread that reloads it when the file changes
+ *
+ * Returns -1 if the file couldn't be read, in which case nothing was started
+ **/
+int credentials_start(const char* path);
+
+/**
+ * Stop the watcher thread and free the index
+ **/
+void credentials_stop();
+
+/**
+ * Check if the file holds a line with this username and password. Never blocks.
+ *
+ * Returns 1 if there is a match
+ **/
+int credentials_check(const char* username, const char* password);
+
+/**
+ * Get a copy of the counters
+ **/
+void credentials_stats_get(struct credentials_stats* stats);
+
+#endif // CREDENTIALS_H
@@ -0,0 +1,788 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "message.h"
+#include "minesweeper.h"
+#include "leaderboard.h"
+#include "results.h"
+#include "boards.h"
+#include "session.h"
+#include "game.h"
+
+#define HIGHSCORE_PAGE_SIZE     10      // How many games are shown on each page of the leaderboard
+#define HIGHSCORE_AROUND_ME     -1      // Set as the page to show the games around the user's best one
+
+// The names of the leaderboards shown on the highscore screen, by view
+const char* highscore_view_names[LEADERBOARD_VIEWS] = {
+    [LEADERBOARD_ALL_TIME] = "All time",
+    [LEADERBOARD_PAST_HOUR] = "Past hour",
+    [LEADERBOARD_PAST_DAY] = "Past day",
+    [LEADERBOARD_PAST_WEEK] = "Past week",
+};
+
+/* =============================================== LEADERBOARD PAGES ================================================ */
+/**
+ * Check if a page is still what its view shows: nothing was added since and no game has left its window
+ **/
+int leaderboard_page_fresh(struct leaderboard_page* page, long now) {
+    return page != NULL && page->version == leaderboard_version() && (page->expires == 0 || now < page->expires);
+}
+
+/**
+ * Get a page of one of the leaderboards from a rank onwards that is up to date. The first reader that asks for it
+ * after the leaderboard changed renders it and caches it, every other reader just takes a reference to the cached
+ * one without any lock. Must be given back with leaderboard_page_put.
+ **/
+struct leaderboard_page* leaderboard_page_latest(int view, int first_rank, long now) {
+    struct leaderboard_page* page = leaderboard_page_get(view, first_rank, HIGHSCORE_PAGE_SIZE);
+    if(leaderboard_page_fresh(page, now)) {
+        return page;
+    }
+    leaderboard_page_put(page);
+
+    leaderboard_lock();
+    page = leaderboard_page_get(view, first_rank, HIGHSCORE_PAGE_SIZE);
+    // Another reader may have rendered it while this one waited for the mutex
+    if(!leaderboard_page_fresh(page, now)) {
+        leaderboard_page_put(page);
+        page = leaderboard_page_render(view, first_rank, HIGHSCORE_PAGE_SIZE, now);
+        // One reference for the cache and one for this reader
+        page->refcount++;
+        leaderboard_page_publish(view, page);
+    }
+    leaderboard_unlock();
+
+    return page;
+}
+
+/* ================================================== CLIENT LOGIN ================================================== */
+/**
+ * Displays the welcome banner and prompts the user to type their username
+ **/
+void draw_login_screen(struct session* session) {
+    // Display the welcome banner
+    session_puts(session, MSGC_PRINT, "===========================================================\n");
+    session_puts(session, MSGC_PRINT, "=     Welcome to the online Minesweeper gaming system     =\n");
+    session_puts(session, MSGC_PRINT, "===========================================================\n");
+    session_puts(session, MSGC_PRINT, "\n");
+
+    // Get the username from the user
+    session_puts(session, MSGC_INPUT, "Username: ");
+}
+
+/**
+ * Removes the newline character from the end of a string sent by the client, if there is one
+ **/
+void strip_newline(char* string) {
+    size_t len = strlen(string);
+    if(len > 0 && string[len-1] == '\n') {
+        string[len-1] = '\0';
+    }
+}
+
+/**
+ * Stores the username sent by the client and then prompts for the password. Once the password is received,
+ * the session waits for the authentication stage to check if the client is authorized to proceed.
+ **/
+void update_login(struct session* session, char* buffer) {
+    if(session->state == LOGIN_USERNAME) {
+        // Keep the username (without the message code) for when the password arrives
+        snprintf(session->username, sizeof(session->username), "%s", buffer + 1);
+        strip_newline(session->username);
+        session->state = LOGIN_PASSWORD;
+        return;
+    }
+
+    // Whoever drives the session hands the login to the authentication stage. Nothing is shown until it is checked.
+    snprintf(session->password, sizeof(session->password), "%s", buffer + 1);
+    strip_newline(session->password);
+    session->state = LOGIN_VERIFYING;
+}
+
+/* =========================================== MINESWEEPER GAME FUNCTIONS =========================================== */
+/**
+ * Iterates through a single row in the Minesweeper field and proceeds to join all of the information
+ * of each tile in that row to a single string.
+ * This string is then sent to the client as a message
+ **/
+void send_minesweeper_row(int y, char row_letter, MinesweeperState *sweeper_state, struct session* session) {
+    int width = sweeper_state->field.size.width;
+    // Make sure the y value passed isn't larger than the field bounds
+    if(y >= sweeper_state->field.size.height) {
+        return;
+    }
+
+    // Iterate through each tile in the row and add the sprites to the sprite string
+    char sprite_string[FIELD_MAX_WIDTH];
+    for(int x = 0; x < width; x++) {
+        // Choose the appropriate character to display depending on the current state of the tile
+        sprite_string[x] = tile_sprite(x, y, sweeper_state);
+    }
+
+    // Add a space between the tile sprites so it looks better when printed to a terminal
+    char sprite_string_spaces[(FIELD_MAX_WIDTH * 2)+1];
+    int x = 0;
+    for(int i = 0; i < width * 2; i++) {
+        // If the number is odd we want a space, otherwise add a tile sprite
+        if(i & 1) {
+            sprite_string_spaces[i] = ' ';
+        } else {
+            sprite_string_spaces[i] = sprite_string[x++];
+        }
+    }
+    sprite_string_spaces[width * 2] = '\0';
+
+    // Add the sprites to the column labels. This is the string that represents a row in the field
+    session_printf(session, MSGC_PRINT, "%c | %s\n", row_letter, sprite_string_spaces);
+}
+
+/**
+ * Sends the Minesweeper field as a single message that the client prints itself. Only the tiles that changed
+ * since the field was last sent are included unless the whole field has to be sent again.
+ * See message.h for the format of the messages.
+ **/
+void send_minesweeper_board(MinesweeperState *sweeper_state, struct session* session) {
+    int width = sweeper_state->field.size.width;
+    int height = sweeper_state->field.size.height;
+    // Each tile of a delta takes at most "xx,yy,s;"
+    char board[(FIELD_MAX_WIDTH * FIELD_MAX_HEIGHT * 8) + 1];
+    int len = 0;
+
+    if(sweeper_state->needs_resync) {
+        len = snprintf(board, sizeof(board), "%d %d ", width, height);
+        for(int y = 0; y < height; y++) {
+            for(int x = 0; x < width; x++) {
+                board[len++] = tile_sprite(x, y, sweeper_state);
+            }
+        }
+        board[len] = '\0';
+        session_printf(session, MSGC_BOARD, "%s", board);
+    } else {
+        board[0] = '\0';
+        for(int i = 0; i < sweeper_state->num_dirty_tiles; i++) {
+            int x = sweeper_state->dirty_tiles[i] % width;
+            int y = sweeper_state->dirty_tiles[i] / width;
+            len += snprintf(board + len, sizeof(board) - len, "%d,%d,%c;", x, y, tile_sprite(x, y, sweeper_state));
+        }
+        session_printf(session, MSGC_BOARD_DELTA, "%s", board);
+    }
+
+    clear_dirty_tiles(sweeper_state);
+}
+
+/**
+ * Sends a series of strings to the client containing each row of the Minesweeper field.
+ * Clients using protocol v2 keep a copy of the field, so they are only sent the tiles that changed.
+ **/
+void draw_minesweeper_field(MinesweeperState *sweeper_state, struct session* session) {
+    if(session->protocol == PROTOCOL_V2) {
+        send_minesweeper_board(sweeper_state, session);
+        return;
+    }
+
+    int width = sweeper_state->field.size.width;
+    int height = sweeper_state->field.size.height;
+
+    // The column numbers, with the tens on a line of their own above the units once there are 10 columns or more
+    char tens[(FIELD_MAX_WIDTH * 2) + 6] = "   ";
+    char units[(FIELD_MAX_WIDTH * 2) + 6] = "   ";
+    char rule[(FIELD_MAX_WIDTH * 2) + 6];
+    for(int x = 0; x < width; x++) {
+        int column = x + 1;
+        tens[3 + (x * 2)] = ' ';
+        tens[4 + (x * 2)] = (column >= 10) ? '0' + (column / 10) : ' ';
+        units[3 + (x * 2)] = ' ';
+        units[4 + (x * 2)] = '0' + (column % 10);
+    }
+    tens[3 + (width * 2)] = '\n';
+    tens[4 + (width * 2)] = '\0';
+    units[3 + (width * 2)] = '\n';
+    units[4 + (width * 2)] = '\0';
+    memset(rule, '-', 3 + (width * 2));
+    rule[3 + (width * 2)] = '\n';
+    rule[4 + (width * 2)] = '\0';
+    if(width >= 10) {
+        session_printf(session, MSGC_PRINT, "%s", tens);
+    }
+    session_printf(session, MSGC_PRINT, "%s", units);
+    session_printf(session, MSGC_PRINT, "%s", rule);
+
+    // Draw the tiles that are revealed
+    for(int y = 0; y < height; y++) {
+        send_minesweeper_row(y, 'A' + y, sweeper_state, session);
+    }
+
+    clear_dirty_tiles(sweeper_state);
+}
+
+/**
+ * Check if the games played on a size of field are ranked on the leaderboard. The times taken on different sizes
+ * can't be compared, so only the Beginner field is ranked.
+ **/
+int field_ranked(FieldSize size) {
+    return size.width == FIELD_BEGINNER.width && size.height == FIELD_BEGINNER.height &&
+           size.num_mines == FIELD_BEGINNER.num_mines;
+}
+
+/**
+ * End the current Minesweeper game. The result is handed to the aggregator that adds it to the leaderboard, so
+ * the game never waits for the leaderboard.
+ **/
+void minesweeper_game_end(struct session* session, int game_won) {
+    MinesweeperState *sweeper_state = &session->sweeper_state;
+    sweeper_state->game_won = game_won;
+    sweeper_state->game_time_taken = time(NULL) - sweeper_state->game_start_time;
+    session->state = GAMEOVER;
+
+    int outcome = RESULT_LOST;
+    sweeper_state->game_rank = 0;
+    if(game_won) {
+        outcome = field_ranked(sweeper_state->field.size) ? RESULT_WON : RESULT_WON_UNRANKED;
+    }
+
+    // The result is usually yet to be added when the game over screen is drawn, so the rank shown is where the
+    // time places on the leaderboard as it is now. It is found without waiting for the leaderboard's lock.
+    if(outcome == RESULT_WON) {
+        sweeper_state->game_rank = leaderboard_score_rank(sweeper_state->username, (int)sweeper_state->game_time_taken);
+    }
+
+    results_submit(sweeper_state->username, (int)sweeper_state->game_time_taken, outcome);
+}
+
+/**
+ * Converts the coordinate sent by the client into a location in the Minesweeper field.
+ * Will let the client know if the coordinate is not valid.
+ *
+ * Returns a 1 if the conversion was successful
+ **/
+int receive_tile_coordinate(struct session* session, char* buffer, int size, int* x, int* y) {
+    // Check that two or three characters where sent (MSGC + A1 + \n = 4, MSGC + A12 + \n = 5)
+    if(size != 4 && size != 5) {
+        session_puts(session, MSGC_PRINT, "A coordinate is a letter and a number. Example: A1 or 1A, B12 or 12B.\n");
+        return 0;
+    }
+    char coord[4] = {buffer[1], buffer[2], (size == 5) ? buffer[3] : '\0', '\0'};
+
+    // Check if the coordinate matches to a valid number
+    if(!convert_coordinate(coord, x, y, &session->sweeper_state)) {
+        session_puts(session, MSGC_PRINT, "Coordinate does not exist.\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Receives the coordinate the user was prompted for. The given location in the Minesweeper field will then be revealed.
+ * If the revealed tile contained a mine, the game will be lost.
+ **/
+void tile_reveal_update(struct session* session, char* buffer, int size) {
+    MinesweeperState *sweeper_state = &session->sweeper_state;
+    session->state = PLAYING;
+
+    int x, y;
+    if(!receive_tile_coordinate(session, buffer, size, &x, &y)) {
+        return;
+    }
+
+    // Check if the tile has already been revealed
+    if(tile_revealed(x, y, sweeper_state)) {
+        session_puts(session, MSGC_PRINT, "This tile has already been revealed");
+    } else {
+        reveal_tile(x, y, sweeper_state);
+        // Check if the tile revealed was a mine
+        if(tile_has_mine(x, y, sweeper_state)) {
+            minesweeper_game_end(session, 0);
+        }
+    }
+}
+
+/**
+ * Receives the coordinate the user was prompted for. Will then match that coordinate to a location in the Minesweeper
+ * field and attempt to place a flag at that location.
+ * Flags will only be placed if there's a mine at that location. The user will be notified if the attempt was
+ * successful.
+ **/
+void tile_flag_update(struct session* session, char* buffer, int size) {
+    MinesweeperState *sweeper_state = &session->sweeper_state;
+    session->state = PLAYING;
+
+    int x, y;
+    if(!receive_tile_coordinate(session, buffer, size, &x, &y)) {
+        return;
+    }
+
+    // Place a flag at the location
+    if(!flag_tile(x, y, sweeper_state)) {
+        session_puts(session, MSGC_PRINT, "There is no mine at this location.\n");
+    }
+
+    // Check if the game was won
+    if(sweeper_state->mines_remaining == 0) {
+        minesweeper_game_end(session, 1);
+    }
+}
+
+/* ================================================= PLAYING SCREEN ================================================= */
+/**
+ * Draws the screen that is shown to the user while the Minesweeper game is being played
+ **/
+void draw_playing_screen(MinesweeperState *sweeper_state, struct session* session) {
+    session_puts(session, MSGC_PRINT, "------- Minesweeper -------\n");
+    session_puts(session, MSGC_PRINT, "\n");
+
+    // Send string calculating number of mines
+    session_printf(session, MSGC_PRINT, "Mines remaining: %d\n", sweeper_state->mines_remaining);
+    session_puts(session, MSGC_PRINT, "\n");
+
+    draw_minesweeper_field(sweeper_state, session);
+
+    session_puts(session, MSGC_PRINT, "\n");
+    session_puts(session, MSGC_PRINT, "Choose an option: \n");
+    session_puts(session, MSGC_PRINT, "(R)eveal tile\n");
+    session_puts(session, MSGC_PRINT, "(P)lace flag\n");
+    session_puts(session, MSGC_PRINT, "(Q)uit game\n");
+    session_puts(session, MSGC_PRINT, "\n");
+    session_puts(session, MSGC_INPUT, "Option (R,P,Q): ");
+}
+
+/**
+ * Receives input from the user in order to play the Minesweeper game.
+ * The main game loop.
+ **/
+void update_playing_screen(struct session* session, char *buffer) {
+    char input = buffer[1];
+
+    switch(input) {
+        case 'r':
+        case 'R':
+            session->state = PLAYING_REVEAL;
+            break;
+        case 'p':
+        case 'P':
+            session->state = PLAYING_FLAG;
+            break;
+        case 'q':
+        case 'Q':
+            minesweeper_game_end(session, 0);
+            session->state = MAIN_MENU;
+            break;
+        default:
+            session_puts(session, MSGC_PRINT, "Not a valid input! Choose a letter from (R, P, Q)\n");
+            break;
+    }
+}
+
+/* =================================================== MAIN MENU ==================================================== */
+/**
+ * Draws a screen that shows the user the viable options to select from the Main Menu
+ **/
+void draw_main_menu(struct session* session) {
+    session_puts(session, MSGC_PRINT, "Welcome to the Minesweeper gaming system.\n");
+    session_puts(session, MSGC_PRINT, "\n");
+    session_puts(session, MSGC_PRINT, "Please enter a selection:\n");
+    session_puts(session, MSGC_PRINT, "<1> Play Minesweeper\n");
+    session_puts(session, MSGC_PRINT, "<2> Show Leaderboard\n");
+    session_puts(session, MSGC_PRINT, "<3> Quit\n");
+    session_puts(session, MSGC_INPUT, "Selection Option (1-3): ");
+}
+
+/**
+ * Handles the input sent by the user.
+ * If the user sends a number between 1 and 3, the game's state will be updated accordingly
+ **/
+void update_main_menu(struct session* session, char* buffer) {
+    char input = buffer[1];
+
+    // Check if the selection is a number
+    if(isdigit(input)) {
+        // Convert to the proper integer, ex. '2' -> 2
+        int selection = input - '0';
+        switch(selection) {
+            case 1:
+                session->state = NEW_GAME;
+                break;
+            case 2:
+                session->highscore_view = LEADERBOARD_ALL_TIME;
+                session->highscore_page = 0;
+                session->state = HIGHSCORE;
+                break;
+            case 3:
+                // Send a message with a code that tells the client to exit and close the socket from their side
+                session_puts(session, MSGC_EXIT, "Thanks for playing! Disconnecting...\n");
+                session->state = EXIT;
+                break;
+            default:
+                session_puts(session, MSGC_PRINT, "Not a valid input! Choose a number between 1 and 3\n");
+                break;
+        }
+    }else {
+        session_puts(session, MSGC_PRINT, "Not a valid input! Choose a number between 1 and 3\n");
+    }
+}
+
+/* ================================================= NEW GAME SCREEN ================================================= */
+/**
+ * Starts a game on a field of the given size, taken from the board pool when one is ready
+ **/
+void start_game(struct session* session, FieldSize size) {
+    if(boards_take(&session->sweeper_state.field, size)) {
+        minesweeper_start(&session->sweeper_state);
+    } else {
+        minesweeper_init(&session->sweeper_state, size);
+    }
+    session->state = PLAYING;
+}
+
+/**
+ * Draws the sizes of field the user can pick from for a new game
+ **/
+void draw_new_game_screen(struct session* session) {
+    session_puts(session, MSGC_PRINT, "Please choose the size of the field:\n");
+    session_printf(session, MSGC_PRINT, "<1> Beginner (%dx%d, %d mines)\n", FIELD_BEGINNER.width, FIELD_BEGINNER.height,
+                   FIELD_BEGINNER.num_mines);
+    session_printf(session, MSGC_PRINT, "<2> Intermediate (%dx%d, %d mines)\n", FIELD_INTERMEDIATE.width,
+                   FIELD_INTERMEDIATE.height, FIELD_INTERMEDIATE.num_mines);
+    session_printf(session, MSGC_PRINT, "<3> Expert (%dx%d, %d mines)\n", FIELD_EXPERT.width, FIELD_EXPERT.height,
+                   FIELD_EXPERT.num_mines);
+    session_puts(session, MSGC_PRINT, "<4> Custom\n");
+    session_puts(session, MSGC_PRINT, "Only the games won on the Beginner field are ranked on the leaderboard.\n");
+    session_puts(session, MSGC_INPUT, "Selection Option (1-4, or <Enter> for Beginner): ");
+}
+
+/**
+ * Starts a game on the size of field picked, or asks for the size of a custom field
+ **/
+void update_new_game_screen(struct session* session, char* buffer) {
+    switch(buffer[1]) {
+        case '\n':
+        case '1':
+            start_game(session, FIELD_BEGINNER);
+            break;
+        case '2':
+            start_game(session, FIELD_INTERMEDIATE);
+            break;
+        case '3':
+            start_game(session, FIELD_EXPERT);
+            break;
+        case '4':
+            session->state = NEW_GAME_CUSTOM;
+            break;
+        default:
+            session_puts(session, MSGC_PRINT, "Not a valid input! Choose a number between 1 and 4\n");
+            break;
+    }
+}
+
+/**
+ * Starts a game on the custom field sent by the user, if it can be played
+ **/
+void update_custom_game(struct session* session, char* buffer) {
+    FieldSize size;
+    if(sscanf(buffer + 1, "%d %d %d", &size.width, &size.height, &size.num_mines) != 3 || !field_size_valid(size)) {
+        session_printf(session, MSGC_PRINT, "Not a valid field! The width can be %d to %d, the height %d to %d, "
+                       "with at least 1 mine and a free row and column.\n", FIELD_MIN_SIZE, FIELD_MAX_WIDTH,
+                       FIELD_MIN_SIZE, FIELD_MAX_HEIGHT);
+        session->state = NEW_GAME;
+        return;
+    }
+    start_game(session, size);
+}
+
+/* ================================================ HIGHSCORE SCREEN ================================================ */
+/**
+ * Lets go of the page a screen was showing once it has been sent
+ **/
+void release_highscore_page(void* data) {
+    leaderboard_page_put(data);
+}
+
+/**
+ * Get the rank the page around the user's best game in a view starts at, or 0 if they haven't won a game there.
+ * The session keeps it until the leaderboard changes, so showing the page again doesn't lock the leaderboard.
+ **/
+int highscore_around_first(struct session* session, int view, long now) {
+    struct highscore_around* around = &session->highscore_around;
+    if(around->cached && around->view == view && around->version == leaderboard_version() &&
+       (around->expires == 0 || now < around->expires)) {
+        return around->first_rank;
+    }
+
+    leaderboard_lock();
+    around->first_rank = leaderboard_around_first(view, session->username, HIGHSCORE_PAGE_SIZE, now);
+    around->version = leaderboard_version();
+    around->expires = leaderboard_view_expires(view, now);
+    leaderboard_unlock();
+    around->view = view;
+    around->cached = 1;
+    return around->first_rank;
+}
+
+/**
+ * Shows a page of the leaderboard. The page is rendered once for every reader of the version, and the screen refers
+ * to the rendered rows rather than copying them and holds on to the page until they have been sent.
+ **/
+void draw_highscore_screen(MinesweeperState *sweeper_state, struct session* session) {
+    long now = time(NULL);
+    int view = session->highscore_view;
+    const char* name = highscore_view_names[view];
+
+    // Where the user's best game is changes with every game added, so it is looked up again once one is
+    int first_rank = 0;
+    if(session->highscore_page == HIGHSCORE_AROUND_ME) {
+        first_rank = highscore_around_first(session, view, now);
+    }
+    int found = (first_rank > 0);
+    if(!found) {
+        first_rank = ((session->highscore_page > 0) ? session->highscore_page * HIGHSCORE_PAGE_SIZE : 0) + 1;
+    }
+    struct leaderboard_page* page = leaderboard_page_latest(view, first_rank, now);
+    // Going past the last page shows the last page
+    if(page->count == 0 && page->num_games > 0) {
+        first_rank = (page->num_games - 1) / HIGHSCORE_PAGE_SIZE * HIGHSCORE_PAGE_SIZE + 1;
+        leaderboard_page_put(page);
+        page = leaderboard_page_latest(view, first_rank, now);
+    }
+    // The page stays valid while the screen is sent, without holding up the games that end meanwhile
+    screen_hold(&session->screen, release_highscore_page, page);
+
+    if(page->num_games < 1) {
+        session_printf(session, MSGC_PRINT, "---- %s: the leaderboard is empty ----\n", name);
+        session_puts(session, MSGC_PRINT, "\n");
+        session_puts(session, MSGC_PRINT, "<a> All time  <h> Past hour  <d> Past day  <w> Past week\n");
+        session_puts(session, MSGC_INPUT, "Selection (or <Enter> to continue): ");
+        return;
+    }
+
+    if(session->highscore_page == HIGHSCORE_AROUND_ME && !found) {
+        session_puts(session, MSGC_PRINT, "You haven't won a game yet!\n");
+        session_puts(session, MSGC_PRINT, "\n");
+    }
+    // The next and previous pages are the ones after and before what is shown now
+    session->highscore_page = (page->first_rank - 1) / HIGHSCORE_PAGE_SIZE;
+
+    session_printf(session, MSGC_PRINT, "---- %s: #%d to #%d of %d ----\n", name, page->first_rank,
+                   page->first_rank + page->count - 1, page->num_games);
+    for(int i = 0; i < page->count; i++) {
+        screen_putn(&session->screen, MSGC_PRINT, page->rows[i].text, page->rows[i].size);
+    }
+    session_puts(session, MSGC_PRINT, "\n");
+    session_puts(session, MSGC_PRINT, "<n> Next page  <p> Previous page  <m> Around my best game\n");
+    session_puts(session, MSGC_PRINT, "<a> All time  <h> Past hour  <d> Past day  <w> Past week\n");
+    session_puts(session, MSGC_INPUT, "Selection (or <Enter> to continue): ");
+}
+
+/**
+ * Switches the leaderboard shown, starting from its first page
+ **/
+void switch_highscore_view(struct session* session, int view) {
+    session->highscore_view = view;
+    session->highscore_page = 0;
+}
+
+/**
+ * Moves between the pages and the leaderboards. Anything other than a selection goes back to the main menu.
+ **/
+void update_highscore_screen(struct session* session, char* buffer) {
+    switch(tolower(buffer[1])) {
+        case 'n':
+            // Going past the last page shows the last page again
+            session->highscore_page++;
+            break;
+        case 'p':
+            if(session->highscore_page > 0) {
+                session->highscore_page--;
+            }
+            break;
+        case 'm':
+            session->highscore_page = HIGHSCORE_AROUND_ME;
+            break;
+        case 'a':
+            switch_highscore_view(session, LEADERBOARD_ALL_TIME);
+            break;
+        case 'h':
+            switch_highscore_view(session, LEADERBOARD_PAST_HOUR);
+            break;
+        case 'd':
+            switch_highscore_view(session, LEADERBOARD_PAST_DAY);
+            break;
+        case 'w':
+            switch_highscore_view(session, LEADERBOARD_PAST_WEEK);
+            break;
+        default:
+            session->state = MAIN_MENU;
+            break;
+    }
+}
+
+/* ================================================ GAMEOVER SCREEN ================================================= */
+/**
+ * Draws the screen shown to the user when the game is finished (either through winning or losing)
+ **/
+void draw_gameover_screen(MinesweeperState *sweeper_state, struct session* session) {
+    session_puts(session, MSGC_PRINT, "------- Minesweeper -------\n");
+    session_puts(session, MSGC_PRINT, "\n");
+
+    if(sweeper_state->game_won) {
+        session_puts(session, MSGC_PRINT, "You've won!\n");
+
+        // Create string with time won
+        session_printf(session, MSGC_PRINT, "Time taken: %d seconds\n", (int)sweeper_state->game_time_taken);
+        if(sweeper_state->game_rank > 0) {
+            session_printf(session, MSGC_PRINT, "Leaderboard rank: #%d\n", sweeper_state->game_rank);
+        } else {
+            session_puts(session, MSGC_PRINT, "Only the games won on the Beginner field are ranked.\n");
+        }
+    } else {
+        session_puts(session, MSGC_PRINT, "Game Over! You've hit a mine\n");
+    }
+    session_puts(session, MSGC_PRINT, "\n");
+
+    show_mines(sweeper_state, sweeper_state->game_won);
+    draw_minesweeper_field(sweeper_state, session);
+
+    session_puts(session, MSGC_PRINT, "\n");
+    session_puts(session, MSGC_INPUT, "Press <Enter> to continue...\n");
+}
+
+/* ========================================== GAME LOOP AND STATE MACHINE =========================================== */
+/**
+ * Will call a draw function that depends on the current state of the game
+ **/
+void draw(struct session* session) {
+    switch(session->state) {
+        case LOGIN_USERNAME:
+            draw_login_screen(session);
+            return;
+        case LOGIN_PASSWORD:
+            session_puts(session, MSGC_INPUT, "Password: ");
+            return;
+        case PLAYING_REVEAL:
+        case PLAYING_FLAG:
+            session_puts(session, MSGC_INPUT, "Enter tile coordinate: ");
+            return;
+        case NEW_GAME_CUSTOM:
+            session_puts(session, MSGC_INPUT, "Enter the width, height and number of mines (eg. 20 12 40): ");
+            return;
+        case LOGIN_VERIFYING:
+        case EXIT:
+            return;
+        default:
+            break;
+    }
+
+    session_puts(session, MSGC_PRINT, "\n");
+    session_puts(session, MSGC_PRINT, "===========================================================\n");
+    session_puts(session, MSGC_PRINT, "\n");
+
+    switch(session->state) {
+        case MAIN_MENU:
+            draw_main_menu(session);
+            break;
+        case NEW_GAME:
+            draw_new_game_screen(session);
+            break;
+        case PLAYING:
+            draw_playing_screen(&session->sweeper_state, session);
+            break;
+        case GAMEOVER:
+            draw_gameover_screen(&session->sweeper_state, session);
+            break;
+        case HIGHSCORE:
+            draw_highscore_screen(&session->sweeper_state, session);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Displays the welcome screen and prompts the client for their username.
+ * Called once when a client connects.
+ **/
+void game_start(struct session* session) {
+    session->state = LOGIN_USERNAME;
+    draw(session);
+
+    // Send the whole screen to the client at once
+    if(session_present(session) < 0) {
+        session->state = EXIT;
+    }
+}
+
+/**
+ * Passes a message received from the client (message code included) to the update function of the
+ * screen the client is on and then draws the screen the game ends up on.
+ **/
+void game_update(struct session* session, char* buffer, int size) {
+    switch(session->state) {
+        case LOGIN_USERNAME:
+        case LOGIN_PASSWORD:
+            update_login(session, buffer);
+            break;
+        case MAIN_MENU:
+            update_main_menu(session, buffer);
+            break;
+        case NEW_GAME:
+            update_new_game_screen(session, buffer);
+            break;
+        case NEW_GAME_CUSTOM:
+            update_custom_game(session, buffer);
+            break;
+        case PLAYING:
+            update_playing_screen(session, buffer);
+            break;
+        case PLAYING_REVEAL:
+            tile_reveal_update(session, buffer, size);
+            break;
+        case PLAYING_FLAG:
+            tile_flag_update(session, buffer, size);
+            break;
+        case HIGHSCORE:
+            update_highscore_screen(session, buffer);
+            break;
+        case GAMEOVER:
+            session->state = MAIN_MENU;
+            break;
+        default:
+            return;
+    }
+
+    // Draw the screen representing the game state to the terminal
+    draw(session);
+
+    // Send the whole screen to the client at once. Check if the client is still connected.
+    if(session_present(session) < 0) {
+        session->state = EXIT;
+    }
+}
+
+/**
+ * Called by whoever drives the session once the authentication stage has checked the username and password.
+ * Tells the client whether it is logged in and draws the screen it ends up on.
+ **/
+void game_login_verified(struct session* session, int verified) {
+    // The password isn't needed anymore
+    memset(session->password, 0, sizeof(session->password));
+
+    if(verified) {
+        // The client has authorization to play the game
+        session_puts(session, MSGC_PRINT, "\n");
+        session_puts(session, MSGC_PRINT, "Login successful\n");
+        session_puts(session, MSGC_PRINT, "\n");
+        session->state = MAIN_MENU;
+    } else {
+        // The username and password were wrong
+        session_puts(session, MSGC_PRINT, "\n");
+        session_puts(session, MSGC_EXIT, "Username or password is incorrect. Disconnecting...\n");
+        session->state = EXIT;
+    }
+
+    draw(session);
+    if(session_present(session) < 0) {
+        session->state = EXIT;
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef GAME_H
+#define GAME_H
+
+#include "session.h"
+
+/**
+ * Displays the welcome screen and prompts the client for their username.
+ * Called once when a client connects.
+ **/
+void game_start(struct session* session);
+
+/**
+ * Passes a message received from the client (message code included) to the update function of the
+ * screen the client is on and then draws the screen the game ends up on. Everything shown to the client
+ * in response to the message is sent as a single screen.
+ *
+ * The game never waits on the client, so the same state machine can be driven by a worker thread
+ * blocking on the socket or by the reactor whenever a message arrives.
+ **/
+void game_update(struct session* session, char* buffer, int size);
+
+/**
+ * Once the client has sent its password the session is left on LOGIN_VERIFYING and whoever drives it submits
+ * session->auth to the authentication stage. Messages received until then are ignored.
+ *
+ * Called with the result once the login has been checked. Tells the client whether it is logged in and draws
+ * the screen it ends up on.
+ **/
+void game_login_verified(struct session* session, int verified);
+
+#endif // GAME_H
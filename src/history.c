@@ -0,0 +1,619 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+// Files
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "message.h"
+#include "leaderboard.h"
+#include "window.h"
+#include "results.h"
+#include "history.h"
+
+#define HISTORY_SNAPSHOT_MAGIC  "MSWPLB02"  // Starts every snapshot, changed whenever the layout changes
+
+/**
+ * The header of a result in the log, followed by the username (without a '\0')
+ **/
+struct history_record {
+    unsigned int checksum;          // CRC-32 of the rest of the header and the username
+    int time_taken;
+    unsigned long seq;              // The number of the result, counting from 1 since the history began
+    unsigned int username_size;
+    unsigned int outcome;           // One of RESULT_*, the logs from before there were unranked games only hold 0 or 1
+    long ended;                     // When the game ended, which places it in the windows
+};
+
+/**
+ * The header of a snapshot. It is followed by the users in order of id, the games in order of rank, the buckets of
+ * the windows and then the usernames, each ending with a '\0'.
+ **/
+struct history_snapshot {
+    char magic[8];
+    unsigned int checksum;          // CRC-32 of everything after the header
+    unsigned int num_users;
+    unsigned long seq;              // The last result the snapshot includes
+    unsigned long num_games;
+    unsigned long windows_size;     // How many bytes the buckets of the windows take
+    unsigned long names_size;       // How many bytes of usernames there are
+};
+
+struct history_snapshot_user {
+    unsigned long name_offset;      // Where the username starts after the users and the games
+    int games_won;
+    int games_played;
+};
+
+struct history_snapshot_game {
+    int user_id;
+    int time_taken;
+    int games_won;                  // How many games the user had won before this one, which breaks ties
+    int reserved;
+    unsigned long id;
+};
+
+/**
+ * A bucket of a window that isn't empty. It is followed by its games in the order they ended and its counts.
+ **/
+struct history_snapshot_bucket {
+    long slice;
+    unsigned int view;
+    unsigned int num_games;
+    unsigned int num_counts;
+    unsigned int reserved;
+};
+
+struct history_snapshot_count {
+    int user_id;
+    int games_played;
+    int games_won;
+    int reserved;
+};
+
+/**
+ * A snapshot copied out of the leaderboard, header included, to be written to the file once the lock is let go
+ **/
+struct history_image {
+    char* data;
+    size_t size;
+    size_t cap;
+};
+
+char* history_path = NULL;                  // The log
+char* history_snapshot_path = NULL;         // The latest snapshot, next to the log
+char* history_dir = NULL;                   // The directory holding them, synced once the snapshot is replaced
+int history_fd = -1;                        // The log, opened to append to it
+unsigned long history_seq = 0;              // The number of the last result logged
+unsigned long history_snapshot_seq = 0;     // The number of the last result in the latest snapshot
+
+char* history_buffer = NULL;                // The records waiting to be written
+size_t history_buffer_len = 0;
+size_t history_buffer_cap = 0;
+
+unsigned int history_crc_table[256];        // Speeds up the checksums, filled in by history_open
+
+struct history_stats history_stats = {0};
+
+/**
+ * Fill in the table used to compute the checksums (CRC-32, reflected polynomial 0xEDB88320)
+ **/
+void history_crc_init() {
+    for(unsigned int i = 0; i < 256; i++) {
+        unsigned int crc = i;
+        for(int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320U : crc >> 1;
+        }
+        history_crc_table[i] = crc;
+    }
+}
+
+/**
+ * Add bytes to a checksum. Start from 0, the checksum of nothing.
+ **/
+unsigned int history_crc(unsigned int crc, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    crc = ~crc;
+    for(size_t i = 0; i < size; i++) {
+        crc = history_crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/**
+ * Get the checksum of a record whose header (other than the checksum) and username are filled in
+ **/
+unsigned int history_record_crc(struct history_record* record, const char* username) {
+    unsigned int crc = history_crc(0, (char*)record + sizeof(record->checksum),
+                                   sizeof(struct history_record) - sizeof(record->checksum));
+    return history_crc(crc, username, record->username_size);
+}
+
+/**
+ * Map a whole file into memory
+ *
+ * Returns NULL if the file doesn't exist or is empty, size is set to its size
+ **/
+char* history_map(const char* path, size_t* size) {
+    *size = 0;
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) {
+        return NULL;
+    }
+    struct stat file_stat;
+    if(fstat(fd, &file_stat) == -1 || file_stat.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    char* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        return NULL;
+    }
+    *size = file_stat.st_size;
+    return data;
+}
+
+/**
+ * Restore the buckets of the windows saved in a snapshot
+ *
+ * Returns -1 if they are damaged
+ **/
+int history_load_windows(char* data, size_t size, unsigned int num_users) {
+    size_t pos = 0;
+    while(pos < size) {
+        struct history_snapshot_bucket* bucket = (struct history_snapshot_bucket*)(data + pos);
+        if(pos + sizeof(struct history_snapshot_bucket) > size || bucket->view >= LEADERBOARD_VIEWS ||
+           bucket->view == LEADERBOARD_ALL_TIME || bucket->slice < 0) {
+            return -1;
+        }
+        struct history_snapshot_game* games = (struct history_snapshot_game*)(bucket + 1);
+        struct history_snapshot_count* counts = (struct history_snapshot_count*)(games + bucket->num_games);
+        pos += sizeof(struct history_snapshot_bucket) + bucket->num_games * sizeof(struct history_snapshot_game) +
+               bucket->num_counts * sizeof(struct history_snapshot_count);
+        if(pos > size) {
+            return -1;
+        }
+
+        for(unsigned int i = 0; i < bucket->num_games; i++) {
+            if(games[i].user_id < 0 || games[i].user_id >= (int)num_users) {
+                return -1;
+            }
+            struct window_game game = {games[i].user_id, games[i].time_taken, games[i].games_won, games[i].id};
+            window_restore_game(bucket->view, bucket->slice, &game);
+        }
+        for(unsigned int i = 0; i < bucket->num_counts; i++) {
+            if(counts[i].user_id < 0 || counts[i].user_id >= (int)num_users) {
+                return -1;
+            }
+            window_restore_count(bucket->view, bucket->slice, counts[i].user_id, counts[i].games_played,
+                                 counts[i].games_won);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Restore the leaderboard from the latest snapshot. The games were saved in order of rank, so they are linked
+ * straight back in without being compared.
+ *
+ * Returns -1 if the snapshot is damaged
+ **/
+int history_load_snapshot() {
+    size_t size;
+    char* data = history_map(history_snapshot_path, &size);
+    if(data == NULL) {
+        return 0;
+    }
+
+    struct history_snapshot* header = (struct history_snapshot*)data;
+    if(size < sizeof(struct history_snapshot) || memcmp(header->magic, HISTORY_SNAPSHOT_MAGIC, 8) != 0) {
+        munmap(data, size);
+        return -1;
+    }
+    struct history_snapshot_user* users = (struct history_snapshot_user*)(data + sizeof(struct history_snapshot));
+    struct history_snapshot_game* games = (struct history_snapshot_game*)(users + header->num_users);
+    char* buckets = (char*)(games + header->num_games);
+    char* names = buckets + header->windows_size;
+    if(size != sizeof(struct history_snapshot) + header->num_users * sizeof(struct history_snapshot_user) +
+               header->num_games * sizeof(struct history_snapshot_game) + header->windows_size + header->names_size ||
+       (header->names_size > 0 && names[header->names_size - 1] != '\0') ||
+       history_crc(0, data + sizeof(struct history_snapshot), size - sizeof(struct history_snapshot)) != header->checksum) {
+        munmap(data, size);
+        return -1;
+    }
+
+    // The users are added in order of id so the games keep pointing to the right ones
+    for(unsigned int i = 0; i < header->num_users; i++) {
+        if(users[i].name_offset >= header->names_size ||
+           leaderboard_add_user(names + users[i].name_offset) != (int)i) {
+            munmap(data, size);
+            return -1;
+        }
+        struct user* user = leaderboard_user(i);
+        user->games_won = users[i].games_won;
+        user->games_played = users[i].games_played;
+    }
+    for(unsigned long i = 0; i < header->num_games; i++) {
+        if(games[i].user_id < 0 || games[i].user_id >= (int)header->num_users) {
+            munmap(data, size);
+            return -1;
+        }
+        leaderboard_restore_game(games[i].user_id, games[i].time_taken, games[i].games_won, games[i].id);
+    }
+    if(history_load_windows(buckets, header->windows_size, header->num_users) < 0) {
+        munmap(data, size);
+        return -1;
+    }
+
+    history_seq = header->seq;
+    history_snapshot_seq = header->seq;
+    history_stats.restored = header->seq;
+    munmap(data, size);
+    return 0;
+}
+
+/**
+ * Replay the results logged after the latest snapshot. The log ends at the first record that isn't whole, which
+ * is cut off so new records are appended after the last good one.
+ **/
+void history_replay_log() {
+    size_t size;
+    char* data = history_map(history_path, &size);
+    if(data == NULL) {
+        return;
+    }
+
+    char username[MESSAGE_MAX_SIZE];
+    size_t pos = 0;
+    while(pos + sizeof(struct history_record) <= size) {
+        // The records are packed one after the other, so the header is copied out to be aligned
+        struct history_record record;
+        memcpy(&record, data + pos, sizeof(record));
+        const char* name = data + pos + sizeof(struct history_record);
+        if(record.username_size >= sizeof(username) ||
+           pos + sizeof(struct history_record) + record.username_size > size ||
+           history_record_crc(&record, name) != record.checksum) {
+            break;
+        }
+
+        // Results that were already in the snapshot are skipped, as the server can stop before the log is emptied
+        if(record.seq > history_seq) {
+            memcpy(username, name, record.username_size);
+            username[record.username_size] = '\0';
+            results_record(username, record.time_taken, record.outcome, record.ended);
+            history_seq = record.seq;
+            history_stats.replayed++;
+        }
+        pos += sizeof(struct history_record) + record.username_size;
+    }
+    munmap(data, size);
+
+    if(pos < size) {
+        history_stats.dropped = size - pos;
+        if(truncate(history_path, pos) == -1) {
+            perror("Error cutting off the end of the leaderboard log");
+        }
+    }
+}
+
+/**
+ * Restore the leaderboard from the snapshot and the log, then open the log to append the new results.
+ * Must be called before anything else is added to the leaderboard.
+ *
+ * Returns -1 if the log couldn't be opened
+ **/
+int history_open(const char* path) {
+    struct timespec started, now;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    history_crc_init();
+
+    history_path = strdup(path);
+    history_snapshot_path = malloc(strlen(path) + sizeof(".snapshot"));
+    history_dir = malloc(strlen(path) + sizeof("."));
+    history_buffer_cap = HISTORY_BUFFER_SIZE;
+    history_buffer = malloc(history_buffer_cap);
+    if(!history_path || !history_snapshot_path || !history_dir || !history_buffer) {
+        perror("Error loading the leaderboard: out of memory");
+        exit(1);
+    }
+    sprintf(history_snapshot_path, "%s.snapshot", path);
+    strcpy(history_dir, path);
+    // The directory is whatever comes before the last '/', the current directory if there is none
+    char* slash = strrchr(history_dir, '/');
+    if(slash == NULL) {
+        strcpy(history_dir, ".");
+    } else {
+        slash[(slash == history_dir) ? 1 : 0] = '\0';
+    }
+
+    if(history_load_snapshot() < 0) {
+        fprintf(stderr, "The leaderboard snapshot %s is damaged\n", history_snapshot_path);
+        return -1;
+    }
+    history_replay_log();
+
+    history_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(history_fd == -1) {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    history_stats.load_ms = (now.tv_sec - started.tv_sec) * 1000L + (now.tv_nsec - started.tv_nsec) / 1000000L;
+    return 0;
+}
+
+/**
+ * Write everything in the buffer to the end of the log
+ **/
+void history_write() {
+    size_t written = 0;
+    while(written < history_buffer_len) {
+        ssize_t size = write(history_fd, history_buffer + written, history_buffer_len - written);
+        if(size < 0) {
+            perror("Error writing to the leaderboard log");
+            exit(1);
+        }
+        written += size;
+    }
+    history_buffer_len = 0;
+}
+
+/**
+ * Add the result of a game (one of RESULT_*) to the batch that will be written by the next history_commit
+ **/
+void history_add(const char* username, int time_taken, int outcome, long ended) {
+    struct history_record record;
+    memset(&record, 0, sizeof(record));
+    record.time_taken = time_taken;
+    record.seq = ++history_seq;
+    record.username_size = strlen(username);
+    record.outcome = outcome;
+    record.ended = ended;
+    record.checksum = history_record_crc(&record, username);
+
+    size_t size = sizeof(record) + record.username_size;
+    if(history_buffer_len + size > history_buffer_cap) {
+        history_write();
+    }
+    if(size > history_buffer_cap) {
+        history_buffer_cap = size;
+        history_buffer = realloc(history_buffer, history_buffer_cap);
+        if(!history_buffer) {
+            perror("Error logging the result: out of memory");
+            exit(1);
+        }
+    }
+    memcpy(history_buffer + history_buffer_len, &record, sizeof(record));
+    memcpy(history_buffer + history_buffer_len + sizeof(record), username, record.username_size);
+    history_buffer_len += size;
+    __atomic_add_fetch(&history_stats.records, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Write the batch to the log and wait until it is on the disk
+ **/
+void history_commit() {
+    if(history_buffer_len == 0) {
+        return;
+    }
+    history_write();
+    if(fdatasync(history_fd) == -1) {
+        perror("Error syncing the leaderboard log");
+        exit(1);
+    }
+    __atomic_add_fetch(&history_stats.syncs, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Add bytes to the end of a snapshot being copied out of the leaderboard
+ **/
+void history_image_add(struct history_image* image, const void* data, size_t size) {
+    if(image->size + size > image->cap) {
+        image->cap = (image->cap > 0) ? image->cap : HISTORY_BUFFER_SIZE;
+        while(image->size + size > image->cap) {
+            image->cap *= 2;
+        }
+        image->data = realloc(image->data, image->cap);
+        if(!image->data) {
+            perror("Error writing the leaderboard snapshot: out of memory");
+            exit(1);
+        }
+    }
+    memcpy(image->data + image->size, data, size);
+    image->size += size;
+}
+
+/**
+ * Copy every bucket of the windows that holds something into the snapshot
+ *
+ * Returns how many bytes were copied
+ **/
+size_t history_copy_windows(struct history_image* image) {
+    size_t size = 0;
+    for(int view = 0; view < LEADERBOARD_VIEWS; view++) {
+        for(int i = 0; i < window_num_buckets(view); i++) {
+            struct window_bucket* bucket = window_bucket_at(view, i);
+            if(bucket->num_games == 0 && bucket->num_counts == 0) {
+                continue;
+            }
+            struct history_snapshot_bucket saved = {bucket->slice, view, bucket->num_games, bucket->num_counts, 0};
+            history_image_add(image, &saved, sizeof(saved));
+            size += sizeof(saved);
+
+            for(int j = 0; j < bucket->num_games; j++) {
+                struct game* game = bucket->games[j];
+                struct history_snapshot_game saved_game = {game->user_id, game->time_taken, game->games_won, 0, game->id};
+                history_image_add(image, &saved_game, sizeof(saved_game));
+                size += sizeof(saved_game);
+            }
+            for(unsigned int j = 0; bucket->num_counts > 0 && j <= bucket->counts_mask; j++) {
+                struct window_count* count = &bucket->counts[j];
+                if(count->user != 0) {
+                    struct history_snapshot_count saved_count = {count->user - 1, count->games_played, count->games_won, 0};
+                    history_image_add(image, &saved_count, sizeof(saved_count));
+                    size += sizeof(saved_count);
+                }
+            }
+        }
+    }
+    return size;
+}
+
+/**
+ * Copy the whole leaderboard into a snapshot in memory. Must be called with the leaderboard locked.
+ **/
+void history_copy_snapshot(struct history_image* image) {
+    struct history_snapshot header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HISTORY_SNAPSHOT_MAGIC, 8);
+    header.num_users = get_userinfolist_size();
+    header.seq = history_seq;
+    header.num_games = get_gameinfo_size();
+    // The header is filled in once the sizes are known
+    history_image_add(image, &header, sizeof(header));
+
+    for(unsigned int i = 0; i < header.num_users; i++) {
+        struct user* user = leaderboard_user(i);
+        struct history_snapshot_user saved = {header.names_size, user->games_won, user->games_played};
+        history_image_add(image, &saved, sizeof(saved));
+        header.names_size += strlen(user->username) + 1;
+    }
+    for(struct game* gameinfo = leaderboard_game_at(1); gameinfo != NULL; gameinfo = leaderboard_game_next(gameinfo)) {
+        struct history_snapshot_game saved = {gameinfo->user_id, gameinfo->time_taken, gameinfo->games_won, 0, gameinfo->id};
+        history_image_add(image, &saved, sizeof(saved));
+    }
+    header.windows_size = history_copy_windows(image);
+    for(unsigned int i = 0; i < header.num_users; i++) {
+        const char* username = leaderboard_user(i)->username;
+        history_image_add(image, username, strlen(username) + 1);
+    }
+    memcpy(image->data, &header, sizeof(header));
+}
+
+/**
+ * Write a snapshot that was copied out of the leaderboard to a new file and empty the log. The snapshot is written
+ * to a temporary file that replaces the previous one once it is on the disk, so there is always a whole snapshot to
+ * start from.
+ **/
+void history_save_snapshot(struct history_image* image) {
+    // The checksum is only worked out now, so the leaderboard isn't held up by it
+    struct history_snapshot* header = (struct history_snapshot*)image->data;
+    header->checksum = history_crc(0, image->data + sizeof(struct history_snapshot),
+                                   image->size - sizeof(struct history_snapshot));
+
+    char* temp_path = malloc(strlen(history_snapshot_path) + sizeof(".tmp"));
+    if(!temp_path) {
+        perror("Error writing the leaderboard snapshot: out of memory");
+        exit(1);
+    }
+    sprintf(temp_path, "%s.tmp", history_snapshot_path);
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1) {
+        perror("Error writing the leaderboard snapshot");
+        free(temp_path);
+        return;
+    }
+
+    size_t written = 0;
+    while(written < image->size) {
+        ssize_t size = write(fd, image->data + written, image->size - written);
+        if(size < 0) {
+            perror("Error writing the leaderboard snapshot");
+            exit(1);
+        }
+        written += size;
+    }
+    if(fsync(fd) == -1) {
+        perror("Error writing the leaderboard snapshot");
+        exit(1);
+    }
+    close(fd);
+    if(rename(temp_path, history_snapshot_path) == -1) {
+        perror("Error replacing the leaderboard snapshot");
+        free(temp_path);
+        return;
+    }
+    free(temp_path);
+    history_snapshot_seq = header->seq;
+
+    // The rename has to be on the disk before the log is emptied, or a crash could leave the previous snapshot with
+    // an empty log. If it can't be synced the log is kept, and the results already in the snapshot are skipped.
+    int dir_fd = open(history_dir, O_RDONLY | O_DIRECTORY);
+    if(dir_fd == -1 || fsync(dir_fd) == -1) {
+        perror("Error syncing the leaderboard snapshot's directory");
+        if(dir_fd != -1) {
+            close(dir_fd);
+        }
+        return;
+    }
+    close(dir_fd);
+    if(ftruncate(history_fd, 0) == -1) {
+        perror("Error emptying the leaderboard log");
+    }
+    __atomic_add_fetch(&history_stats.snapshots, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Write the whole leaderboard to a new snapshot and empty the log. The leaderboard is only locked while it is
+ * copied, the file is written and synced once the lock is let go.
+ **/
+void history_write_snapshot() {
+    struct history_image image = {NULL, 0, 0};
+    leaderboard_lock();
+    history_copy_snapshot(&image);
+    leaderboard_unlock();
+
+    history_save_snapshot(&image);
+    free(image.data);
+}
+
+/**
+ * Write a snapshot of the leaderboard if enough results were logged since the last one. Must be called after the
+ * committed results were added to the leaderboard, with the leaderboard unlocked and before any more are logged.
+ **/
+void history_checkpoint() {
+    if(history_seq - history_snapshot_seq >= HISTORY_SNAPSHOT_RECORDS) {
+        history_write_snapshot();
+    }
+}
+
+/**
+ * Write a last snapshot and close the log. Must be called before the leaderboard is freed.
+ **/
+void history_close() {
+    if(history_fd == -1) {
+        return;
+    }
+    history_commit();
+    if(history_seq != history_snapshot_seq) {
+        history_write_snapshot();
+    }
+    close(history_fd);
+    history_fd = -1;
+
+    free(history_path);
+    free(history_snapshot_path);
+    free(history_dir);
+    free(history_buffer);
+    history_path = NULL;
+    history_snapshot_path = NULL;
+    history_dir = NULL;
+    history_buffer = NULL;
+    history_buffer_len = 0;
+}
+
+/**
+ * Get a copy of the counters
+ **/
+void history_stats_get(struct history_stats* stats) {
+    // The counters of the startup don't change once the server is running
+    *stats = history_stats;
+    stats->records = __atomic_load_n(&history_stats.records, __ATOMIC_RELAXED);
+    stats->syncs = __atomic_load_n(&history_stats.syncs, __ATOMIC_RELAXED);
+    stats->snapshots = __atomic_load_n(&history_stats.snapshots, __ATOMIC_RELAXED);
+}
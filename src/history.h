@@ -0,0 +1,68 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+/**
+ * The history keeps the leaderboard across restarts.
+ *
+ * Every result is appended to a log before it is added to the leaderboard. Each record carries a checksum, so a
+ * record that was only partly written when the server stopped is noticed and dropped. The results are written and
+ * synced to the disk in batches (group commit), so a burst of games ending costs a single fsync.
+ *
+ * Every so often the whole leaderboard is copied to a compact binary snapshot, which is written out once the
+ * leaderboard's lock is let go, and the log is emptied once the snapshot is on the disk. At startup the snapshot is
+ * mapped into memory and the games are linked back in the order they were saved, then only the results logged after
+ * the snapshot are replayed.
+ **/
+
+#define HISTORY_SNAPSHOT_RECORDS    100000      // How many results are logged before a new snapshot is written
+#define HISTORY_BUFFER_SIZE         65536       // How many bytes of records are gathered before they are written
+
+/**
+ * Counters that show what was restored and how much was written
+ **/
+struct history_stats {
+    unsigned long restored;     // How many results were covered by the snapshot loaded at startup
+    unsigned long replayed;     // How many results were replayed from the log at startup
+    unsigned long dropped;      // How many bytes at the end of the log were dropped as they were not whole records
+    long load_ms;               // How long loading the history took at startup
+    unsigned long records;      // How many results were logged since startup
+    unsigned long syncs;        // How many times the log was synced to the disk
+    unsigned long snapshots;    // How many snapshots were written since startup
+};
+
+/**
+ * Restore the leaderboard from the snapshot and the log, then open the log to append the new results.
+ * Must be called before anything else is added to the leaderboard.
+ *
+ * Returns -1 if the log couldn't be opened
+ **/
+int history_open(const char* path);
+
+/**
+ * Add the result of a game (one of RESULT_*) to the batch that will be written by the next history_commit
+ **/
+void history_add(const char* username, int time_taken, int outcome, long ended);
+
+/**
+ * Write the batch to the log and wait until it is on the disk
+ **/
+void history_commit();
+
+/**
+ * Write a snapshot of the leaderboard if enough results were logged since the last one. Must be called after the
+ * committed results were added to the leaderboard, with the leaderboard unlocked and before any more are logged.
+ * The leaderboard is only locked while the snapshot is copied out of it.
+ **/
+void history_checkpoint();
+
+/**
+ * Write a last snapshot and close the log. Must be called before the leaderboard is freed.
+ **/
+void history_close();
+
+/**
+ * Get a copy of the counters
+ **/
+void history_stats_get(struct history_stats* stats);
+
+#endif // HISTORY_H
@@ -1,48 +1,268 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
+// Threads
+#include <pthread.h>
 
 #include "leaderboard.h"
+#include "window.h"
+
+#define LEADERBOARD_MAX_LEVEL   32      // Enough levels for billions of won games
+#define LEADERBOARD_LEVEL_ODDS  4       // A game linked into a level is also linked into the next one 1 time in 4
+#define USERNAME_CHUNK_SIZE     65536   // How many bytes of usernames each chunk of the arena holds
+#define USERINFO_SLOTS_MIN      64      // How many slots the user table starts with
+#define PAGE_SLOTS_BITS         6       // Each view caches up to 64 pages
 
 // Contains each user's number of games 
-int userinfo_size = 0;  // How many clients are waiting to connect
-// Contains each won game
-int gameinfo_size = 0;  // How many clients are waiting to connect
+int userinfo_size = 0;  // How many users are in the leaderboard
+
+/**
+ * A chunk of the arena the usernames are interned into. Usernames are never removed, so they are packed one
+ * after the other and the chunks are only freed along with the leaderboard.
+ **/
+struct username_chunk {
+    struct username_chunk* next;    // The chunk that was filled before this one
+    size_t used;                    // How many bytes of the chunk hold usernames
+    size_t size;
+    char names[];
+};
+
+/**
+ * A slot of the user table. Empty slots have no user.
+ **/
+struct user_slot {
+    unsigned int hash;              // The hash of the username, so most mismatches don't need a strcmp
+    int user_id;                    // The user's index in the user info array plus 1, 0 if the slot is empty
+};
+
+struct user* userinfo = NULL;                // The user details, indexed by user id
+int userinfo_capacity = 0;                   // How many users fit in the array
+struct user_slot* userinfo_slots = NULL;     // Open addressing table that finds a user id from a username
+unsigned int userinfo_mask = 0;              // The number of slots minus 1 (it is a power of 2)
+struct username_chunk* usernames = NULL;     // The chunk of the arena usernames are interned into
 
-struct user* head_userinfo = NULL;   // HEAD of the linked list of the user details
-struct user* tail_userinfo = NULL;   // TAIL of the linked list of the user details
+struct game_list gameinfo_list = {NULL, NULL, 1, 0};    // Every won game, ranked
+unsigned long gameinfo_next_id = 0;  // The id given to the next won game
+unsigned long gameinfo_random = 88172645463325252UL;    // The state of the generator picking the height of each game
+struct game* restore_tails[LEADERBOARD_MAX_LEVEL];      // The last game linked into each level while restoring
+int restore_ranks[LEADERBOARD_MAX_LEVEL];               // The rank of each of those games
 
-struct game* head_gameinfo = NULL;   // HEAD of the linked list of the queue of clients
-struct game* tail_gameinfo = NULL;   // TAIL of the linked list of the queue of clients
+pthread_mutex_t leaderboard_mutex = PTHREAD_MUTEX_INITIALIZER;   // Serialises updating the leaderboard and reading it
+unsigned long leaderboard_changes = 0;                  // The version of the leaderboard, bumped by every update
+unsigned long leaderboard_seq = 0;                      // Odd while the all-time games or a user's record are changed
+struct leaderboard_page* leaderboard_pages[LEADERBOARD_VIEWS][1 << PAGE_SLOTS_BITS];  // The cached pages, by first rank
+unsigned int page_epoch = 0;                            // Picks which of the reader counters new readers use
+int page_readers[2] = {0, 0};                           // How many readers are taking a reference, by epoch
 
 /**
  * Fress all of the memory allocated to the nodes in the two lists. Will also set the head and 
  * tail pointers to NULL.
  **/
 void leaderboard_free() {
-    // Free the user info list
-    struct user* userinfo;
-    while(head_userinfo != NULL) {
-        userinfo = head_userinfo;
-        head_userinfo = head_userinfo->next;
-
-        userinfo->next = NULL;
-        free(userinfo);
+    // Free the user info table and the usernames
+    free(userinfo);
+    userinfo = NULL;
+    userinfo_capacity = 0;
+    free(userinfo_slots);
+    userinfo_slots = NULL;
+    userinfo_mask = 0;
+    while(usernames != NULL) {
+        struct username_chunk* chunk = usernames;
+        usernames = chunk->next;
+        free(chunk);
     }
 
     // Free the game info list
-    struct game* gameinfo;
-    while(head_gameinfo != NULL) {
-        gameinfo = head_gameinfo;
-        head_gameinfo = head_gameinfo->next;
+    game_list_free(&gameinfo_list);
+    gameinfo_next_id = 0;
+    userinfo_size = 0;
+
+    // Let go of the cached pages, the readers are expected to be gone
+    for(int view = 0; view < LEADERBOARD_VIEWS; view++) {
+        for(int slot = 0; slot < (1 << PAGE_SLOTS_BITS); slot++) {
+            leaderboard_page_put(__atomic_exchange_n(&leaderboard_pages[view][slot], NULL, __ATOMIC_SEQ_CST));
+        }
+    }
+}
+
+/**
+ * Wait until no reader can still be taking a reference to the page that was just replaced, or looking at the user
+ * table that was just replaced. A reader that got hold of it announced itself on the counter of the epoch it saw,
+ * which is either the current epoch or the one before it. The counter of the previous epoch is drained first, then
+ * the epoch moves on so that new readers use the other counter and the counter of the current epoch drains as well.
+ * Readers only stay on a counter for as long as it takes to take a reference or find a rank, so this never waits
+ * on a reader's network.
+ **/
+void leaderboard_synchronize() {
+    unsigned int epoch = __atomic_load_n(&page_epoch, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&page_readers[(epoch + 1) & 1], __ATOMIC_SEQ_CST) > 0) {
+        sched_yield();
+    }
+    __atomic_store_n(&page_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&page_readers[epoch & 1], __ATOMIC_SEQ_CST) > 0) {
+        sched_yield();
+    }
+}
+
+/**
+ * Announce a reader that doesn't lock, so nothing it can get hold of is freed until leaderboard_read_end.
+ *
+ * Returns the counter the reader was announced on
+ **/
+int* leaderboard_read_begin() {
+    unsigned int epoch = __atomic_load_n(&page_epoch, __ATOMIC_SEQ_CST);
+    int* readers = &page_readers[epoch & 1];
+    __atomic_add_fetch(readers, 1, __ATOMIC_SEQ_CST);
+    return readers;
+}
+
+/**
+ * Let leaderboard_synchronize know the reader is done
+ **/
+void leaderboard_read_end(int* readers) {
+    __atomic_sub_fetch(readers, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Start changing the all-time games or a user's record. Readers that don't lock retry if they overlapped with it.
+ **/
+void leaderboard_write_begin() {
+    __atomic_store_n(&leaderboard_seq, leaderboard_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Finish changing the all-time games or a user's record
+ **/
+void leaderboard_write_end() {
+    __atomic_store_n(&leaderboard_seq, leaderboard_seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Hashes a username (FNV-1a)
+ **/
+unsigned int username_hash(const char* username) {
+    unsigned int hash = 2166136261U;
+    for(const unsigned char* c = (const unsigned char*)username; *c != '\0'; c++) {
+        hash ^= *c;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/**
+ * Find the slot of the user table that holds the username, or the empty slot it would go in
+ **/
+struct user_slot* leaderboard_find_slot(const char* username, unsigned int hash) {
+    unsigned int i = hash & userinfo_mask;
+    while(userinfo_slots[i].user_id != 0) {
+        struct user_slot* slot = &userinfo_slots[i];
+        if(slot->hash == hash && strcmp(userinfo[slot->user_id - 1].username, username) == 0) {
+            break;
+        }
+        i = (i + 1) & userinfo_mask;
+    }
+    return &userinfo_slots[i];
+}
+
+/**
+ * Double the number of slots of the user table and put every user back in. The new table is filled before it
+ * replaces the old one, which is freed once no reader can still be looking at it.
+ **/
+void leaderboard_grow_slots() {
+    unsigned int num_slots = (userinfo_slots == NULL) ? USERINFO_SLOTS_MIN : (userinfo_mask + 1) * 2;
+    struct user_slot* slots = calloc(num_slots, sizeof(struct user_slot));
+    if(!slots) {
+        perror("Error adding user to the leaderboard: out of memory");
+        exit(1);
+    }
+
+    for(int id = 0; id < userinfo_size; id++) {
+        unsigned int hash = username_hash(userinfo[id].username);
+        unsigned int i = hash & (num_slots - 1);
+        while(slots[i].user_id != 0) {
+            i = (i + 1) & (num_slots - 1);
+        }
+        slots[i].hash = hash;
+        slots[i].user_id = id + 1;
+    }
+
+    // The slots go before the mask, so a reader that sees the larger mask also sees the larger table
+    struct user_slot* old = userinfo_slots;
+    __atomic_store_n(&userinfo_slots, slots, __ATOMIC_RELEASE);
+    __atomic_store_n(&userinfo_mask, num_slots - 1, __ATOMIC_RELEASE);
+    if(old != NULL) {
+        leaderboard_synchronize();
+        free(old);
+    }
+}
+
+/**
+ * Double the size of the user info array. The users are copied into a new array, and the old one is freed once no
+ * reader can still be looking at it.
+ **/
+void leaderboard_grow_users() {
+    int capacity = (userinfo_capacity == 0) ? USERINFO_SLOTS_MIN : userinfo_capacity * 2;
+    struct user* users = malloc(capacity * sizeof(struct user));
+    if(!users) {
+        perror("Error adding user to the leaderboard: out of memory");
+        exit(1);
+    }
+    if(userinfo_size > 0) {
+        memcpy(users, userinfo, userinfo_size * sizeof(struct user));
+    }
+
+    struct user* old = userinfo;
+    __atomic_store_n(&userinfo, users, __ATOMIC_RELEASE);
+    userinfo_capacity = capacity;
+    if(old != NULL) {
+        leaderboard_synchronize();
+        free(old);
+    }
+}
+
+/**
+ * Copy a username into the arena, where it stays until the leaderboard is freed
+ **/
+const char* leaderboard_intern(const char* username) {
+    size_t size = strlen(username) + 1;
+    if(usernames == NULL || usernames->used + size > usernames->size) {
+        size_t chunk_size = (size > USERNAME_CHUNK_SIZE) ? size : USERNAME_CHUNK_SIZE;
+        struct username_chunk* chunk = malloc(sizeof(struct username_chunk) + chunk_size);
+        if(!chunk) {
+            perror("Error adding user to the leaderboard: out of memory");
+            exit(1);
+        }
+        chunk->next = usernames;
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        usernames = chunk;
+    }
 
-        gameinfo->next = NULL;
-        free(gameinfo);
+    char* interned = usernames->names + usernames->used;
+    memcpy(interned, username, size);
+    usernames->used += size;
+    return interned;
+}
+
+/**
+ * Get the id of a user in the leaderboard.
+ * Returns -1 if the username is not in the leaderboard.
+ **/
+int leaderboard_user_id(char* username) {
+    if(userinfo_slots == NULL) {
+        return -1;
     }
+    struct user_slot* slot = leaderboard_find_slot(username, username_hash(username));
+    return slot->user_id - 1;
+}
 
-    // Set tail pointers to NULL
-    tail_gameinfo = NULL;
-    tail_userinfo = NULL;
+/**
+ * Get the details of the user with the given id. Only valid until another user is added.
+ **/
+struct user* leaderboard_user(int user_id) {
+    return &userinfo[user_id];
 }
 
 /**
@@ -51,142 +271,294 @@ void leaderboard_free() {
  *          0   If no username was found in the leaderboard
  **/
 int username_exists(char* username) {
-    // Iterate through the list while checking if the usernames match the one that was passed
-    struct user* userinfo = head_userinfo;
-    while(userinfo != NULL) {
-        if(strcmp(username, userinfo->username) == 0) {
-            return 1;
+    return leaderboard_user_id(username) >= 0;
+}
+
+/**
+ * Get the id of a user, adding the user to the leaderboard with no games played if the username is new.
+ * The username is interned so the leaderboard never points to the session's copy.
+ **/
+int leaderboard_add_user(char* username) {
+    // Keep the table at most half full
+    if(userinfo_slots == NULL || (unsigned int)(userinfo_size + 1) * 2 > userinfo_mask + 1) {
+        leaderboard_grow_slots();
+    }
+
+    unsigned int hash = username_hash(username);
+    struct user_slot* slot = leaderboard_find_slot(username, hash);
+    if(slot->user_id != 0) {
+        return slot->user_id - 1;
+    }
+
+    if(userinfo_size == userinfo_capacity) {
+        leaderboard_grow_users();
+    }
+
+    // The user is filled in before the slot points to it, for the readers that don't lock
+    int user_id = userinfo_size++;
+    userinfo[user_id].username = leaderboard_intern(username);
+    userinfo[user_id].games_played = 0;
+    userinfo[user_id].games_won = 0;
+    userinfo[user_id].best = NULL;
+    slot->hash = hash;
+    __atomic_store_n(&slot->user_id, user_id + 1, __ATOMIC_RELEASE);
+    return user_id;
+}
+
+/**
+ * Allocate a won game that is linked into the given number of levels
+ **/
+struct game* leaderboard_new_game(int height) {
+    struct game* gameinfo = calloc(1, sizeof(struct game) + height * sizeof(struct game_link));
+    if(!gameinfo) {
+        perror("Error adding score to the leaderboard: out of memory");
+        exit(1);
+    }
+    gameinfo->height = height;
+    return gameinfo;
+}
+
+/**
+ * Pick how many levels a new game is linked into. Each level holds about a quarter of the games of the level
+ * below it. Uses its own generator (xorshift) so the games keep getting the same fields.
+ **/
+int leaderboard_random_height() {
+    int height = 1;
+    while(height < LEADERBOARD_MAX_LEVEL) {
+        gameinfo_random ^= gameinfo_random << 13;
+        gameinfo_random ^= gameinfo_random >> 7;
+        gameinfo_random ^= gameinfo_random << 17;
+        if(gameinfo_random % LEADERBOARD_LEVEL_ODDS != 0) {
+            break;
         }
-        userinfo = userinfo->next;
+        height++;
     }
+    return height;
+}
 
+/**
+ * Compare the rank of two won games
+ * Return   <0  If game a ranks above game b
+ *          0   If they are the same game
+ *          >0  If game a ranks below game b
+ **/
+int leaderboard_compare(struct game* a, struct game* b) {
+    // The fastest time ranks first
+    if(a->time_taken != b->time_taken) {
+        return (a->time_taken < b->time_taken) ? -1 : 1;
+    }
+    // Whoever has won more games ranks first
+    if(a->games_won != b->games_won) {
+        return (a->games_won > b->games_won) ? -1 : 1;
+    }
+    // The latest game ranks first
+    if(a->id != b->id) {
+        return (a->id > b->id) ? -1 : 1;
+    }
     return 0;
 }
 
 /**
- * Add a user to the list so their records can be tracked. 
- * As this function is only meant to be called when updating records, and to avoid adding
- * another iteration through the list, this function assumes the username is unique (ie. 
- * already checked by the function that calls this one).
+ * Allocate a won game, picking how many levels of a skiplist it is linked into
  **/
-void leaderboard_add_user(char* username, int game_won) {
-    // Create the game structure
-    struct user* userinfo = (struct user*)malloc(sizeof(struct user));
-    if(!userinfo) {
-        perror("Error adding user to the leaderboard: out of memory");
-        exit(1);
+struct game* game_new(int user_id, int time_taken, int games_won, unsigned long id) {
+    struct game* game = leaderboard_new_game(leaderboard_random_height());
+    game->user_id = user_id;
+    game->time_taken = time_taken;
+    game->games_won = games_won;
+    game->id = id;
+    return game;
+}
+
+/**
+ * Link a game into a list in order of rank in O(log n)
+ *
+ * Returns the rank of the game (1 is the best)
+ **/
+int game_list_insert(struct game_list* list, struct game* game) {
+    if(list->head == NULL) {
+        __atomic_store_n(&list->head, leaderboard_new_game(LEADERBOARD_MAX_LEVEL), __ATOMIC_RELEASE);
+    }
+
+    // Find the last game ranked above the new one on every level, along with its rank
+    struct game* update[LEADERBOARD_MAX_LEVEL];
+    int rank[LEADERBOARD_MAX_LEVEL];
+    struct game* game_iterator = list->head;
+    for(int level = list->levels - 1; level >= 0; level--) {
+        rank[level] = (level == list->levels - 1) ? 0 : rank[level + 1];
+        while(game_iterator->links[level].next != NULL &&
+              leaderboard_compare(game_iterator->links[level].next, game) < 0) {
+            rank[level] += game_iterator->links[level].span;
+            game_iterator = game_iterator->links[level].next;
+        }
+        update[level] = game_iterator;
+    }
+
+    // The levels that weren't in use yet start from the header, which skips over every game
+    if(game->height > list->levels) {
+        for(int level = list->levels; level < game->height; level++) {
+            rank[level] = 0;
+            update[level] = list->head;
+            list->head->links[level].span = list->size;
+        }
+        list->levels = game->height;
     }
-    userinfo->username = username;
-    userinfo->games_played = 1;
-    userinfo->games_won = game_won;
 
-    // Add the user to the user info list
-    if(userinfo_size == 0) {
-        head_userinfo = userinfo;
-        tail_userinfo = userinfo;
+    // Link the game in after those games, splitting the spans they had around it. The game's own links are set
+    // before it is linked in, so a reader that doesn't lock (see leaderboard_score_rank) never follows a bad one.
+    for(int level = 0; level < game->height; level++) {
+        game->links[level].next = update[level]->links[level].next;
+        __atomic_store_n(&update[level]->links[level].next, game, __ATOMIC_RELEASE);
+        game->links[level].span = update[level]->links[level].span - (rank[0] - rank[level]);
+        update[level]->links[level].span = (rank[0] - rank[level]) + 1;
+    }
+    // The links above the game now skip over one more game
+    for(int level = game->height; level < list->levels; level++) {
+        update[level]->links[level].span++;
+    }
+
+    game->prev = (update[0] == list->head) ? NULL : update[0];
+    if(game->links[0].next != NULL) {
+        game->links[0].next->prev = game;
     } else {
-        tail_userinfo->next = userinfo;
-        tail_userinfo = userinfo;
+        list->tail = game;
     }
-    userinfo_size++;
+    list->size++;
+    return rank[0] + 1;
 }
 
 /**
- * Add a record of a won game to the leaderboard. This new score is automatically
- * sorted during the insert operation following rules set by the task sheet.
+ * Unlink a game from a list in O(log n). The game isn't freed.
  **/
-void leaderboard_add_score(char* username, int time_taken) {
-    // Create the game structure
-    struct game* gameinfo = (struct game*)malloc(sizeof(struct game));
-    if(!gameinfo) {
-        perror("Error adding score to the leaderboard: out of memory");
-        exit(1);
+void game_list_remove(struct game_list* list, struct game* game) {
+    // Find the last game ranked above it on every level
+    struct game* update[LEADERBOARD_MAX_LEVEL];
+    struct game* game_iterator = list->head;
+    for(int level = list->levels - 1; level >= 0; level--) {
+        while(game_iterator->links[level].next != NULL &&
+              leaderboard_compare(game_iterator->links[level].next, game) < 0) {
+            game_iterator = game_iterator->links[level].next;
+        }
+        update[level] = game_iterator;
+    }
+
+    // The links to the game take over its spans, the links above it skip over one game fewer
+    for(int level = 0; level < list->levels; level++) {
+        if(level < game->height) {
+            update[level]->links[level].span += game->links[level].span - 1;
+            update[level]->links[level].next = game->links[level].next;
+        } else {
+            update[level]->links[level].span--;
+        }
+    }
+    while(list->levels > 1 && list->head->links[list->levels - 1].next == NULL) {
+        list->levels--;
     }
-    gameinfo->username = username;
-    gameinfo->time_taken = time_taken;
 
-    // Add the score to the game info leaderboard
-    if(gameinfo_size == 0) {
-        // Just add the score if the list is empty
-        head_gameinfo = gameinfo;
-        gameinfo_size++;
+    if(game->links[0].next != NULL) {
+        game->links[0].next->prev = game->prev;
     } else {
-        // Check if the score is should be at the top of the list
-        if(gameinfo->time_taken > head_gameinfo->time_taken) {
-            gameinfo->next = head_gameinfo;
-            head_gameinfo = gameinfo;
-            gameinfo_size++;
-            return;
+        list->tail = game->prev;
+    }
+    list->size--;
+}
+
+/**
+ * Free every game of a list along with its header
+ **/
+void game_list_free(struct game_list* list) {
+    // Every game is linked on level 0 after the header
+    if(list->head != NULL) {
+        struct game* game = list->head->links[0].next;
+        while(game != NULL) {
+            struct game* next = game->links[0].next;
+            free(game);
+            game = next;
         }
+        free(list->head);
+    }
+    list->head = NULL;
+    list->tail = NULL;
+    list->levels = 1;
+    list->size = 0;
+}
 
-        // The data for the user who just won a game
-        int user_games_won, user_games_played;
-        // The data for the current score in the list
-        int iterator_games_won, iterator_games_played;
-
-        // Check if the score at the top of the list is equal to the user's score
-        if(gameinfo->time_taken == head_gameinfo->time_taken) {
-            get_userinfo(gameinfo->username, &user_games_played, &user_games_won);
-            get_userinfo(head_gameinfo->username, &iterator_games_played, &iterator_games_won);
-            // Place the user at the top of the list if they've won less games
-            if(user_games_won < iterator_games_won) {
-                gameinfo->next = head_gameinfo;
-                head_gameinfo = gameinfo;
-                gameinfo_size++;
-                return;
-            }
+/**
+ * Add a record of a won game to the leaderboard. This new score is automatically
+ * sorted during the insert operation following rules set by the task sheet.
+ *
+ * Returns the rank of the new score (1 is the best)
+ **/
+int leaderboard_add_score(char* username, int time_taken) {
+    leaderboard_write_begin();
+
+    // Create the game structure. Ties are broken by how many games the user had won until now.
+    int games_played, games_won;
+    get_userinfo(username, &games_played, &games_won);
+    struct game* gameinfo = game_new(leaderboard_add_user(username), time_taken, games_won, gameinfo_next_id++);
+
+    int rank = game_list_insert(&gameinfo_list, gameinfo);
+    struct user* user = &userinfo[gameinfo->user_id];
+    if(user->best == NULL || leaderboard_compare(gameinfo, user->best) < 0) {
+        user->best = gameinfo;
+    }
+    leaderboard_write_end();
+    __atomic_add_fetch(&leaderboard_changes, 1, __ATOMIC_RELEASE);
+    return rank;
+}
+
+/**
+ * Add a won game to the end of the leaderboard in O(1), for restoring a leaderboard that was saved. The games must
+ * be restored in order of rank before any other game is added.
+ **/
+void leaderboard_restore_game(int user_id, int time_taken, int games_won, unsigned long id) {
+    struct game_list* list = &gameinfo_list;
+    if(list->head == NULL) {
+        list->head = leaderboard_new_game(LEADERBOARD_MAX_LEVEL);
+    }
+    if(list->size == 0) {
+        for(int level = 0; level < LEADERBOARD_MAX_LEVEL; level++) {
+            restore_tails[level] = list->head;
+            restore_ranks[level] = 0;
         }
+    }
 
-        // Iterate through the list to find a spot to place the score
-        struct game* game_iterator = head_gameinfo;
-        while(game_iterator != NULL) {
-            // Check if the score fits after the current item in the list
-            if(gameinfo->time_taken <= game_iterator->time_taken) {
-                // Check if the scores are equal (to apply the games won rule) AND we can place the score after the current one
-                if(gameinfo->time_taken == game_iterator->time_taken) {
-                    get_userinfo(gameinfo->username, &user_games_played, &user_games_won);
-                    get_userinfo(game_iterator->username, &iterator_games_played, &iterator_games_won);
-
-                    // Insert after the current item in the list if this user has won more games
-                    if(user_games_won >= iterator_games_won) {
-                        gameinfo->next = game_iterator->next;
-                        game_iterator->next = gameinfo;
-                        gameinfo_size++;
-                        return;
-                    }
-                }
-                // Check if we have reached the tail of the list
-                if(game_iterator->next == NULL) {
-                    gameinfo->next = NULL;
-                    game_iterator->next = gameinfo;
-                    gameinfo_size++;
-                    return;
-                }
-                // Check if the score fits between two scores in the middle of the list
-                if(gameinfo->time_taken > game_iterator->next->time_taken) {
-                    gameinfo->next = game_iterator->next;
-                    game_iterator->next = gameinfo;
-                    gameinfo_size++;
-                    return;
-                }
+    struct game* gameinfo = game_new(user_id, time_taken, games_won, id);
+    if(id >= gameinfo_next_id) {
+        gameinfo_next_id = id + 1;
+    }
 
-                // Check if the next score will be equal AND we need to place the score before the next one (due to games won rule)
-                if(gameinfo->time_taken == game_iterator->next->time_taken) {
-                    get_userinfo(gameinfo->username, &user_games_played, &user_games_won);
-                    get_userinfo(game_iterator->next->username, &iterator_games_played, &iterator_games_won);
-
-                    if(user_games_won < iterator_games_won) {
-                        gameinfo->next = game_iterator->next;
-                        game_iterator->next = gameinfo;
-                        gameinfo_size++;
-                        return;
-                    }
-                }
-            }
+    // The levels that weren't in use yet start from the header, which restore_tails already points to
+    int rank = list->size + 1;
+    if(gameinfo->height > list->levels) {
+        list->levels = gameinfo->height;
+    }
 
-            game_iterator = game_iterator->next;
+    // Link the game after the last game of each of its levels. The last link of a level skips over the games
+    // after it, so the links of the levels above the game skip over one more game.
+    for(int level = 0; level < list->levels; level++) {
+        struct game* tail = restore_tails[level];
+        if(level < gameinfo->height) {
+            tail->links[level].next = gameinfo;
+            tail->links[level].span = rank - restore_ranks[level];
+            gameinfo->links[level].next = NULL;
+            gameinfo->links[level].span = 0;
+            restore_tails[level] = gameinfo;
+            restore_ranks[level] = rank;
+        } else {
+            tail->links[level].span++;
         }
     }
+
+    gameinfo->prev = list->tail;
+    list->tail = gameinfo;
+    list->size++;
+
+    // The games come best first, so the first game of a user is their best
+    if(userinfo[user_id].best == NULL) {
+        userinfo[user_id].best = gameinfo;
+    }
+    __atomic_add_fetch(&leaderboard_changes, 1, __ATOMIC_RELEASE);
 }
 
 /**
@@ -195,23 +567,14 @@ void leaderboard_add_score(char* username, int time_taken) {
  * If the username does not exist in the leaderboard, it will add it and set games played to 1. 
  **/
 void leaderboard_update_user_games(char* username, int game_won) {
-    // If the user exists, increment their details accordingly 
-    if(username_exists(username)) {
-        struct user* userinfo = head_userinfo;
-        while(userinfo != NULL) {
-            if(strcmp(username, userinfo->username) == 0) {
-                userinfo->games_played++;
-                if(game_won) {
-                    userinfo->games_won++;
-                }
-                return;
-            }
-            userinfo = userinfo->next;
-        }
-    } else { 
-        // If the user doesn't exist in the list yet, add to the list
-        leaderboard_add_user(username, game_won);
+    leaderboard_write_begin();
+    struct user* user = leaderboard_user(leaderboard_add_user(username));
+    user->games_played++;
+    if(game_won) {
+        user->games_won++;
     }
+    leaderboard_write_end();
+    __atomic_add_fetch(&leaderboard_changes, 1, __ATOMIC_RELEASE);
 }
 
 /**
@@ -222,24 +585,355 @@ void get_userinfo(char* username, int* games_played, int* games_won) {
     *games_played = -1;
     *games_won = -1;
 
-    if(username_exists(username)) {
-        struct user* userinfo = head_userinfo;
-        while(userinfo != NULL) {
-            if(strcmp(username, userinfo->username) == 0) {
-                *games_played = userinfo->games_played;
-                *games_won = userinfo->games_won;
-                return;
-            }
-            userinfo = userinfo->next;
+    int user_id = leaderboard_user_id(username);
+    if(user_id >= 0) {
+        *games_played = userinfo[user_id].games_played;
+        *games_won = userinfo[user_id].games_won;
+    }
+}
+
+/**
+ * Get the game at a rank of a list (1 is the best) in O(log n).
+ * Returns NULL if there is no game at that rank.
+ **/
+struct game* game_list_at(struct game_list* list, int rank) {
+    if(list->head == NULL || rank < 1 || rank > list->size) {
+        return NULL;
+    }
+
+    // Follow the links that don't skip past the rank, from the highest level down
+    struct game* game_iterator = list->head;
+    int traversed = 0;
+    for(int level = list->levels - 1; level >= 0; level--) {
+        while(game_iterator->links[level].next != NULL && traversed + game_iterator->links[level].span <= rank) {
+            traversed += game_iterator->links[level].span;
+            game_iterator = game_iterator->links[level].next;
+        }
+        if(traversed == rank) {
+            return game_iterator;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get the rank of a game in a list (1 is the best) in O(log n)
+ **/
+int game_list_rank(struct game_list* list, struct game* game) {
+    // Add up the spans of the links followed to reach the game, from the highest level down
+    struct game* game_iterator = list->head;
+    int rank = 0;
+    for(int level = list->levels - 1; level >= 0; level--) {
+        while(game_iterator->links[level].next != NULL &&
+              leaderboard_compare(game_iterator->links[level].next, game) <= 0) {
+            rank += game_iterator->links[level].span;
+            game_iterator = game_iterator->links[level].next;
+        }
+        if(game_iterator == game) {
+            return rank;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Get the won game at a rank of the leaderboard (1 is the best).
+ * Returns NULL if there is no game at that rank.
+ **/
+struct game* leaderboard_game_at(int rank) {
+    return game_list_at(&gameinfo_list, rank);
+}
+
+/**
+ * Get the rank of a won game in the leaderboard (1 is the best)
+ **/
+int leaderboard_game_rank(struct game* game) {
+    return game_list_rank(&gameinfo_list, game);
+}
+
+/**
+ * Get the game ranked just below the one passed, or NULL if it is the last one
+ **/
+struct game* leaderboard_game_next(struct game* game) {
+    return game->links[0].next;
+}
+
+/**
+ * Get the game ranked just above the one passed, or NULL if it is the first one
+ **/
+struct game* leaderboard_game_prev(struct game* game) {
+    return game->prev;
+}
+
+/**
+ * Lock the leaderboard to update or read it
+ **/
+void leaderboard_lock() {
+    pthread_mutex_lock(&leaderboard_mutex);
+}
+
+/**
+ * Unlock the leaderboard
+ **/
+void leaderboard_unlock() {
+    pthread_mutex_unlock(&leaderboard_mutex);
+}
+
+/**
+ * Get the version of the leaderboard, which changes every time a game or a user's record is added or updated.
+ * Can be called without holding any lock.
+ **/
+unsigned long leaderboard_version() {
+    return __atomic_load_n(&leaderboard_changes, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Get the ranked games of a view as they are at a time, moving its window on to the time if it is one
+ **/
+struct game_list* leaderboard_view_games(int view, long now) {
+    if(view == LEADERBOARD_ALL_TIME) {
+        return &gameinfo_list;
+    }
+    window_advance(view, now);
+    return window_games(view);
+}
+
+/**
+ * Get when a game next leaves a view's window after a time, or 0 if the games never leave it
+ **/
+long leaderboard_view_expires(int view, long now) {
+    return (view == LEADERBOARD_ALL_TIME) ? 0 : window_expires(view, now);
+}
+
+/**
+ * Get how many games a user won and played in a view
+ **/
+void leaderboard_view_stats(int view, int user_id, int* games_won, int* games_played) {
+    if(view == LEADERBOARD_ALL_TIME) {
+        *games_won = userinfo[user_id].games_won;
+        *games_played = userinfo[user_id].games_played;
+    }else {
+        window_user_stats(view, user_id, games_won, games_played);
+    }
+}
+
+/**
+ * Get the rank of the first of page_size games around the best game a user won in a view, which is placed in the
+ * middle where possible. Must be called with the leaderboard locked.
+ *
+ * Returns 0 if the user has never won a game in the view
+ **/
+int leaderboard_around_first(int view, char* username, int page_size, long now) {
+    struct game_list* list = leaderboard_view_games(view, now);
+    int user_id = leaderboard_user_id(username);
+    if(user_id < 0) {
+        return 0;
+    }
+    struct game* best = (view == LEADERBOARD_ALL_TIME) ? userinfo[user_id].best : window_user_best(view, user_id);
+    if(best == NULL) {
+        return 0;
+    }
+
+    // Keep the page inside the leaderboard, moving it rather than shrinking it near either end
+    int first = game_list_rank(list, best) - 1 - page_size / 2;
+    if(first + page_size > list->size) {
+        first = list->size - page_size;
+    }
+    if(first < 0) {
+        first = 0;
+    }
+    return first + 1;
+}
+
+/**
+ * Render a row of a page into a buffer of the given size, or only measure it if the buffer is NULL
+ *
+ * Returns the length of the row (not including the '\0')
+ **/
+int leaderboard_row_render(char* text, size_t size, int view, int rank, struct game* game) {
+    int games_won, games_played;
+    leaderboard_view_stats(view, game->user_id, &games_won, &games_played);
+    return snprintf(text, size, LEADERBOARD_ROW_FORMAT, rank, userinfo[game->user_id].username, game->time_taken,
+                    games_won, games_played);
+}
+
+/**
+ * Render the page_size games of a view from a rank onwards as they are at a time.
+ * Must be called with the leaderboard locked.
+ **/
+struct leaderboard_page* leaderboard_page_render(int view, int first_rank, int page_size, long now) {
+    struct game_list* list = leaderboard_view_games(view, now);
+    int count = list->size - first_rank + 1;
+    if(count > page_size) {
+        count = page_size;
+    }
+    if(count < 0) {
+        count = 0;
+    }
+
+    struct leaderboard_page* page = malloc(sizeof(struct leaderboard_page) + count * sizeof(struct leaderboard_row));
+    if(!page) {
+        perror("Error rendering the leaderboard: out of memory");
+        exit(1);
+    }
+    page->version = leaderboard_version();
+    page->expires = leaderboard_view_expires(view, now);
+    page->refcount = 1;
+    page->page_size = page_size;
+    page->first_rank = first_rank;
+    page->count = count;
+    page->num_games = list->size;
+
+    // Measure the rows before rendering them so the buffer is allocated once
+    struct game* first = game_list_at(list, first_rank);
+    size_t text_size = 0;
+    struct game* gameinfo = first;
+    for(int i = 0; i < count; i++, gameinfo = gameinfo->links[0].next) {
+        text_size += leaderboard_row_render(NULL, 0, view, first_rank + i, gameinfo) + 1;
+    }
+    page->text = malloc(text_size ? text_size : 1);
+    if(!page->text) {
+        perror("Error rendering the leaderboard: out of memory");
+        exit(1);
+    }
+    size_t offset = 0;
+    gameinfo = first;
+    for(int i = 0; i < count; i++, gameinfo = gameinfo->links[0].next) {
+        page->rows[i].text = page->text + offset;
+        page->rows[i].size = leaderboard_row_render(page->text + offset, text_size - offset, view, first_rank + i,
+                                                    gameinfo);
+        offset += page->rows[i].size + 1;
+    }
+    return page;
+}
+
+/**
+ * Get the slot of the cache a page from a rank onwards goes in (Fibonacci hashing)
+ **/
+unsigned int leaderboard_page_slot(int first_rank) {
+    return ((unsigned int)first_rank * 2654435769U) >> (32 - PAGE_SLOTS_BITS);
+}
+
+/**
+ * Get the page of a view cached for a rank without taking any lock, or NULL if none is. It may be stale, the caller
+ * checks its version. Must be given back with leaderboard_page_put.
+ **/
+struct leaderboard_page* leaderboard_page_get(int view, int first_rank, int page_size) {
+    // Announce the reader before getting hold of the page, so it isn't freed before the reference is taken
+    int* readers = leaderboard_read_begin();
+
+    // The slot may hold another page whose first rank hashes the same
+    struct leaderboard_page* page = __atomic_load_n(&leaderboard_pages[view][leaderboard_page_slot(first_rank)],
+                                                    __ATOMIC_SEQ_CST);
+    if(page != NULL && page->first_rank == first_rank && page->page_size == page_size) {
+        __atomic_add_fetch(&page->refcount, 1, __ATOMIC_SEQ_CST);
+    }else {
+        page = NULL;
+    }
+
+    leaderboard_read_end(readers);
+    return page;
+}
+
+/**
+ * Cache a rendered page, handing it the reference it was rendered with. The page it replaces is freed once its last
+ * reader lets it go. Must be called with the leaderboard locked.
+ **/
+void leaderboard_page_publish(int view, struct leaderboard_page* page) {
+    struct leaderboard_page** slot = &leaderboard_pages[view][leaderboard_page_slot(page->first_rank)];
+    struct leaderboard_page* old = __atomic_exchange_n(slot, page, __ATOMIC_SEQ_CST);
+    if(old != NULL) {
+        leaderboard_synchronize();
+        leaderboard_page_put(old);
+    }
+}
+
+/**
+ * Let go of a page. The page is freed if it was replaced and this was its last reference.
+ **/
+void leaderboard_page_put(struct leaderboard_page* page) {
+    if(page != NULL && __atomic_sub_fetch(&page->refcount, 1, __ATOMIC_SEQ_CST) == 0) {
+        free(page->text);
+        free(page);
+    }
+}
+
+/**
+ * Find the id of a user without the lock. The user table is only ever replaced by a larger one, and a replaced table
+ * is kept until leaderboard_synchronize sees the reader is done. Must be called between leaderboard_read_begin and
+ * leaderboard_read_end.
+ *
+ * Returns -1 if the username is not in the leaderboard
+ **/
+int leaderboard_read_user_id(const char* username) {
+    // The mask is read before the slots, so the table is at least as large as the mask
+    unsigned int mask = __atomic_load_n(&userinfo_mask, __ATOMIC_ACQUIRE);
+    struct user_slot* slots = __atomic_load_n(&userinfo_slots, __ATOMIC_ACQUIRE);
+    if(slots == NULL) {
+        return -1;
+    }
+    unsigned int hash = username_hash(username);
+    for(unsigned int i = hash & mask, probes = 0; probes <= mask; i = (i + 1) & mask, probes++) {
+        int user_id = __atomic_load_n(&slots[i].user_id, __ATOMIC_ACQUIRE);
+        if(user_id == 0) {
+            break;
+        }
+        struct user* users = __atomic_load_n(&userinfo, __ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&slots[i].hash, __ATOMIC_RELAXED) == hash &&
+           strcmp(users[user_id - 1].username, username) == 0) {
+            return user_id - 1;
         }
     }
+    return -1;
 }
 
 /**
- * Get the HEAD pointer for the game info list
+ * Find where a game the user wins now in time_taken seconds places on the all-time leaderboard in O(log n), without
+ * adding it. Can be called without holding any lock: the all-time games are never freed while the server runs, and
+ * the rank is worked out again if the games or the user's record changed while it was being found.
+ *
+ * Returns the rank, 1 being the best
  **/
-struct game* get_gameinfo_head() {
-    return head_gameinfo;
+int leaderboard_score_rank(char* username, int time_taken) {
+    while(1) {
+        unsigned long seq = __atomic_load_n(&leaderboard_seq, __ATOMIC_ACQUIRE);
+        if(seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        // The reader leaves its counter before retrying, as a writer can be waiting for it to drain
+        int* readers = leaderboard_read_begin();
+        int rank = 0;
+        struct game* game_iterator = __atomic_load_n(&gameinfo_list.head, __ATOMIC_ACQUIRE);
+        if(game_iterator != NULL) {
+            // The game as leaderboard_add_score would make it, it is only compared so it needs no links
+            int user_id = leaderboard_read_user_id(username);
+            int games_won = -1;
+            if(user_id >= 0) {
+                struct user* users = __atomic_load_n(&userinfo, __ATOMIC_ACQUIRE);
+                games_won = __atomic_load_n(&users[user_id].games_won, __ATOMIC_RELAXED);
+            }
+            struct game score = {user_id, time_taken, games_won, __atomic_load_n(&gameinfo_next_id, __ATOMIC_RELAXED)};
+
+            // Add up the spans of the links to the games that rank above it, from the highest level down
+            int levels = __atomic_load_n(&gameinfo_list.levels, __ATOMIC_RELAXED);
+            for(int level = levels - 1; level >= 0; level--) {
+                struct game* next;
+                while((next = __atomic_load_n(&game_iterator->links[level].next, __ATOMIC_ACQUIRE)) != NULL &&
+                      leaderboard_compare(next, &score) < 0) {
+                    rank += __atomic_load_n(&game_iterator->links[level].span, __ATOMIC_RELAXED);
+                    game_iterator = next;
+                }
+            }
+        }
+        leaderboard_read_end(readers);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&leaderboard_seq, __ATOMIC_RELAXED) == seq) {
+            return rank + 1;
+        }
+    }
 }
 
 /**
@@ -253,5 +947,5 @@ int get_userinfolist_size() {
  * Get the number of games won in the leaderboard
  **/
 int get_gameinfo_size() {
-    return gameinfo_size;
+    return gameinfo_list.size;
 }
\ No newline at end of file
@@ -2,29 +2,137 @@
 #define LEADERBOARD_H
 
 /**
- * This list contains information about each unique user that plays Minesweeper. The unique 
- * identifier for each user is their username.
+ * This table contains information about each unique user that plays Minesweeper. The unique 
+ * identifier for each user is their username, which is mapped to a compact user id by a hash table.
  * The information includes:
  *      - Games played
  *      - Games won
  **/
 struct user {
-    char* username;         
+    const char* username;   // Interned into an arena owned by the leaderboard
     int games_won;
     int games_played;     
-    struct user* next; // Pointer to the next user
+    struct game* best;      // The user's best won game, NULL if they never won
 };
 
 /**
- * Contains a list of won games with the time taken to complete. Contains the username of 
- * whoever won each specific game to allow joining of the two lists. 
+ * A level of a won game in the skiplist: the next game on that level and how many games it skips over
+ **/
+struct game_link {
+    struct game* next;
+    int span;
+};
+
+/**
+ * Contains the won games with the time taken to complete. Contains the id of the user who won each
+ * specific game to allow joining of the two tables.
+ *
+ * The games are kept in an indexed skiplist ordered by rank: the fastest time first and, between equal
+ * times, whoever had won more games first. Each level also records how many games its links skip over, so
+ * a game can be inserted, ranked or found by its rank in O(log n).
  **/
 struct game {
-    char* username; 
-    int time_taken;       
-    struct game* next;   // Pointer to the next game completed
+    int user_id;                // The user who won the game
+    int time_taken;
+    int games_won;              // How many games the user had won before this one, which breaks ties
+    unsigned long id;           // Breaks the remaining ties, a later game ranks above an equal earlier one
+    struct game* prev;          // The game ranked just above this one
+    struct game* user_next;     // In a window, the next game the same user won there (see window.h)
+    int height;                 // How many levels the game is linked into
+    struct game_link links[];   // The game's link on each level, level 0 links every game
+};
+
+/**
+ * A skiplist of won games ranked best first. The all-time leaderboard is one and so is each window's leaderboard.
+ **/
+struct game_list {
+    struct game* head;          // The header, which links to the best game on every level. Allocated with the first game.
+    struct game* tail;          // The game ranked last
+    int levels;                 // How many levels are in use
+    int size;                   // How many games are in the list
 };
 
+// The leaderboards that can be shown, each has its own ranked list of games
+#define LEADERBOARD_ALL_TIME    0       // Every game ever won
+#define LEADERBOARD_PAST_HOUR   1       // The games won in the past hour (see window.h)
+#define LEADERBOARD_PAST_DAY    2
+#define LEADERBOARD_PAST_WEEK   3
+#define LEADERBOARD_VIEWS       4
+
+#define LEADERBOARD_ROW_FORMAT  "#%d \t %s \t %d seconds \t %d games won, %d games played\n"    // How a row is shown
+
+/**
+ * A row of a leaderboard page: a won game along with the stats of whoever won it, rendered with
+ * LEADERBOARD_ROW_FORMAT along with its rank
+ **/
+struct leaderboard_row {
+    const char* text;       // Owned by the page
+    int size;               // The length of the row (not including the '\0')
+};
+
+/**
+ * A page of one of the leaderboards with its rows rendered, so the session showing it sends them as they are.
+ * Only the games on the page are looked at to build it: the first one is found by its rank in O(log n) and the
+ * rest are walked to on level 0.
+ *
+ * Pages are only rendered when a reader asks for one that isn't cached for the current version, so nothing is
+ * rendered when the leaderboard changes and the pages nobody looks at are never rendered. They are cached by the
+ * rank of their first row and reference counted: the cache holds a reference and so does every screen showing the
+ * page until it is sent, so a replaced page is freed once its last reader lets it go.
+ **/
+struct leaderboard_page {
+    unsigned long version;              // The version of the leaderboard it was rendered from
+    long expires;                       // When it goes stale even if nothing is added, as games leave its window (0 for never)
+    int refcount;
+    int page_size;                      // How many rows it was rendered for
+    int first_rank;                     // The rank of the first row, 1 being the best
+    int count;                          // How many rows the page has
+    int num_games;                      // How many games the whole leaderboard has
+    char* text;                         // The rendered rows, each ending with a '\0'
+    struct leaderboard_row rows[];
+};
+
+/**
+ * Allocate a won game, picking how many levels of a skiplist it is linked into
+ **/
+struct game* game_new(int user_id, int time_taken, int games_won, unsigned long id);
+
+/**
+ * Compare the rank of two won games
+ * Return   <0  If game a ranks above game b
+ *          0   If they are the same game
+ *          >0  If game a ranks below game b
+ **/
+int leaderboard_compare(struct game* a, struct game* b);
+
+/**
+ * Link a game into a list in order of rank in O(log n)
+ *
+ * Returns the rank of the game (1 is the best)
+ **/
+int game_list_insert(struct game_list* list, struct game* game);
+
+/**
+ * Unlink a game from a list in O(log n). The game isn't freed.
+ **/
+void game_list_remove(struct game_list* list, struct game* game);
+
+/**
+ * Get the game at a rank of a list (1 is the best) in O(log n).
+ * Returns NULL if there is no game at that rank.
+ **/
+struct game* game_list_at(struct game_list* list, int rank);
+
+/**
+ * Get the rank of a game in a list (1 is the best) in O(log n)
+ **/
+int game_list_rank(struct game_list* list, struct game* game);
+
+/**
+ * Free every game of a list along with its header
+ **/
+void game_list_free(struct game_list* list);
+
 /**
  * Fress all of the memory allocated to the nodes in the two lists. Will also set the head and 
  * tail pointers to NULL.
@@ -34,8 +142,16 @@ void leaderboard_free();
 /**
  * Add a record of a won game to the leaderboard. This new score is automatically
  * sorted during the insert operation following rules set by the task sheet.
+ *
+ * Returns the rank of the new score (1 is the best)
  **/
-void leaderboard_add_score(char* username, int time_taken);
+int leaderboard_add_score(char* username, int time_taken);
+
+/**
+ * Add a won game to the end of the leaderboard in O(1), for restoring a leaderboard that was saved. The games must
+ * be restored in order of rank before any other game is added.
+ **/
+void leaderboard_restore_game(int user_id, int time_taken, int games_won, unsigned long id);
 
 /**
  * Update the record of games played and won by the user passed to this function.
@@ -44,6 +160,23 @@ void leaderboard_add_score(char* username, int time_taken);
  **/
 void leaderboard_update_user_games(char* username, int game_won);
 
+/**
+ * Get the id of a user in the leaderboard.
+ * Returns -1 if the username is not in the leaderboard.
+ **/
+int leaderboard_user_id(char* username);
+
+/**
+ * Get the id of a user, adding the user to the leaderboard with no games played if the username is new.
+ * The username is interned so the leaderboard never points to the session's copy.
+ **/
+int leaderboard_add_user(char* username);
+
+/**
+ * Get the details of the user with the given id. Only valid until another user is added.
+ **/
+struct user* leaderboard_user(int user_id);
+
 /**
  * Get the number of games played and won by an user in the leaderboard.
  * If the user does not exists, the values for both variables will be -1.
@@ -51,9 +184,85 @@ void leaderboard_update_user_games(char* username, int game_won);
 void get_userinfo(char* username, int* games_played, int* games_won);
 
 /**
- * Get the HEAD pointer for the game info list
+ * Get the won game at a rank of the leaderboard (1 is the best).
+ * Returns NULL if there is no game at that rank.
+ **/
+struct game* leaderboard_game_at(int rank);
+
+/**
+ * Get the rank of a won game in the leaderboard (1 is the best)
+ **/
+int leaderboard_game_rank(struct game* game);
+
+/**
+ * Get the game ranked just below the one passed, or NULL if it is the last one
+ **/
+struct game* leaderboard_game_next(struct game* game);
+
+/**
+ * Get the game ranked just above the one passed, or NULL if it is the first one
+ **/
+struct game* leaderboard_game_prev(struct game* game);
+
+/**
+ * Lock the leaderboard to update or read it
+ **/
+void leaderboard_lock();
+
+/**
+ * Unlock the leaderboard
+ **/
+void leaderboard_unlock();
+
+/**
+ * Get the version of the leaderboard, which changes every time a game or a user's record is added or updated.
+ * Can be called without holding any lock.
+ **/
+unsigned long leaderboard_version();
+
+/**
+ * Get when a game next leaves a view's window after a time, or 0 if the games never leave it
+ **/
+long leaderboard_view_expires(int view, long now);
+
+/**
+ * Get the rank of the first of page_size games around the best game a user won in a view, which is placed in the
+ * middle where possible. Must be called with the leaderboard locked.
+ *
+ * Returns 0 if the user has never won a game in the view
+ **/
+int leaderboard_around_first(int view, char* username, int page_size, long now);
+
+/**
+ * Render the page_size games of a view from a rank onwards as they are at a time.
+ * Must be called with the leaderboard locked.
+ **/
+struct leaderboard_page* leaderboard_page_render(int view, int first_rank, int page_size, long now);
+
+/**
+ * Get the page of a view cached for a rank without taking any lock, or NULL if none is. It may be stale, the caller
+ * checks its version. Must be given back with leaderboard_page_put.
+ **/
+struct leaderboard_page* leaderboard_page_get(int view, int first_rank, int page_size);
+
+/**
+ * Cache a rendered page, handing it the reference it was rendered with. The page it replaces is freed once its last
+ * reader lets it go. Must be called with the leaderboard locked.
+ **/
+void leaderboard_page_publish(int view, struct leaderboard_page* page);
+
+/**
+ * Let go of a page. The page is freed if it was replaced and this was its last reference.
+ **/
+void leaderboard_page_put(struct leaderboard_page* page);
+
+/**
+ * Find where a game the user wins now in time_taken seconds places on the all-time leaderboard in O(log n), without
+ * adding it. Can be called without holding any lock.
+ *
+ * Returns the rank, 1 being the best
  **/
-struct game* get_gameinfo_head();
+int leaderboard_score_rank(char* username, int time_taken);
 
 /**
  * Get the number of users in the leaderboard
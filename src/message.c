@@ -6,6 +6,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 #include "message.h"
 
@@ -60,4 +61,66 @@ void send_input(int sockfd) {
     if(msg_size < 0) {
         perror("Error with writing to socket");
     }
+}
+
+/**
+ * Writes the header of a frame holding a message of msg_size bytes to header, which must have space
+ * for FRAME_HEADER_SIZE bytes.
+ **/
+void frame_header(char* header, char msg_code, size_t msg_size) {
+    // The size is stored in network byte order
+    header[0] = (msg_size >> 24) & 0xFF;
+    header[1] = (msg_size >> 16) & 0xFF;
+    header[2] = (msg_size >> 8) & 0xFF;
+    header[3] = msg_size & 0xFF;
+    header[4] = msg_code;
+}
+
+/**
+ * Send a message to a client/server in a protocol version 2 frame. Doesn't wait for an ACK.
+ **/
+int send_frame(int sockfd, char msg_code, char* msg) {
+    char header[FRAME_HEADER_SIZE];
+    size_t msg_size = strlen(msg);
+    frame_header(header, msg_code, msg_size);
+
+    // Write the header and the message with a single system call
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = FRAME_HEADER_SIZE;
+    iov[1].iov_base = msg;
+    iov[1].iov_len = msg_size;
+
+    return writev(sockfd, iov, 2);
+}
+
+/**
+ * Reads the size of the message from the header of a frame, which must hold FRAME_HEADER_SIZE bytes
+ **/
+size_t frame_msg_size(char* header) {
+    unsigned char* bytes = (unsigned char*)header;
+    return ((size_t)bytes[0] << 24) | ((size_t)bytes[1] << 16) | ((size_t)bytes[2] << 8) | bytes[3];
+}
+
+/**
+ * Checks if there is a complete frame at the start of the buffer.
+ *
+ * Return   >0  The size of the frame (header included)
+ *          0   More bytes need to be received to complete the frame
+ *          -1  The frame is larger than FRAME_MAX_SIZE
+ **/
+int frame_size(char* buffer, int size) {
+    if(size < FRAME_HEADER_SIZE) {
+        return 0;
+    }
+
+    size_t msg_size = frame_msg_size(buffer);
+    if(msg_size > FRAME_MAX_SIZE) {
+        return -1;
+    }
+    if(size < FRAME_HEADER_SIZE + (int)msg_size) {
+        return 0;
+    }
+
+    return FRAME_HEADER_SIZE + msg_size;
 }
\ No newline at end of file
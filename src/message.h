@@ -12,7 +12,38 @@
 #define MSGC_INPUT          '3' // The message should be printed to the terminal and the user should be polled for input
 #define MSGC_EXIT           '4' // The message should be printed to the terminal and the receiving process should exit
 #define MSGC_DATA           '5' // The message sent contains data that should be placed in a variable (eg. the input from an user)
-// NOTE: Every message sent requires the receiver to send a MSGC_ACK in response. Exceptions include messages sent with codes MSGC_ACK and MSGC_DATA
+#define MSGC_HELLO          '6' // Sent by a client instead of the first ACK to ask for a newer protocol version. The server replies with the version it will use.
+#define MSGC_BOARD          '7' // (Protocol v2 only) The whole Minesweeper field. The receiver keeps a copy of it and prints it
+#define MSGC_BOARD_DELTA    '8' // (Protocol v2 only) The tiles that changed since the last field sent. The receiver patches its copy and prints it
+// NOTE: Every message sent requires the receiver to send a MSGC_ACK in response. Exceptions include messages sent with codes MSGC_ACK, MSGC_DATA and MSGC_HELLO
+
+/**
+ * The protocol versions a client and server can talk with.
+ *
+ * Version 1 sends each message with a single send() and waits for the receiver's MSGC_ACK before sending the next one.
+ * Version 2 puts each message in a frame that starts with the length of the message, so many messages can be streamed
+ * back to back without waiting for ACKs (which are never sent). A client asks for version 2 by replying to the
+ * server's first message with MSGC_HELLO followed by the version number (eg. "62"). A server that understands it
+ * replies with the same MSGC_HELLO message, after which both sides only send frames. Old servers treat the hello as an
+ * ACK and old clients never send it, so they keep using version 1.
+ **/
+#define PROTOCOL_V1         1
+#define PROTOCOL_V2         2
+
+/**
+ * The Minesweeper field messages let the server send only what changed in the field after each move.
+ *
+ * MSGC_BOARD holds the width and height of the field followed by the sprite of every tile, row by row:
+ *      "<width> <height> <sprites>"            eg. "9 9 " followed by 81 sprites
+ * MSGC_BOARD_DELTA holds one entry for every tile that changed, where x is the column and y is the row:
+ *      "<x>,<y>,<sprite>;" repeated            eg. "0,3,2;4,4,+;"
+ * A delta with no entries means nothing changed, but the field should still be printed.
+ **/
+
+// A frame starts with the size of the message as a 4 byte big-endian number followed by the message code
+#define FRAME_HEADER_SIZE   5
+#define FRAME_MAX_SIZE      (1 << 20)   // The largest message a frame can hold
+#define FRAME_DATA_MAX_SIZE (MESSAGE_MAX_SIZE - FRAME_HEADER_SIZE)  // The largest message a client sends, so its frame fits in the server's inbox
 
 /**
  * Send a message to a client/server
@@ -38,4 +69,29 @@ int receive_message(int sockfd, char* buffer, int buffer_size);
  **/
 void send_input(int sockfd);
 
+/**
+ * Writes the header of a frame holding a message of msg_size bytes to header, which must have space
+ * for FRAME_HEADER_SIZE bytes.
+ **/
+void frame_header(char* header, char msg_code, size_t msg_size);
+
+/**
+ * Send a message to a client/server in a protocol version 2 frame. Doesn't wait for an ACK.
+ **/
+int send_frame(int sockfd, char msg_code, char* msg);
+
+/**
+ * Checks if there is a complete frame at the start of the buffer.
+ *
+ * Return   >0  The size of the frame (header included)
+ *          0   More bytes need to be received to complete the frame
+ *          -1  The frame is larger than FRAME_MAX_SIZE
+ **/
+int frame_size(char* buffer, int size);
+
+/**
+ * Reads the size of the message from the header of a frame, which must hold FRAME_HEADER_SIZE bytes
+ **/
+size_t frame_msg_size(char* header);
+
 #endif // MESSAGE_H
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <time.h>
 
@@ -7,68 +8,124 @@
 /**
  * Makes sure the coordinates fall in bounds of the field
  **/
-int in_bounds(int x, int y) {
-    return (x >= 0) && (x < FIELD_WIDTH) && (y >= 0) && (y < FIELD_HEIGHT);
+int in_bounds(int x, int y, MinesweeperState *state) {
+    return (x >= 0) && (x < state->field.size.width) && (y >= 0) && (y < state->field.size.height);
 }
 
 /**
- * Converts a coordinate from the game (such as A1, 1A, B2, etc.) into coordinates 
- * that match to the field array
+ * Remembers that a tile changed so it is sent to the client with the next update of the field
+ **/
+void mark_tile_dirty(int x, int y, MinesweeperState *state) {
+    if(!(state->field.dirty[y + 1] & FIELD_BIT(x))) {
+        state->field.dirty[y + 1] |= FIELD_BIT(x);
+        state->dirty_tiles[state->num_dirty_tiles++] = y * state->field.size.width + x;
+    }
+}
+
+/**
+ * Forget which tiles changed. Called once the field has been sent to the client.
+ **/
+void clear_dirty_tiles(MinesweeperState *state) {
+    memset(state->field.dirty, 0, sizeof(state->field.dirty));
+    state->num_dirty_tiles = 0;
+    state->needs_resync = 0;
+}
+
+/**
+ * Returns how many mines are adjacent to the tile at the given coordinate
+ **/
+int num_mines_adjacent(int x, int y, Field *field) {
+    // The border comes before column 0
+    int lane = x + 1;
+    return (field->adjacent[y][lane / 16] >> (4 * (lane % 16))) & 0xF;
+}
+
+/**
+ * Returns true if the tile at the given coordinate has been revealed
+ **/
+int tile_revealed(int x, int y, MinesweeperState *state) {
+    return (state->field.revealed[y + 1] & FIELD_BIT(x)) != 0;
+}
+
+/**
+ * Returns true if the tile at the given coordinate contains a mine
+ **/
+int tile_has_mine(int x, int y, MinesweeperState *state) {
+    return (state->field.mines[y + 1] & FIELD_BIT(x)) != 0;
+}
+
+/**
+ * Get the character that represents a tile when the field is drawn
+ **/
+char tile_sprite(int x, int y, MinesweeperState *state) {
+    if(!tile_revealed(x, y, state)) {
+        return ' ';
+    }
+    if(state->field.flags[y + 1] & FIELD_BIT(x)) {
+        return FLAG_SPRITE;
+    }
+    if(tile_has_mine(x, y, state)) {
+        return MINE_SPRITE;
+    }
+    return num_mines_adjacent(x, y, &state->field) + '0';
+}
+
+/**
+ * Converts a coordinate from the game (such as A1, 1A, B12, 12B, etc.) into coordinates
+ * that match to the field of the game
  * Will return a 1 if the conversion was successful
  **/
-int convert_coordinate(char *coord, int *x, int *y) {
+int convert_coordinate(const char *coord, int *x, int *y, MinesweeperState *state) {
     *x = -1;
     *y = -1;
 
-    // Test to see if each digit of the coordinate is a number or character
-    for(int i = 0; i < 2; i++) {
-        if(isdigit(coord[i])) {
-            int x_coord = coord[i] - '0';
-            // If it's a number, we want it to be the x coordinate
-            if(in_bounds(x_coord - 1, 0)) {
-                *x = x_coord - 1;   // Need to take 1 away as A1 means that the x is the first in the array, ie. 0.
-            } else {
+    // The coordinate is a letter for the row and a number for the column, in either order
+    int column = 0, digits = 0, letters = 0;
+    for(const char *c = coord; *c != '\0'; c++) {
+        if(isdigit((unsigned char)*c)) {
+            // The digits of the number have to follow each other, and no column goes past 2 digits
+            if((digits > 0 && !isdigit((unsigned char)c[-1])) || ++digits > 2) {
                 return 0;
             }
-        } else {
-            // If it's not a number, we assume it's a character - which will be put into the y coordinate
-            if(coord[i] >= 'A' && coord[i] <= 'Z') {
-                *y = coord[i] - 'A';
-            } else if(coord[i] >= 'a' && coord[i] <= 'z') {
-                *y = coord[i] - 'a';
-            } else {
+            column = column * 10 + (*c - '0');
+        } else if(isalpha((unsigned char)*c)) {
+            if(++letters > 1) {
                 return 0;
             }
+            *y = toupper((unsigned char)*c) - 'A';
+        } else {
+            return 0;
         }
     }
-
-    // One last check to make sure everything is valid
-    if(!in_bounds(*x, *y)) {
+    if(digits == 0 || letters == 0) {
         return 0;
     }
+    *x = column - 1;    // Need to take 1 away as A1 means that the x is the first in the array, ie. 0.
 
-    return 1;
+    // One last check to make sure everything is valid
+    return in_bounds(*x, *y, state);
 }
 
 /**
- * Sets a tile at the specified coordinates to revealed. 
+ * Sets a tile at the specified coordinates to revealed, along with every tile reached through tiles that have
+ * no mines around them. The tiles revealed are the last ones added to the dirty tiles.
+ *
+ * Returns how many tiles were revealed
  **/
-void reveal_tile(int x, int y, MinesweeperState *state) {
-    if(in_bounds(x, y) && (state->field[x][y].revealed == 0)) {
-        state->field[x][y].revealed = 1;
+int reveal_tile(int x, int y, MinesweeperState *state) {
+    if(!in_bounds(x, y, state)) {
+        return 0;
+    }
 
-        // If the tile has a value of 0, recursively fill out until a border is made
-        if(state->field[x][y].adjacent_mines == 0) {
-            reveal_tile(x-1, y, state);
-            reveal_tile(x+1, y, state);
-            reveal_tile(x-1, y-1, state);
-            reveal_tile(x+1, y-1, state);
-            reveal_tile(x-1, y+1, state);
-            reveal_tile(x+1, y+1, state);
-            reveal_tile(x, y-1, state);
-            reveal_tile(x, y+1, state);
-        }
+    // A hidden tile was never dirty, so the fill writes the tiles straight onto the end of the dirty tiles
+    int width = state->field.size.width;
+    int num_cells = state->engine->reveal_fill(x, y, &state->field, &state->dirty_tiles[state->num_dirty_tiles]);
+    for(int i = 0; i < num_cells; i++) {
+        int index = state->dirty_tiles[state->num_dirty_tiles + i];
+        state->field.dirty[index / width + 1] |= FIELD_BIT(index % width);
     }
+    state->num_dirty_tiles += num_cells;
+    return num_cells;
 }
 
 /**
@@ -78,11 +135,12 @@ void reveal_tile(int x, int y, MinesweeperState *state) {
  *          0 - Flag no placed because there is no mine present
  **/
 int flag_tile(int x, int y, MinesweeperState *state) {
-    if(in_bounds(x, y) && (state->field[x][y].revealed == 0)) {
-        if(state->field[x][y].has_mine) {
-            state->field[x][y].has_flag = 1;
-            state->field[x][y].revealed = 1;
+    if(in_bounds(x, y, state) && !tile_revealed(x, y, state)) {
+        if(tile_has_mine(x, y, state)) {
+            state->field.flags[y + 1] |= FIELD_BIT(x);
+            state->field.revealed[y + 1] |= FIELD_BIT(x);
             state->mines_remaining--;
+            mark_tile_dirty(x, y, state);
             return 1;
         }   
     }
@@ -94,96 +152,194 @@ int flag_tile(int x, int y, MinesweeperState *state) {
  * Reveals all the mines on the field. Will also hide every tile that is not a mine
  **/
 void show_mines(MinesweeperState *state, int show_flags) {
-    for(int x = 0; x < FIELD_WIDTH; x++) {
-        for(int y = 0; y < FIELD_HEIGHT; y++) {
-            if(state->field[x][y].has_mine) {
-                state->field[x][y].revealed = 1;
-                state->field[x][y].has_flag = show_flags;
-            } else {
-                state->field[x][y].revealed = 0;
-            }
-        }
+    for(int row = 1; row <= state->field.size.height; row++) {
+        state->field.revealed[row] = state->field.mines[row] | ~FIELD_INNER(state->field.size.width);
+        state->field.flags[row] = show_flags ? state->field.mines[row] : 0;
     }
+
+    // Most of the field changed, send all of it
+    state->needs_resync = 1;
 }
 
 /**
- * Clears a field by removing all the mines and making everything hidden
+ * Clears a field by removing all the mines and making everything hidden but the border
  **/
-void reset_field(Tile field[FIELD_WIDTH][FIELD_HEIGHT]) {
-    for(int x = 0; x < FIELD_WIDTH; x++) {
-        for(int y = 0; y < FIELD_HEIGHT; y++) {
-            field[x][y].adjacent_mines = 0;
-            field[x][y].has_mine = 0;
-            field[x][y].revealed = 0;
-            field[x][y].has_flag = 0;
-        }
+void reset_field(Field *field, FieldSize size) {
+    memset(field, 0, sizeof(Field));
+    field->size = size;
+    for(int row = 0; row < FIELD_MAX_ROWS; row++) {
+        field->revealed[row] = (row == 0 || row > size.height) ? 0xFFFFFFFF : ~FIELD_INNER(size.width);
     }
 }
 
 /**
- * Returns true if a coordinate contains a mine
+ * Spreads the 16 bits of a row of the field out to 4 bits each, so the rows can be added up tile by tile
  **/
-int tile_contains_mine(int x, int y, Tile field[FIELD_WIDTH][FIELD_HEIGHT]) {
-    return field[x][y].has_mine;
+uint64_t spread_row(uint16_t row) {
+    uint64_t bits = row;
+    bits = (bits | (bits << 24)) & 0x000000FF000000FFULL;
+    bits = (bits | (bits << 12)) & 0x000F000F000F000FULL;
+    bits = (bits | (bits << 6)) & 0x0303030303030303ULL;
+    bits = (bits | (bits << 3)) & 0x1111111111111111ULL;
+    return bits;
 }
 
 /**
- * Returns how many mines are adjacent to the tile at the given coordinate.
- * Counts diagonal tiles too.
+ * Gathers the lowest of every 4 bits back into the 16 bits of a row, undoing spread_row
  **/
-int num_mines_adjacent(int x, int y, Tile field[FIELD_WIDTH][FIELD_HEIGHT]) {
-    int num_mines = 0;
+uint16_t gather_row(uint64_t bits) {
+    bits &= 0x1111111111111111ULL;
+    bits = (bits | (bits >> 3)) & 0x0303030303030303ULL;
+    bits = (bits | (bits >> 6)) & 0x000F000F000F000FULL;
+    bits = (bits | (bits >> 12)) & 0x000000FF000000FFULL;
+    bits = (bits | (bits >> 24)) & 0xFFFFULL;
+    return (uint16_t)bits;
+}
 
-    for(int i = x-1; i <= x+1; i++) {
-        for(int j = y-1; j <= y+1; j++) {
-            if(in_bounds(i, j)) {
-                if(field[i][j].has_mine) {
-                    num_mines++;
-                }            
-            }
-        }
+// The fixed sizes that can be picked each get their own copy of the work on a field, with every bound known
+#define ENGINE_NAME(name)   name##_beginner
+#define ENGINE_WIDTH        9
+#define ENGINE_HEIGHT       9
+#include "minesweeper_engine.h"
+
+#define ENGINE_NAME(name)   name##_intermediate
+#define ENGINE_WIDTH        16
+#define ENGINE_HEIGHT       16
+#include "minesweeper_engine.h"
+
+#define ENGINE_NAME(name)   name##_expert
+#define ENGINE_WIDTH        30
+#define ENGINE_HEIGHT       16
+#include "minesweeper_engine.h"
+
+// Any other size reads the bounds from the field
+#define ENGINE_NAME(name)   name##_custom
+#define ENGINE_WIDTH        (field->size.width)
+#define ENGINE_HEIGHT       (field->size.height)
+#include "minesweeper_engine.h"
+
+/**
+ * Pick the copy of the work on a field made for its size, or the one that takes any size
+ **/
+const FieldEngine* field_engine(FieldSize size) {
+    if(size.width == FIELD_BEGINNER.width && size.height == FIELD_BEGINNER.height) {
+        return &field_engine_beginner;
+    }
+    if(size.width == FIELD_INTERMEDIATE.width && size.height == FIELD_INTERMEDIATE.height) {
+        return &field_engine_intermediate;
     }
+    if(size.width == FIELD_EXPERT.width && size.height == FIELD_EXPERT.height) {
+        return &field_engine_expert;
+    }
+    return &field_engine_custom;
+}
 
-    return num_mines;
+/**
+ * Check if a field of this size can be played: it fits between the smallest and the largest field and has at
+ * least one mine but no more than (width - 1) * (height - 1), like the classic game
+ **/
+int field_size_valid(FieldSize size) {
+    return size.width >= FIELD_MIN_SIZE && size.width <= FIELD_MAX_WIDTH &&
+           size.height >= FIELD_MIN_SIZE && size.height <= FIELD_MAX_HEIGHT &&
+           size.num_mines >= 1 && size.num_mines <= (size.width - 1) * (size.height - 1);
 }
 
 /**
- * Places a pre determined number of mines randomly across the field.
- * Not thread-safe as it uses the rand() function
+ * Get the next 64 random bits of a generator (xoshiro256**)
  **/
-void place_mines(MinesweeperState *state) {
-    state->mines_remaining = NUM_MINES;
+uint64_t field_random_next(FieldRandom *random) {
+    uint64_t *s = random->s;
+    uint64_t result = s[1] * 5;
+    result = ((result << 7) | (result >> 57)) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
 
-    // Place all of the mines on the field
-    for(int i = 0; i < NUM_MINES; i++) {
-        // Keep searching for an (x, y) coordinate until a tile is found which does not
-        // already contain a mine
-        int x, y;
-        do {
-            x = rand() % FIELD_WIDTH;
-            y = rand() % FIELD_HEIGHT;
-        } while(tile_contains_mine(x, y, state->field));
+/**
+ * Get a random number from 0 up to but not including bound, every one as likely as the others. The top 32 bits
+ * are scaled to the bound by a multiply, and the few results that would make some numbers more likely are drawn
+ * again (Lemire's method), so unlike a modulo there is no bias and no division in the common case.
+ **/
+uint32_t field_random_below(FieldRandom *random, uint32_t bound) {
+    uint64_t m = (field_random_next(random) >> 32) * bound;
+    if((uint32_t)m < bound) {
+        uint32_t threshold = -bound % bound;
+        while((uint32_t)m < threshold) {
+            m = (field_random_next(random) >> 32) * bound;
+        }
+    }
+    return m >> 32;
+}
 
-        // Place mine at (x, y).
-        state->field[x][y].has_mine = 1;
+/**
+ * Seed a random number generator. Generators seeded alike place the mines of their fields alike.
+ **/
+void field_random_seed(FieldRandom *random, uint64_t seed) {
+    // The seed is spread over the whole state with splitmix64, so that similar seeds give unrelated generators
+    for(int i = 0; i < 4; i++) {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        random->s[i] = z ^ (z >> 31);
     }
 }
 
 /**
- * Prepare a Minesweeper field by randomly placing mines and starting the timer.
- * Will reset the previous board state. Not thread safe as it uses the rand function
+ * Places a pre determined number of mines randomly across the field, using the given generator.
+ *
+ * Picks the tiles with Floyd's algorithm: for each of the last num_mines tiles in turn, a tile is drawn from the
+ * ones up to it, and if that one already has a mine the mine goes on the tile itself instead. Every set of tiles
+ * is as likely as any other, and it takes exactly one draw per mine however dense the field is, where drawing
+ * again until a free tile comes up slows down as the field fills.
  **/
-void minesweeper_init(MinesweeperState *state) {
-    // Reset everything
-    reset_field(state->field);
-    place_mines(state);
-    state->game_won = 0;
-    state->game_start_time = time(NULL);
+void place_mines(Field *field, FieldRandom *random) {
+    FieldSize size = field->size;
+    int num_tiles = size.width * size.height;
 
-    // Iterate throughout the field and count how many mines can be found ajacent to each tile
-    for(int x = 0; x < FIELD_WIDTH; x++){ 
-        for(int y = 0; y < FIELD_HEIGHT; y++) {
-            state->field[x][y].adjacent_mines = num_mines_adjacent(x, y, state->field);
+    for(int last = num_tiles - size.num_mines; last < num_tiles; last++) {
+        int tile = field_random_below(random, last + 1);
+        if(field->mines[tile / size.width + 1] & FIELD_BIT(tile % size.width)) {
+            tile = last;
         }
+        field->mines[tile / size.width + 1] |= FIELD_BIT(tile % size.width);
     }
+}
+
+/**
+ * Fill a field of the given size with randomly placed mines, ready for a game to start on it. Only uses the
+ * given generator, so fields can be made on any thread ahead of the games that will be played on them.
+ **/
+void field_generate(Field *field, FieldSize size, FieldRandom *random) {
+    reset_field(field, size);
+    place_mines(field, random);
+
+    // Count how many mines can be found ajacent to each tile
+    field_engine(size)->count_adjacent_mines(field);
+}
+
+/**
+ * Start a game on the field already in the state, made by field_generate, and start the timer
+ **/
+void minesweeper_start(MinesweeperState *state) {
+    state->engine = field_engine(state->field.size);
+    state->mines_remaining = state->field.size.num_mines;
+    state->game_won = 0;
+    state->game_start_time = time(NULL);
+    state->num_dirty_tiles = 0;
+    state->needs_resync = 1;
+}
+
+/**
+ * Prepare a Minesweeper field of the given size by randomly placing mines and starting the timer.
+ * Will reset the previous board state. Only uses the game's own generator, so it is safe to call on any thread.
+ **/
+void minesweeper_init(MinesweeperState *state, FieldSize size) {
+    field_generate(&state->field, size, &state->random);
+    minesweeper_start(state);
 }
\ No newline at end of file
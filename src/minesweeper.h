@@ -1,46 +1,133 @@
 #ifndef MINESWEEPER_H
 #define MINESWEEPER_H
 
-#define FIELD_WIDTH     9
-#define FIELD_HEIGHT    9
-#define NUM_MINES       10
+#include <stdint.h>
+
+#define FIELD_MAX_WIDTH     30      // The columns are numbered from 1
+#define FIELD_MAX_HEIGHT    26      // The rows are lettered from A
+#define FIELD_MIN_SIZE      2       // The fewest columns or rows a field can have
 
 #define MINE_SPRITE     '*'
 #define FLAG_SPRITE     '+'
 
 /**
- * A tile is one point in the Minesweeper field. Ie., the field is made of 
- * many tiles.
+ * The size of a field and how many mines are hidden in it
+ **/
+typedef struct {
+    int width;
+    int height;
+    int num_mines;
+} FieldSize;
+
+// The sizes that can be picked when starting a game. Any other valid size is played as a custom game.
+#define FIELD_BEGINNER      ((FieldSize){9, 9, 10})
+#define FIELD_INTERMEDIATE  ((FieldSize){16, 16, 40})
+#define FIELD_EXPERT        ((FieldSize){30, 16, 99})
+
+// Each row of the field is a word of bits with a border of one tile around it, so a neighbour is never out of bounds
+#if FIELD_MAX_WIDTH + 2 > 32
+#error "A row of the field and its border must fit in 32 bits"
+#endif
+#define FIELD_MAX_ROWS      (FIELD_MAX_HEIGHT + 2)              // The rows of a field along with the border above and below
+#define FIELD_BIT(x)        ((uint32_t)1 << ((x) + 1))          // The bit of the tile in column x of a row
+#define FIELD_INNER(width)  ((((uint32_t)1 << (width)) - 1) << 1)   // The bits of a row that are tiles rather than the border
+#define FIELD_LANE_WORDS    2       // How many words of 16 tiles hold the mine counts of a row and its border
+
+/**
+ * The Minesweeper field, packed into planes of bits. Row y of the field is at index y + 1 of each plane and
+ * the tile in column x is at FIELD_BIT(x). The border is never a mine and is always revealed, so the fill that
+ * reveals the tiles stops at it without checking any bounds. The fill works on whole rows at once (see reveal_tile).
+ **/
+typedef struct {
+    FieldSize size;
+    uint32_t mines[FIELD_MAX_ROWS];
+    uint32_t revealed[FIELD_MAX_ROWS];
+    uint32_t flags[FIELD_MAX_ROWS];
+    uint32_t dirty[FIELD_MAX_ROWS];     // The tiles that changed since the field was last sent to the client
+    uint32_t empty[FIELD_MAX_ROWS];     // The tiles with no mines around them, which reveal the tiles around them too
+    // How many mines are around each tile of a row, 4 bits per tile in the same order as the bits of the row
+    uint64_t adjacent[FIELD_MAX_HEIGHT][FIELD_LANE_WORDS];
+} Field;
+
+/**
+ * The work on a field that depends on its size, specialized for the sizes that can be picked (see minesweeper_engine.h)
  **/
 typedef struct {
-    int adjacent_mines;
-    int revealed;
-    int has_mine;
-    int has_flag;
-} Tile;
+    void (*count_adjacent_mines)(Field *field);
+    int (*reveal_fill)(int x, int y, Field *field, int *cells);
+} FieldEngine;
+
+/**
+ * The state of a random number generator (xoshiro256**). Each game and the board pool have their own, so fields
+ * can be made on any number of threads at once without sharing anything.
+ **/
+typedef struct {
+    uint64_t s[4];
+} FieldRandom;
 
 /**
  * Contains information about a current game of Minesweeper
  **/
 typedef struct {
-    Tile field[FIELD_WIDTH][FIELD_HEIGHT];
+    Field field;
+    FieldRandom random;         // Where the mines of the next field are placed from, seeded once with field_random_seed
+    const FieldEngine *engine;  // Picked for the size of the field when the game starts
     int mines_remaining;
     int game_won;
     time_t game_start_time;
     time_t game_time_taken;
+    int game_rank;          // Where the game placed on the leaderboard if it was won and ranked, otherwise 0
     char* username;
+
+    // The tiles that changed since the field was last sent to the client, so only those have to be sent again
+    int dirty_tiles[FIELD_MAX_WIDTH * FIELD_MAX_HEIGHT];    // Index of each tile (y * width + x) in the order they changed
+    int num_dirty_tiles;
+    int needs_resync;       // Set when the whole field has to be sent again (eg. a new game started)
 } MinesweeperState;
 
 /**
- * Prepare a Minesweeper field by randomly placing mines and starting the timer.
- * Will reset the previous board state. Not thread safe as it uses the rand function
+ * Check if a field of this size can be played: it fits between the smallest and the largest field and has at
+ * least one mine but no more than (width - 1) * (height - 1), like the classic game
+ **/
+int field_size_valid(FieldSize size);
+
+// The copy of the work on a field that takes any size, which the other sizes are compared against
+extern const FieldEngine field_engine_custom;
+
+/**
+ * Pick the copy of the work on a field made for its size, or the one that takes any size
+ **/
+const FieldEngine* field_engine(FieldSize size);
+
+/**
+ * Seed a random number generator. Generators seeded alike place the mines of their fields alike.
+ **/
+void field_random_seed(FieldRandom *random, uint64_t seed);
+
+/**
+ * Fill a field of the given size with randomly placed mines, ready for a game to start on it. Only uses the
+ * given generator, so fields can be made on any thread ahead of the games that will be played on them.
  **/
-void minesweeper_init(MinesweeperState *state);
+void field_generate(Field *field, FieldSize size, FieldRandom *random);
 
 /**
- * Sets a tile at the specified coordinates to revealed. 
+ * Start a game on the field already in the state, made by field_generate, and start the timer
  **/
-void reveal_tile(int x, int y, MinesweeperState *state);
+void minesweeper_start(MinesweeperState *state);
+
+/**
+ * Prepare a Minesweeper field of the given size by randomly placing mines and starting the timer.
+ * Will reset the previous board state. Only uses the game's own generator, so it is safe to call on any thread.
+ **/
+void minesweeper_init(MinesweeperState *state, FieldSize size);
+
+/**
+ * Sets a tile at the specified coordinates to revealed, along with every tile reached through tiles that have
+ * no mines around them. The tiles revealed are the last ones added to the dirty tiles.
+ *
+ * Returns how many tiles were revealed
+ **/
+int reveal_tile(int x, int y, MinesweeperState *state);
 
 /**
  * Attempts to place a flag at a coordinate in the game field.
@@ -56,10 +143,30 @@ int flag_tile(int x, int y, MinesweeperState *state);
 void show_mines(MinesweeperState *state, int show_flags);
 
 /**
- * Converts a coordinate from the game (such as A1, 1A, B2, etc.) into coordinates 
- * that match to the field array
+ * Forget which tiles changed. Called once the field has been sent to the client.
+ **/
+void clear_dirty_tiles(MinesweeperState *state);
+
+/**
+ * Returns true if the tile at the given coordinate has been revealed
+ **/
+int tile_revealed(int x, int y, MinesweeperState *state);
+
+/**
+ * Returns true if the tile at the given coordinate contains a mine
+ **/
+int tile_has_mine(int x, int y, MinesweeperState *state);
+
+/**
+ * Get the character that represents a tile when the field is drawn
+ **/
+char tile_sprite(int x, int y, MinesweeperState *state);
+
+/**
+ * Converts a coordinate from the game (such as A1, 1A, B12, 12B, etc.) into coordinates
+ * that match to the field of the game
  * Will return a 1 if the conversion was successful
  **/
-int convert_coordinate(char *coord, int *x, int *y);
+int convert_coordinate(const char *coord, int *x, int *y, MinesweeperState *state);
 
 #endif // MINESWEEPER_H
\ No newline at end of file
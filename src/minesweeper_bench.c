@@ -0,0 +1,95 @@
+#define _POSIX_C_SOURCE 199309L // Required to use clock_gettime
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "minesweeper.h"
+
+/**
+ * Times the copies of the work on a field made for the sizes that can be picked against the copy that takes any
+ * size, on the same fields. Built and run with "make bench".
+ **/
+
+#define BENCH_FIELDS        64          // How many different fields each size is timed on
+#define BENCH_ROUNDS        20000       // How many fields are worked on for each timing, going round the different ones
+
+/**
+ * Get the current time in nanoseconds
+ **/
+double bench_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/**
+ * Time counting the mines around every tile and revealing from every tile that has no mine, in ns per field
+ **/
+void bench_engine(const FieldEngine* engine, Field* fields, double* count_ns, double* reveal_ns) {
+    static Field field;
+    static int cells[FIELD_MAX_WIDTH * FIELD_MAX_HEIGHT];
+    long revealed = 0;
+
+    double start = bench_now_ns();
+    for(int round = 0; round < BENCH_ROUNDS; round++) {
+        field = fields[round % BENCH_FIELDS];
+        engine->count_adjacent_mines(&field);
+    }
+    double copy_start = bench_now_ns();
+    for(int round = 0; round < BENCH_ROUNDS; round++) {
+        field = fields[round % BENCH_FIELDS];
+        __asm__ volatile("" : : "r"(&field) : "memory");   // Keeps the copy from being optimized away
+    }
+    double copy_ns = bench_now_ns() - copy_start;
+    *count_ns = (copy_start - start - copy_ns) / BENCH_ROUNDS;
+
+    // Each round reveals the tiles one at a time, most of them already revealed by an earlier fill
+    start = bench_now_ns();
+    for(int round = 0; round < BENCH_ROUNDS; round++) {
+        field = fields[round % BENCH_FIELDS];
+        for(int y = 0; y < field.size.height; y++) {
+            for(int x = 0; x < field.size.width; x++) {
+                if(!(field.mines[y + 1] & FIELD_BIT(x))) {
+                    revealed += engine->reveal_fill(x, y, &field, cells);
+                }
+            }
+        }
+    }
+    *reveal_ns = (bench_now_ns() - start - copy_ns) / BENCH_ROUNDS;
+
+    if(revealed == 0) {
+        printf("Nothing was revealed\n");
+    }
+}
+
+int main() {
+    FieldSize sizes[] = {FIELD_BEGINNER, FIELD_INTERMEDIATE, FIELD_EXPERT};
+    const char* names[] = {"Beginner", "Intermediate", "Expert"};
+    static Field fields[BENCH_FIELDS];
+    FieldRandom random;
+    field_random_seed(&random, 42);
+
+    printf("%-14s %-12s %12s %12s\n", "Size", "Engine", "Count (ns)", "Reveal (ns)");
+    for(int i = 0; i < 3; i++) {
+        for(int j = 0; j < BENCH_FIELDS; j++) {
+            field_generate(&fields[j], sizes[i], &random);
+        }
+
+        double count_ns, reveal_ns;
+        bench_engine(field_engine(sizes[i]), fields, &count_ns, &reveal_ns);
+        printf("%-14s %-12s %12.1f %12.1f\n", names[i], "specialized", count_ns, reveal_ns);
+        bench_engine(&field_engine_custom, fields, &count_ns, &reveal_ns);
+        printf("%-14s %-12s %12.1f %12.1f\n", names[i], "generic", count_ns, reveal_ns);
+    }
+
+    // Setting up a whole game: placing the mines and counting them
+    MinesweeperState state;
+    field_random_seed(&state.random, 42);
+    double start = bench_now_ns();
+    for(int round = 0; round < BENCH_ROUNDS; round++) {
+        minesweeper_init(&state, FIELD_BEGINNER);
+    }
+    printf("Starting a %dx%d game takes %.1f ns\n", FIELD_BEGINNER.width, FIELD_BEGINNER.height,
+           (bench_now_ns() - start) / BENCH_ROUNDS);
+    return 0;
+}
@@ -0,0 +1,118 @@
+/**
+ * The work on a Minesweeper field that depends on its size. This file is included by minesweeper.c once for each
+ * size that gets its own copy of the functions, with these defined beforehand:
+ *      ENGINE_NAME(name)   The name of a function in this copy, eg. name##_9x9
+ *      ENGINE_WIDTH        The number of columns, a constant or field->size.width for the copy that takes any size
+ *      ENGINE_HEIGHT       The number of rows, a constant or field->size.height
+ * When they are constants the compiler knows every bound, so it unrolls the loops and drops the branches that
+ * don't apply to that size. There is no include guard on purpose, and the definitions are undone at the end.
+ **/
+
+// How many words of 16 tiles hold the mine counts of a row and its border
+#define ENGINE_WORDS    (((ENGINE_WIDTH) + 2 + 15) / 16)
+
+/**
+ * Counts the mines around every tile of the field at once. Each row of mines is spread out to 4 bits a tile and
+ * the rows above and below are added to it, then the sums are shifted by a tile either way and added up again, so
+ * every 4 bits end up with the number of mines in the 3x3 block around the tile. The sums never go past 9, so no
+ * tile ever carries into the next one. Rows wider than 16 tiles (with the border) carry on in a second word, and
+ * the tiles on either side of the split are shifted across it.
+ **/
+void ENGINE_NAME(count_adjacent_mines)(Field *field) {
+    uint64_t spread[FIELD_MAX_ROWS][FIELD_LANE_WORDS];
+    for(int row = 0; row < (ENGINE_HEIGHT) + 2; row++) {
+        spread[row][0] = spread_row(field->mines[row] & 0xFFFF);
+        if(ENGINE_WORDS > 1) {
+            spread[row][1] = spread_row(field->mines[row] >> 16);
+        }
+    }
+
+    for(int y = 0; y < (ENGINE_HEIGHT); y++) {
+        uint64_t low = spread[y][0] + spread[y + 1][0] + spread[y + 2][0];
+        uint64_t block_low = low + (low << 4) + (low >> 4);
+        uint64_t block_high = 0;
+        if(ENGINE_WORDS > 1) {
+            uint64_t high = spread[y][1] + spread[y + 1][1] + spread[y + 2][1];
+            block_low += high << 60;
+            block_high = high + (high << 4) + (high >> 4) + (low >> 60);
+        }
+        field->adjacent[y][0] = block_low;
+        field->adjacent[y][1] = block_high;
+
+        // A tile is empty when none of its 4 bits are set
+        uint32_t empty = gather_row(~(block_low | (block_low >> 1) | (block_low >> 2) | (block_low >> 3)));
+        if(ENGINE_WORDS > 1) {
+            empty |= (uint32_t)gather_row(~(block_high | (block_high >> 1) | (block_high >> 2) | (block_high >> 3))) << 16;
+        }
+        field->empty[y + 1] = empty & FIELD_INNER(ENGINE_WIDTH);
+    }
+}
+
+/**
+ * Reveals a tile and, if no mines are around it, every tile around it, until the revealed area is bordered by
+ * tiles that have mines around them. Rather than visiting the tiles one by one, the whole frontier grows by a
+ * tile in every direction at once: each row of the frontier is ORed with the rows above and below it and shifted
+ * a tile left and right. Whatever it grows into that wasn't revealed yet is revealed, and the empty tiles among
+ * those make up the next frontier. The border is always revealed, so nothing grows past it.
+ *
+ * Returns how many tiles were revealed, their indexes (y * width + x) are written to cells in row order
+ **/
+int ENGINE_NAME(reveal_fill)(int x, int y, Field *field, int *cells) {
+    if(field->revealed[y + 1] & FIELD_BIT(x)) {
+        return 0;
+    }
+    uint32_t fresh[FIELD_MAX_ROWS];         // Every tile revealed by this fill
+    uint32_t frontier[FIELD_MAX_ROWS];      // The empty tiles revealed by the last step, which reveal their neighbours
+    uint32_t grown[FIELD_MAX_ROWS];
+    // Only the rows of this field and its border are used
+    memset(fresh, 0, ((ENGINE_HEIGHT) + 2) * sizeof(uint32_t));
+    memset(frontier, 0, ((ENGINE_HEIGHT) + 2) * sizeof(uint32_t));
+    field->revealed[y + 1] |= FIELD_BIT(x);
+    fresh[y + 1] = FIELD_BIT(x);
+    frontier[y + 1] = field->empty[y + 1] & FIELD_BIT(x);
+
+    // Only the rows next to the frontier can change
+    int first = y + 1, last = (frontier[y + 1] != 0) ? y + 1 : y;
+    while(first <= last) {
+        int from = (first > 1) ? first - 1 : 1;
+        int to = (last < (ENGINE_HEIGHT)) ? last + 1 : (ENGINE_HEIGHT);
+        for(int row = from; row <= to; row++) {
+            uint32_t around = frontier[row - 1] | frontier[row] | frontier[row + 1];
+            around |= (around << 1) | (around >> 1);
+            grown[row] = around & ~field->revealed[row];
+        }
+
+        first = FIELD_MAX_ROWS;
+        last = 0;
+        for(int row = from; row <= to; row++) {
+            field->revealed[row] |= grown[row];
+            fresh[row] |= grown[row];
+            frontier[row] = grown[row] & field->empty[row];
+            if(frontier[row] != 0) {
+                first = (row < first) ? row : first;
+                last = row;
+            }
+        }
+    }
+
+    int num_cells = 0;
+    for(int row = 1; row <= (ENGINE_HEIGHT); row++) {
+        for(uint32_t bits = fresh[row]; bits != 0; bits &= bits - 1) {
+            cells[num_cells++] = (row - 1) * (ENGINE_WIDTH) + __builtin_ctz(bits) - 1;
+        }
+    }
+    return num_cells;
+}
+
+/**
+ * The functions of this copy, to be picked by the size of a field
+ **/
+const FieldEngine ENGINE_NAME(field_engine) = {
+    ENGINE_NAME(count_adjacent_mines),
+    ENGINE_NAME(reveal_fill),
+};
+
+#undef ENGINE_WORDS
+#undef ENGINE_NAME
+#undef ENGINE_WIDTH
+#undef ENGINE_HEIGHT
@@ -0,0 +1,426 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+// Threads
+#include <pthread.h>
+// Sockets
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "message.h"
+#include "session.h"
+#include "game.h"
+#include "timer.h"
+#include "auth.h"
+#include "reactor.h"
+
+#define REACTOR_MAX_EVENTS      256     // How many events a reactor thread handles each time it wakes up
+
+/**
+ * A single reactor thread along with the sessions it owns
+ **/
+struct reactor {
+    pthread_t thread;
+    int epollfd;                        // Waits on the sockets of every session owned by this reactor
+    int eventfd;                        // Wakes the reactor up when a client is handed to it or the server is stopping
+    int num_sessions;                   // How many sessions are owned by this reactor
+
+    pthread_mutex_t incoming_mutex;     // Protects the incoming list
+    struct session* incoming;           // Sessions handed over by the acceptor that haven't been registered yet
+    struct auth_request* verified;      // Logins the authentication stage has checked. Protected by the incoming mutex
+    struct session* sessions;           // HEAD of the list of sessions owned by this reactor
+    struct timer_wheel wheel;           // The deadlines of the sessions owned by this reactor
+};
+
+struct reactor* reactors = NULL;        // The reactor threads
+int reactors_size = 0;                  // How many reactor threads were started
+unsigned int reactor_next = 0;          // The reactor the next client will be handed to
+int reactor_keep_alive = 1;             // Cleared when the reactor threads should stop
+
+/**
+ * Removes a session from the reactor, closes the socket and frees its memory
+ **/
+void reactor_close_session(struct reactor* reactor, struct session* session) {
+    if(session->auth.pending) {
+        // The authentication stage still holds the session, so it is closed once the login is handed back
+        session->state = EXIT;
+        session_timers_stop(session, &reactor->wheel);
+        return;
+    }
+
+    // Unlink the session from the reactor's list
+    if(session->prev != NULL) {
+        session->prev->next = session->next;
+    } else {
+        reactor->sessions = session->next;
+    }
+    if(session->next != NULL) {
+        session->next->prev = session->prev;
+    }
+    __atomic_sub_fetch(&reactor->num_sessions, 1, __ATOMIC_RELAXED);
+    session_timers_stop(session, &reactor->wheel);
+
+    // Closing the socket also removes it from the epoll instance
+    close(session->sockfd);
+    printf("Client disconnected. Socket: %d.\n", session->sockfd);
+
+    session_free(session);
+    free(session);
+}
+
+/**
+ * Called by the reactor's wheel when a client took too long. The client is told why before being disconnected.
+ **/
+void reactor_session_timeout(struct timer* timer, void* arg) {
+    struct reactor* reactor = arg;
+    struct session* session = timer->data;
+
+    session_timed_out(session);
+    printf("Client timed out. Socket: %d.\n", session->sockfd);
+    session->awaiting_ack = 0;
+    session_puts(session, MSGC_EXIT, SESSION_TIMEOUT_MESSAGE);
+    session_present(session);
+    reactor_close_session(reactor, session);
+}
+
+/**
+ * Registers the sessions handed over by the acceptor. The welcome screen is drawn before the socket
+ * is added to the epoll instance so that all of a session's work happens on this thread.
+ **/
+void reactor_register_incoming(struct reactor* reactor) {
+    pthread_mutex_lock(&reactor->incoming_mutex);
+    struct session* session = reactor->incoming;
+    reactor->incoming = NULL;
+    pthread_mutex_unlock(&reactor->incoming_mutex);
+
+    while(session != NULL) {
+        struct session* next = session->next;
+
+        // Add the session to the list owned by this reactor
+        session->prev = NULL;
+        session->next = reactor->sessions;
+        if(reactor->sessions != NULL) {
+            reactor->sessions->prev = session;
+        }
+        reactor->sessions = session;
+
+        // Display the welcome banner
+        game_start(session);
+        if(session->state == EXIT) {
+            reactor_close_session(reactor, session);
+            session = next;
+            continue;
+        }
+
+        session_timers_start(session, &reactor->wheel, reactor_session_timeout);
+
+        // Edge triggered so the reactor is only woken up when something new happens at the socket
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = session;
+        if(epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, session->sockfd, &event) == -1) {
+            perror("Error adding client to the reactor");
+            reactor_close_session(reactor, session);
+        }
+
+        session = next;
+    }
+}
+
+/**
+ * Called by an authentication thread once a login was checked. Hands the session back to its reactor.
+ **/
+void reactor_auth_done(struct auth_request* request) {
+    struct reactor* reactor = request->owner;
+
+    pthread_mutex_lock(&reactor->incoming_mutex);
+    int wake = (reactor->verified == NULL);
+    request->next = reactor->verified;
+    reactor->verified = request;
+    pthread_mutex_unlock(&reactor->incoming_mutex);
+
+    // The reactor is already due to wake up if other logins were waiting to be handed back
+    if(wake) {
+        uint64_t value = 1;
+        if(write(reactor->eventfd, &value, sizeof(value)) < 0) {
+            perror("Reactor eventfd");
+        }
+    }
+}
+
+/**
+ * Reads everything the client has sent, passes each message to the game and writes out whatever the
+ * game wants to send back.
+ **/
+void reactor_handle_session(struct reactor* reactor, struct session* session, uint32_t events) {
+    int closed = (events & (EPOLLERR | EPOLLHUP)) != 0;
+
+    if(!closed && (events & (EPOLLIN | EPOLLRDHUP))) {
+        char buffer[MESSAGE_MAX_SIZE];
+        int result = 0;
+        // Keep reading until the socket is drained as the epoll instance is edge triggered. While a login is being
+        // checked, whatever the client sends after it is left in the inbox and the socket until it is handed back.
+        while(!session->auth.pending) {
+            result = session_fill(session);
+
+            int size = 0;
+            while(!session->auth.pending && (size = session_next_message(session, buffer, sizeof(buffer))) > 0) {
+                game_update(session, buffer, size);
+                session_timers_touch(session, &reactor->wheel);
+
+                if(session->state == LOGIN_VERIFYING && !session->auth.pending) {
+                    // Check the login on the authentication stage, the session is handed back once it has been
+                    session->auth.done = reactor_auth_done;
+                    session->auth.owner = reactor;
+                    auth_submit(&session->auth);
+                }
+            }
+            if(size < 0) {
+                // The client sent something that doesn't follow the protocol
+                result = -1;
+            }
+            if(result <= 0) {
+                break;
+            }
+        }
+
+        if(result < 0) {
+            closed = 1;
+        }
+    }
+
+    if(!closed && (session_flush(session) < 0)) {
+        closed = 1;
+    }
+
+    if(closed || session_finished(session)) {
+        reactor_close_session(reactor, session);
+    }
+}
+
+/**
+ * Shows the clients whose login was checked whether they are logged in
+ **/
+void reactor_handle_verified(struct reactor* reactor) {
+    pthread_mutex_lock(&reactor->incoming_mutex);
+    struct auth_request* request = reactor->verified;
+    reactor->verified = NULL;
+    pthread_mutex_unlock(&reactor->incoming_mutex);
+
+    while(request != NULL) {
+        struct auth_request* next = request->next;
+        struct session* session = request->data;
+        request->pending = 0;
+
+        if(session->state == EXIT) {
+            // The client left or timed out while its login was being checked
+            reactor_close_session(reactor, session);
+        } else {
+            game_login_verified(session, request->verified);
+            session_timers_touch(session, &reactor->wheel);
+            if(session_finished(session)) {
+                reactor_close_session(reactor, session);
+            } else {
+                // Carry on with whatever the client sent while its login was being checked
+                reactor_handle_session(reactor, session, EPOLLIN);
+            }
+        }
+
+        request = next;
+    }
+}
+
+/**
+ * The main function of each reactor thread. Waits for events on the sockets of the sessions it owns
+ * and drives their game state machine.
+ **/
+void* reactor_loop(void* arg) {
+    struct reactor* reactor = arg;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    while(reactor_keep_alive) {
+        // Only wake up for the ticks of the wheel while some session has a deadline
+        int timeout_ms = (timer_wheel_size(&reactor->wheel) > 0) ? reactor->wheel.tick_ms : -1;
+        int num_events = epoll_wait(reactor->epollfd, events, REACTOR_MAX_EVENTS, timeout_ms);
+        if(num_events == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("Reactor epoll_wait");
+            break;
+        }
+
+        int woken = 0;
+        for(int i = 0; i < num_events; i++) {
+            if(events[i].data.ptr == NULL) {
+                woken = 1;
+            } else {
+                reactor_handle_session(reactor, events[i].data.ptr, events[i].events);
+            }
+        }
+        if(woken) {
+            // The eventfd was written to. A client was handed over, a login was checked or the server is stopping.
+            // Handled once the batch is done, as a login that fails closes its session, which a later event of the
+            // batch could still point to.
+            uint64_t value;
+            if(read(reactor->eventfd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                perror("Reactor eventfd");
+            }
+            reactor_register_incoming(reactor);
+            reactor_handle_verified(reactor);
+        }
+
+        timer_wheel_advance(&reactor->wheel, reactor);
+    }
+
+    // The authentication stage is stopped first, so every login it checked has been handed back
+    reactor_handle_verified(reactor);
+
+    // Tell all of the clients still connected to exit
+    while(reactor->sessions != NULL) {
+        struct session* session = reactor->sessions;
+        session->awaiting_ack = 0;
+        session_puts(session, MSGC_EXIT, "Server is offline.\n");
+        session_present(session);
+        reactor_close_session(reactor, session);
+    }
+
+    return NULL;
+}
+
+/**
+ * Create the reactor threads that will handle the clients. If pin is set, reactor thread i only runs on core i
+ * (wrapping around when there are more threads than cores).
+ **/
+void reactor_start(int num_threads, int pin) {
+    reactors = calloc(num_threads, sizeof(struct reactor));
+    if(!reactors) {
+        perror("Error creating the reactor: out of memory");
+        exit(1);
+    }
+    reactors_size = num_threads;
+
+    for(int i = 0; i < num_threads; i++) {
+        struct reactor* reactor = &reactors[i];
+        pthread_mutex_init(&reactor->incoming_mutex, NULL);
+        timer_wheel_init(&reactor->wheel, SESSION_TIMER_TICK_MS);
+
+        reactor->epollfd = epoll_create1(0);
+        reactor->eventfd = eventfd(0, EFD_NONBLOCK);
+        if(reactor->epollfd == -1 || reactor->eventfd == -1) {
+            perror("Error creating the reactor");
+            exit(1);
+        }
+
+        // The eventfd is the only thing in the epoll instance that doesn't point to a session
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        if(epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, reactor->eventfd, &event) == -1) {
+            perror("Error creating the reactor");
+            exit(1);
+        }
+
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if(pin) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+        if(pthread_create(&reactor->thread, &attr, reactor_loop, reactor) != 0) {
+            perror("Error creating the reactor");
+            exit(1);
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+/**
+ * Hand a newly connected client to one of the reactor threads. The socket is made non-blocking.
+ *
+ * Returns the number of sessions handled by the reactor thread that received the client
+ **/
+int reactor_add_client(int client_sockfd) {
+    // Spread the clients across the reactor threads
+    return reactor_add_client_to(reactor_next++ % reactors_size, client_sockfd);
+}
+
+/**
+ * Hand a newly connected client to a specific reactor thread. The socket is made non-blocking.
+ *
+ * Returns the number of sessions handled by the reactor thread
+ **/
+int reactor_add_client_to(int reactor_index, int client_sockfd) {
+    // Make the socket non-blocking so the reactor threads never wait on a client
+    int flags = fcntl(client_sockfd, F_GETFL, 0);
+    fcntl(client_sockfd, F_SETFL, flags | O_NONBLOCK);
+
+    struct session* session = malloc(sizeof(struct session));
+    if(!session) {
+        perror("Error adding client to the reactor: out of memory");
+        exit(1);
+    }
+    session_init(session, client_sockfd, 1);
+
+    struct reactor* reactor = &reactors[reactor_index % reactors_size];
+    int size = __atomic_add_fetch(&reactor->num_sessions, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&reactor->incoming_mutex);
+    session->next = reactor->incoming;
+    reactor->incoming = session;
+    pthread_mutex_unlock(&reactor->incoming_mutex);
+
+    // Wake the reactor up so it registers the session
+    uint64_t value = 1;
+    if(write(reactor->eventfd, &value, sizeof(value)) < 0) {
+        perror("Reactor eventfd");
+    }
+
+    return size;
+}
+
+/**
+ * Get how many sessions all of the reactor threads are handling
+ **/
+int reactor_num_sessions() {
+    int num_sessions = 0;
+    for(int i = 0; i < reactors_size; i++) {
+        num_sessions += __atomic_load_n(&reactors[i].num_sessions, __ATOMIC_RELAXED);
+    }
+    return num_sessions;
+}
+
+/**
+ * Stop all the reactor threads. Every client still connected is told the server is offline and disconnected.
+ * The authentication stage must be stopped first.
+ **/
+void reactor_stop() {
+    reactor_keep_alive = 0;
+
+    // Wake up every reactor so it notices it has to stop
+    for(int i = 0; i < reactors_size; i++) {
+        uint64_t value = 1;
+        if(write(reactors[i].eventfd, &value, sizeof(value)) < 0) {
+            perror("Reactor eventfd");
+        }
+    }
+
+    for(int i = 0; i < reactors_size; i++) {
+        pthread_join(reactors[i].thread, NULL);
+        close(reactors[i].epollfd);
+        close(reactors[i].eventfd);
+    }
+
+    free(reactors);
+    reactors = NULL;
+    reactors_size = 0;
+}
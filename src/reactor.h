@@ -0,0 +1,42 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+/**
+ * The reactor is the event-driven alternative to the threadpool. Instead of a thread blocking on each
+ * client, a small number of threads each wait on an epoll instance and advance a session's game state
+ * machine whenever its socket becomes readable or writable. Every session is owned by a single reactor
+ * thread, so the session itself never needs to be locked.
+ **/
+
+/**
+ * Create the reactor threads that will handle the clients. If pin is set, reactor thread i only runs on core i
+ * (wrapping around when there are more threads than cores).
+ **/
+void reactor_start(int num_threads, int pin);
+
+/**
+ * Hand a newly connected client to one of the reactor threads. The socket is made non-blocking.
+ *
+ * Returns the number of sessions handled by the reactor thread that received the client
+ **/
+int reactor_add_client(int client_sockfd);
+
+/**
+ * Hand a newly connected client to a specific reactor thread. The socket is made non-blocking.
+ *
+ * Returns the number of sessions handled by the reactor thread
+ **/
+int reactor_add_client_to(int reactor_index, int client_sockfd);
+
+/**
+ * Get how many sessions all of the reactor threads are handling
+ **/
+int reactor_num_sessions();
+
+/**
+ * Stop all the reactor threads. Every client still connected is told the server is offline and disconnected.
+ * The authentication stage must be stopped first.
+ **/
+void reactor_stop();
+
+#endif // REACTOR_H
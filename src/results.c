@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+// Threads
+#include <pthread.h>
+#include <sched.h>
+
+#include "ring.h"
+#include "leaderboard.h"
+#include "history.h"
+#include "window.h"
+#include "results.h"
+
+/**
+ * The result of a game waiting to be added to the leaderboard
+ **/
+struct result {
+    struct result* next;        // The result submitted just before this one
+    int time_taken;
+    int outcome;                // One of RESULT_*
+    long ended;                 // When the game ended, which places it in the windows
+    char username[];
+};
+
+struct result* results_queue = NULL;    // The results waiting to be applied, the latest first
+pthread_t results_thread;               // The aggregator
+int results_running = 0;                // Set while the aggregator is taking results off the queue
+int results_submitting = 0;             // How many threads are in the middle of queueing a result, so stopping can wait for them
+unsigned int results_stopping = 0;      // Set when the aggregator should stop once the queue is empty
+unsigned int results_sleeping = 0;      // Set while the aggregator sleeps on an empty queue. Also the futex it sleeps on
+pthread_mutex_t results_mutex = PTHREAD_MUTEX_INITIALIZER;  // Keeps the results in the same order in the log and the leaderboard
+
+struct results_stats results_stats = {0};
+
+/**
+ * Add the result of a game (one of RESULT_*) to the leaderboard and to the windows it ended in.
+ * Must be called with the leaderboard locked.
+ **/
+void results_record(char* username, int time_taken, int outcome, long ended) {
+    // Add the score for the won game to the leaderboard, if it was won on the field that is ranked
+    if(outcome == RESULT_WON) {
+        leaderboard_add_score(username, time_taken);
+    }
+    // Modify this user's leaderboard data to increase number of games played
+    int game_won = (outcome != RESULT_LOST);
+    leaderboard_update_user_games(username, game_won);
+    window_add_result(leaderboard_user_id(username), time_taken, game_won, outcome == RESULT_WON, ended);
+}
+
+/**
+ * Add a list of results to the leaderboard in the order they were submitted. The results are logged with a single
+ * sync first, so they are kept if the server stops. The leaderboard is only locked once they are on the disk, and
+ * any snapshot that is due is written after it is unlocked.
+ **/
+void results_apply(struct result* first) {
+    pthread_mutex_lock(&results_mutex);
+    for(struct result* result = first; result != NULL; result = result->next) {
+        history_add(result->username, result->time_taken, result->outcome, result->ended);
+    }
+    history_commit();
+
+    leaderboard_lock();
+    for(struct result* result = first; result != NULL; result = result->next) {
+        results_record(result->username, result->time_taken, result->outcome, result->ended);
+    }
+    leaderboard_unlock();
+    history_checkpoint();
+    pthread_mutex_unlock(&results_mutex);
+}
+
+/**
+ * Deallocate a list of results
+ **/
+void results_free(struct result* result) {
+    while(result != NULL) {
+        struct result* next = result->next;
+        free(result);
+        result = next;
+    }
+}
+
+/**
+ * The main function of the aggregator. Takes every result queued so far in one go, so a burst of games ending
+ * costs a single wake up and a single lock of the leaderboard.
+ **/
+void* results_loop(void* arg) {
+    while(1) {
+        struct result* batch = __atomic_exchange_n(&results_queue, NULL, __ATOMIC_ACQUIRE);
+        if(batch == NULL) {
+            if(__atomic_load_n(&results_stopping, __ATOMIC_SEQ_CST)) {
+                break;
+            }
+            // Announce the sleep before checking the queue one last time, so a result queued meanwhile wakes us up
+            __atomic_store_n(&results_sleeping, 1, __ATOMIC_SEQ_CST);
+            if(__atomic_load_n(&results_queue, __ATOMIC_SEQ_CST) == NULL &&
+               !__atomic_load_n(&results_stopping, __ATOMIC_SEQ_CST)) {
+                ring_futex_wait(&results_sleeping, 1, -1);
+            }
+            __atomic_store_n(&results_sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        // The queue hands the results back latest first
+        struct result* ordered = NULL;
+        int size = 0;
+        while(batch != NULL) {
+            struct result* next = batch->next;
+            batch->next = ordered;
+            ordered = batch;
+            batch = next;
+            size++;
+        }
+
+        results_apply(ordered);
+        results_free(ordered);
+
+        __atomic_add_fetch(&results_stats.results, size, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&results_stats.batches, 1, __ATOMIC_RELAXED);
+        if(size > __atomic_load_n(&results_stats.max_batch, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&results_stats.max_batch, size, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Start the aggregator thread
+ **/
+void results_start() {
+    __atomic_store_n(&results_stopping, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&results_running, 1, __ATOMIC_SEQ_CST);
+    if(pthread_create(&results_thread, NULL, results_loop, NULL) != 0) {
+        perror("Error creating the results aggregator");
+        exit(1);
+    }
+}
+
+/**
+ * Stop the aggregator thread. Every result already submitted is added to the leaderboard before this returns, and
+ * the results submitted afterwards are added straight away by whoever submits them.
+ **/
+void results_stop() {
+    // Once no thread is in the middle of queueing a result, nothing else will be queued
+    __atomic_store_n(&results_running, 0, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&results_submitting, __ATOMIC_SEQ_CST) > 0) {
+        sched_yield();
+    }
+
+    // The aggregator empties the queue before it sees it should stop
+    __atomic_store_n(&results_stopping, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&results_sleeping, 0, __ATOMIC_SEQ_CST);
+    ring_futex_wake(&results_sleeping, 1);
+    pthread_join(results_thread, NULL);
+}
+
+/**
+ * Queue the result of a game (one of RESULT_*) to be added to the leaderboard. Never blocks, the username is copied.
+ **/
+void results_submit(const char* username, int time_taken, int outcome) {
+    size_t length = strlen(username) + 1;
+    struct result* result = malloc(sizeof(struct result) + length);
+    if(!result) {
+        perror("Error adding the result to the leaderboard: out of memory");
+        exit(1);
+    }
+    result->time_taken = time_taken;
+    result->outcome = outcome;
+    result->ended = time(NULL);
+    memcpy(result->username, username, length);
+
+    __atomic_add_fetch(&results_submitting, 1, __ATOMIC_SEQ_CST);
+    int queued = __atomic_load_n(&results_running, __ATOMIC_SEQ_CST);
+    if(queued) {
+        // Push onto the queue, the aggregator takes the whole of it at once so nothing is ever popped from the middle
+        result->next = __atomic_load_n(&results_queue, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&results_queue, &result->next, result, 1,
+                                           __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+        if(__atomic_exchange_n(&results_sleeping, 0, __ATOMIC_SEQ_CST)) {
+            ring_futex_wake(&results_sleeping, 1);
+        }
+    }
+    __atomic_sub_fetch(&results_submitting, 1, __ATOMIC_SEQ_CST);
+
+    if(!queued) {
+        result->next = NULL;
+        results_apply(result);
+        results_free(result);
+        __atomic_add_fetch(&results_stats.overflows, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Get a copy of the counters
+ **/
+void results_stats_get(struct results_stats* stats) {
+    stats->results = __atomic_load_n(&results_stats.results, __ATOMIC_RELAXED);
+    stats->batches = __atomic_load_n(&results_stats.batches, __ATOMIC_RELAXED);
+    stats->overflows = __atomic_load_n(&results_stats.overflows, __ATOMIC_RELAXED);
+    stats->max_batch = __atomic_load_n(&results_stats.max_batch, __ATOMIC_RELAXED);
+}
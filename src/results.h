@@ -0,0 +1,57 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+/**
+ * The results stage adds the games that ended to the leaderboard on a thread of its own, so the threads driving
+ * the games never wait for the leaderboard.
+ *
+ * Whoever ends a game pushes a small record onto a lock-free queue and carries on straight away. A single
+ * aggregator thread takes every record queued so far in one go, logs them all to the history with a single sync
+ * and applies them while holding the leaderboard's lock once, so the busier the server gets, the more results
+ * each wake up applies.
+ **/
+
+// How a game ended, as it is submitted and logged. Times on different fields can't be compared, so only the games
+// won on the Beginner field are ranked. The others only count as games won.
+#define RESULT_LOST             0
+#define RESULT_WON              1       // Won on the field that is ranked
+#define RESULT_WON_UNRANKED     2       // Won on any other field
+
+/**
+ * Counters that show how the aggregator is keeping up
+ **/
+struct results_stats {
+    unsigned long results;      // How many results the aggregator added to the leaderboard
+    unsigned long batches;      // How many times the aggregator took results off the queue
+    unsigned long overflows;    // How many results were added by whoever ended the game as the stage was stopped
+    int max_batch;              // The most results applied at once
+};
+
+/**
+ * Start the aggregator thread
+ **/
+void results_start();
+
+/**
+ * Stop the aggregator thread. Every result already submitted is added to the leaderboard before this returns, and
+ * the results submitted afterwards are added straight away by whoever submits them.
+ **/
+void results_stop();
+
+/**
+ * Queue the result of a game (one of RESULT_*) to be added to the leaderboard. Never blocks, the username is copied.
+ **/
+void results_submit(const char* username, int time_taken, int outcome);
+
+/**
+ * Add the result of a game (one of RESULT_*) to the leaderboard and to the windows it ended in, straight away.
+ * Must be called with the leaderboard locked.
+ **/
+void results_record(char* username, int time_taken, int outcome, long ended);
+
+/**
+ * Get a copy of the counters
+ **/
+void results_stats_get(struct results_stats* stats);
+
+#endif // RESULTS_H
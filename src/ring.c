@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+// Futex
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ring.h"
+
+/**
+ * Sleep until the futex no longer holds expected, someone wakes it or the timeout runs out (never if timeout_ms
+ * is negative). Used by the ring and by anything else that needs to sleep until a counter changes.
+ **/
+void ring_futex_wait(unsigned int* futex, unsigned int expected, int timeout_ms) {
+    struct timespec timeout;
+    struct timespec* timeout_ptr = NULL;
+    if(timeout_ms >= 0) {
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+        timeout_ptr = &timeout;
+    }
+    syscall(SYS_futex, futex, FUTEX_WAIT_PRIVATE, expected, timeout_ptr, NULL, 0);
+}
+
+/**
+ * Wake up to num_threads threads sleeping on the futex
+ **/
+void ring_futex_wake(unsigned int* futex, int num_threads) {
+    syscall(SYS_futex, futex, FUTEX_WAKE_PRIVATE, num_threads, NULL, NULL, 0);
+}
+
+/**
+ * Prepare a ring that can hold at least capacity values. The capacity is rounded up to a power of 2.
+ **/
+void ring_init(struct ring* ring, int capacity) {
+    unsigned long size = 1;
+    while(size < (unsigned long)capacity) {
+        size *= 2;
+    }
+
+    ring->slots = malloc(size * sizeof(struct ring_slot));
+    if(!ring->slots) {
+        perror("Error creating the ring: out of memory");
+        exit(1);
+    }
+    // A slot can be written to once its sequence matches the position being written
+    for(unsigned long i = 0; i < size; i++) {
+        ring->slots[i].sequence = i;
+    }
+
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->futex = 0;
+    ring->waiters = 0;
+    ring->closed = 0;
+    ring->depth = 0;
+    ring->high_water = 0;
+}
+
+/**
+ * Deallocate the memory assigned to the ring
+ **/
+void ring_free(struct ring* ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+/**
+ * Add a value to the ring and wake up a thread waiting for it, if any. Never blocks.
+ *
+ * Returns the number of values in the ring after adding it, or 0 if the ring is full
+ **/
+int ring_push(struct ring* ring, long value) {
+    struct ring_slot* slot;
+    unsigned long pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+    // Claim the slot at the head
+    while(1) {
+        slot = &ring->slots[pos & ring->mask];
+        unsigned long sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)(sequence - pos);
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&ring->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if(diff < 0) {
+            // The slot still holds a value from the last time around the ring
+            return 0;
+        } else {
+            // Another thread claimed the slot first
+            pos = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Count the value before it can be removed so the depth never goes below 0
+    int depth = __atomic_add_fetch(&ring->depth, 1, __ATOMIC_RELAXED);
+    int high_water = __atomic_load_n(&ring->high_water, __ATOMIC_RELAXED);
+    while(depth > high_water &&
+          !__atomic_compare_exchange_n(&ring->high_water, &high_water, depth, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    // Hand the slot over to the threads removing values
+    slot->value = value;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    // Only make the syscall if someone is asleep
+    __atomic_add_fetch(&ring->futex, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&ring->waiters, __ATOMIC_SEQ_CST) > 0) {
+        ring_futex_wake(&ring->futex, 1);
+    }
+
+    return depth;
+}
+
+/**
+ * Remove the oldest value from the ring without waiting.
+ *
+ * Returns 1 if a value was removed
+ **/
+int ring_pop(struct ring* ring, long* value) {
+    struct ring_slot* slot;
+    unsigned long pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+    // Claim the slot at the tail
+    while(1) {
+        slot = &ring->slots[pos & ring->mask];
+        unsigned long sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)(sequence - (pos + 1));
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if(diff < 0) {
+            // Nothing has been written to the slot yet
+            return 0;
+        } else {
+            // Another thread claimed the slot first
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Hand the slot back to the threads adding values for the next time around the ring
+    *value = slot->value;
+    __atomic_store_n(&slot->sequence, pos + ring->mask + 1, __ATOMIC_RELEASE);
+
+    __atomic_sub_fetch(&ring->depth, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/**
+ * Remove the oldest value from the ring, sleeping until one is added if the ring is empty.
+ * Gives up after timeout_ms milliseconds (never if timeout_ms is negative) or once the ring is closed.
+ *
+ * Returns 1 if a value was removed
+ **/
+int ring_pop_wait(struct ring* ring, long* value, int timeout_ms) {
+    while(1) {
+        // Read the futex before checking the ring, so a value added in between makes the wait return straight away
+        unsigned int futex = __atomic_load_n(&ring->futex, __ATOMIC_SEQ_CST);
+        if(ring_pop(ring, value)) {
+            return 1;
+        }
+        if(__atomic_load_n(&ring->closed, __ATOMIC_SEQ_CST)) {
+            return 0;
+        }
+
+        __atomic_add_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+        // Check again now that the threads adding values know to wake us up
+        if(__atomic_load_n(&ring->futex, __ATOMIC_SEQ_CST) == futex) {
+            ring_futex_wait(&ring->futex, futex, timeout_ms);
+        }
+        __atomic_sub_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+
+        if(timeout_ms >= 0 && __atomic_load_n(&ring->futex, __ATOMIC_SEQ_CST) == futex) {
+            // Nothing was added before the timeout ran out
+            return ring_pop(ring, value);
+        }
+    }
+}
+
+/**
+ * Wake every thread waiting on the ring and make them give up. Values can still be removed with ring_pop.
+ **/
+void ring_close(struct ring* ring) {
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&ring->futex, 1, __ATOMIC_SEQ_CST);
+    ring_futex_wake(&ring->futex, __INT_MAX__);
+}
+
+/**
+ * Get how many values are in the ring
+ **/
+int ring_depth(struct ring* ring) {
+    return __atomic_load_n(&ring->depth, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the most values the ring has held at once
+ **/
+int ring_high_water(struct ring* ring) {
+    return __atomic_load_n(&ring->high_water, __ATOMIC_RELAXED);
+}
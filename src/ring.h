@@ -0,0 +1,98 @@
+#ifndef RING_H
+#define RING_H
+
+/**
+ * A bounded queue of values (eg. sockets) that many threads can add to and remove from at the same time
+ * without locks. Each slot has a sequence number that tells the threads whether the slot is ready to be
+ * written to or read from, so a thread only ever has to claim a position with a compare and swap.
+ *
+ * Adding never blocks: if the ring is full the value is refused and the caller decides what to do with it.
+ * Threads that want to wait for a value sleep on a futex that is only woken when someone is waiting.
+ **/
+
+#define RING_CACHE_LINE     64      // Keeps the counters written by different threads on separate cache lines
+
+/**
+ * A slot in the ring along with the sequence number that says who can use it next
+ **/
+struct ring_slot {
+    unsigned long sequence;
+    long value;
+};
+
+struct ring {
+    struct ring_slot* slots;
+    unsigned long mask;                                             // The capacity of the ring minus 1 (it is a power of 2)
+
+    unsigned long head __attribute__((aligned(RING_CACHE_LINE)));   // The next position a value is added at
+    unsigned long tail __attribute__((aligned(RING_CACHE_LINE)));   // The next position a value is removed from
+
+    // Sleeping on the ring
+    unsigned int futex __attribute__((aligned(RING_CACHE_LINE)));  // Changes every time a value is added or the ring is closed
+    int waiters;                                                    // How many threads are sleeping on the futex
+    int closed;                                                     // Set when the threads waiting on the ring should give up
+
+    // Counters that can be reported
+    int depth __attribute__((aligned(RING_CACHE_LINE)));            // How many values are in the ring
+    int high_water;                                                 // The most values the ring has held at once
+};
+
+/**
+ * Sleep until the futex no longer holds expected, someone wakes it or the timeout runs out (never if timeout_ms
+ * is negative). Used by the ring and by anything else that needs to sleep until a counter changes.
+ **/
+void ring_futex_wait(unsigned int* futex, unsigned int expected, int timeout_ms);
+
+/**
+ * Wake up to num_threads threads sleeping on the futex
+ **/
+void ring_futex_wake(unsigned int* futex, int num_threads);
+
+/**
+ * Prepare a ring that can hold at least capacity values. The capacity is rounded up to a power of 2.
+ **/
+void ring_init(struct ring* ring, int capacity);
+
+/**
+ * Deallocate the memory assigned to the ring
+ **/
+void ring_free(struct ring* ring);
+
+/**
+ * Add a value to the ring and wake up a thread waiting for it, if any. Never blocks.
+ *
+ * Returns the number of values in the ring after adding it, or 0 if the ring is full
+ **/
+int ring_push(struct ring* ring, long value);
+
+/**
+ * Remove the oldest value from the ring without waiting.
+ *
+ * Returns 1 if a value was removed
+ **/
+int ring_pop(struct ring* ring, long* value);
+
+/**
+ * Remove the oldest value from the ring, sleeping until one is added if the ring is empty.
+ * Gives up after timeout_ms milliseconds (never if timeout_ms is negative) or once the ring is closed.
+ *
+ * Returns 1 if a value was removed
+ **/
+int ring_pop_wait(struct ring* ring, long* value, int timeout_ms);
+
+/**
+ * Wake every thread waiting on the ring and make them give up. Values can still be removed with ring_pop.
+ **/
+void ring_close(struct ring* ring);
+
+/**
+ * Get how many values are in the ring
+ **/
+int ring_depth(struct ring* ring);
+
+/**
+ * Get the most values the ring has held at once
+ **/
+int ring_high_water(struct ring* ring);
+
+#endif // RING_H
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "screen.h"
+
+#define SCREEN_SEGMENTS_DEFAULT     64      // How many lines a screen can hold before it has to grow
+#define SCREEN_ARENA_DEFAULT        1024    // How many bytes of formatted lines a screen can hold before it has to grow
+#define SCREEN_HOLDS_DEFAULT        4       // How many shared buffers a screen can hold on to before it has to grow
+
+/**
+ * Grows a buffer so it can hold at least size elements of element_size bytes
+ **/
+void* screen_grow(void* buffer, int* cap, int size, size_t element_size, int cap_default) {
+    if(size <= *cap) {
+        return buffer;
+    }
+
+    int new_cap = *cap ? *cap : cap_default;
+    while(new_cap < size) {
+        new_cap *= 2;
+    }
+
+    buffer = realloc(buffer, new_cap * element_size);
+    if(!buffer) {
+        perror("Error drawing the screen: out of memory");
+        exit(1);
+    }
+    *cap = new_cap;
+    return buffer;
+}
+
+/**
+ * Adds a new segment to the end of the screen and returns it
+ **/
+struct screen_segment* screen_add_segment(struct screen* screen, char msg_code) {
+    if(screen->num_segments == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &screen->started);
+    }
+
+    screen->segments = screen_grow(screen->segments, &screen->segments_cap, screen->num_segments + 1,
+                                   sizeof(struct screen_segment), SCREEN_SEGMENTS_DEFAULT);
+
+    struct screen_segment* segment = &screen->segments[screen->num_segments++];
+    segment->msg_code = msg_code;
+    segment->text = NULL;
+    segment->offset = 0;
+    segment->size = 0;
+    return segment;
+}
+
+/**
+ * Add a constant line to the screen. The string is not copied, so it must outlive the screen (eg. a string literal).
+ **/
+void screen_puts(struct screen* screen, char msg_code, const char* text) {
+    struct screen_segment* segment = screen_add_segment(screen, msg_code);
+    segment->text = text;
+    segment->size = strlen(text);
+}
+
+/**
+ * Add a line of size bytes to the screen without copying it or measuring it. The string must end at size with a '\0'
+ * and outlive the frame, eg. by being held with screen_hold.
+ **/
+void screen_putn(struct screen* screen, char msg_code, const char* text, size_t size) {
+    struct screen_segment* segment = screen_add_segment(screen, msg_code);
+    segment->text = text;
+    segment->size = size;
+}
+
+/**
+ * Keep data alive until the frame has been sent, as lines on the screen refer to it. release is called with data
+ * when the screen is cleared or freed.
+ **/
+void screen_hold(struct screen* screen, void (*release)(void* data), void* data) {
+    screen->holds = screen_grow(screen->holds, &screen->holds_cap, screen->num_holds + 1,
+                                sizeof(struct screen_hold), SCREEN_HOLDS_DEFAULT);
+    screen->holds[screen->num_holds].release = release;
+    screen->holds[screen->num_holds].data = data;
+    screen->num_holds++;
+}
+
+/**
+ * Let go of everything the screen held
+ **/
+void screen_release(struct screen* screen) {
+    for(int i = 0; i < screen->num_holds; i++) {
+        screen->holds[i].release(screen->holds[i].data);
+    }
+    screen->num_holds = 0;
+}
+
+/**
+ * Add a formatted line to the screen. The line is written to the screen's arena.
+ **/
+void screen_printf(struct screen* screen, char msg_code, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    screen_vprintf(screen, msg_code, format, args);
+    va_end(args);
+}
+
+/**
+ * Same as screen_printf but takes a va_list
+ **/
+void screen_vprintf(struct screen* screen, char msg_code, const char* format, va_list args) {
+    struct screen_segment* segment = screen_add_segment(screen, msg_code);
+    segment->offset = screen->arena_len;
+
+    // Format the line straight into the arena, growing the arena if the line didn't fit
+    while(1) {
+        size_t space = screen->arena_cap - screen->arena_len;
+        va_list args_copy;
+        va_copy(args_copy, args);
+        int size = vsnprintf(screen->arena + screen->arena_len, space, format, args_copy);
+        va_end(args_copy);
+
+        if(size < 0) {
+            // Nothing could be formatted, leave the line empty
+            size = 0;
+        }
+        if((size_t)size < space) {
+            segment->size = size;
+            screen->arena[screen->arena_len + size] = '\0';
+            screen->arena_len += size + 1;
+            return;
+        }
+
+        int cap = screen->arena_cap;
+        screen->arena = screen_grow(screen->arena, &cap, screen->arena_len + size + 1, 1, SCREEN_ARENA_DEFAULT);
+        screen->arena_cap = cap;
+    }
+}
+
+/**
+ * Get the string of a line in the screen
+ **/
+const char* screen_segment_text(struct screen* screen, int index) {
+    struct screen_segment* segment = &screen->segments[index];
+    if(segment->text != NULL) {
+        return segment->text;
+    }
+    return screen->arena + segment->offset;
+}
+
+/**
+ * Make space for num_iov iovecs and num_headers frame headers in the screen's scratch buffers
+ **/
+void screen_reserve_scratch(struct screen* screen, int num_iov, int num_headers, int header_size) {
+    screen->iov = screen_grow(screen->iov, &screen->iov_cap, num_iov, sizeof(struct iovec), SCREEN_SEGMENTS_DEFAULT);
+
+    int headers_size = num_headers * header_size;
+    screen->headers = screen_grow(screen->headers, &screen->headers_cap, headers_size, 1, SCREEN_SEGMENTS_DEFAULT);
+}
+
+/**
+ * Remove every line from the screen and let go of what it held, keeping the memory for the next frame
+ **/
+void screen_clear(struct screen* screen) {
+    screen_release(screen);
+    screen->num_segments = 0;
+    screen->arena_len = 0;
+}
+
+/**
+ * Deallocate the memory assigned to the screen
+ **/
+void screen_free(struct screen* screen) {
+    screen_release(screen);
+    free(screen->segments);
+    free(screen->holds);
+    free(screen->arena);
+    free(screen->iov);
+    free(screen->headers);
+    memset(screen, 0, sizeof(struct screen));
+}
@@ -0,0 +1,107 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+
+#include <stddef.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/uio.h>
+
+/**
+ * A screen collects every line that will be shown to the client after it sends a message, so the whole
+ * frame can be sent at once rather than line by line.
+ *
+ * Lines that never change (banners, menus, etc.) are referenced where they are instead of being copied.
+ * Lines that live in shared memory that could be freed (eg. the rendered leaderboard) are referenced as well, as
+ * long as the screen holds on to that memory until the frame is cleared. Formatted lines are written to an arena
+ * owned by the screen. The memory of a screen is kept between
+ * frames, so drawing a frame doesn't allocate once the screen has grown to fit it.
+ **/
+
+/**
+ * A single line on the screen along with the message code it is sent with
+ **/
+struct screen_segment {
+    char msg_code;
+    const char* text;       // The constant string this line refers to, or NULL if the line is in the arena
+    size_t offset;          // Where the line starts in the arena
+    size_t size;            // The length of the line (not including the '\0')
+};
+
+/**
+ * Something a line on the screen refers to, which is let go once the frame has been sent
+ **/
+struct screen_hold {
+    void (*release)(void* data);
+    void* data;
+};
+
+struct screen {
+    struct screen_segment* segments;
+    int num_segments;
+    int segments_cap;
+
+    struct screen_hold* holds;
+    int num_holds;
+    int holds_cap;
+
+    char* arena;            // Holds the formatted lines, each ending with a '\0'
+    size_t arena_len;
+    size_t arena_cap;
+
+    // Reused by the session when turning the screen into frames
+    struct iovec* iov;
+    int iov_cap;
+    char* headers;
+    int headers_cap;
+
+    struct timespec started;    // When the first line of the current frame was added
+};
+
+/**
+ * Add a constant line to the screen. The string is not copied, so it must outlive the screen (eg. a string literal).
+ **/
+void screen_puts(struct screen* screen, char msg_code, const char* text);
+
+/**
+ * Add a line of size bytes to the screen without copying it or measuring it. The string must end at size with a '\0'
+ * and outlive the frame, eg. by being held with screen_hold.
+ **/
+void screen_putn(struct screen* screen, char msg_code, const char* text, size_t size);
+
+/**
+ * Keep data alive until the frame has been sent, as lines on the screen refer to it. release is called with data
+ * when the screen is cleared or freed.
+ **/
+void screen_hold(struct screen* screen, void (*release)(void* data), void* data);
+
+/**
+ * Add a formatted line to the screen. The line is written to the screen's arena.
+ **/
+void screen_printf(struct screen* screen, char msg_code, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+/**
+ * Same as screen_printf but takes a va_list
+ **/
+void screen_vprintf(struct screen* screen, char msg_code, const char* format, va_list args);
+
+/**
+ * Get the string of a line in the screen
+ **/
+const char* screen_segment_text(struct screen* screen, int index);
+
+/**
+ * Make space for num_iov iovecs and num_headers frame headers in the screen's scratch buffers
+ **/
+void screen_reserve_scratch(struct screen* screen, int num_iov, int num_headers, int header_size);
+
+/**
+ * Remove every line from the screen and let go of what it held, keeping the memory for the next frame
+ **/
+void screen_clear(struct screen* screen);
+
+/**
+ * Deallocate the memory assigned to the screen
+ **/
+void screen_free(struct screen* screen);
+
+#endif // SCREEN_H
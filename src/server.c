@@ -1,9 +1,10 @@
-#define _GNU_SOURCE // Required to use recursive mutex
+#define _GNU_SOURCE // Required to use SO_REUSEPORT
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <getopt.h>
 // Signals
 #include <signal.h>
 #include <errno.h>
@@ -14,57 +15,114 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+// Resource limits
+#include <sys/resource.h>
 
 #include "message.h"
 #include "minesweeper.h"
 #include "leaderboard.h"
+#include "session.h"
+#include "game.h"
+#include "reactor.h"
+#include "uring.h"
+#include "threadpool.h"
+#include "timer.h"
+#include "credentials.h"
+#include "auth.h"
+#include "results.h"
+#include "history.h"
+#include "window.h"
+#include "boards.h"
 
 #define PORT_DEFAULT            12345       // The port to listen to when no other option is given
-#define THREADPOOL_SIZE         10          // How many working threads will be handling clients at one time
+#define THREADPOOL_MIN_DEFAULT  2           // How many working threads the threadpool keeps even when idle
+#define THREADPOOL_MAX_DEFAULT  10          // How many working threads will be handling clients at one time
+#define THREADPOOL_IDLE_DEFAULT 30          // How many seconds a working thread can be idle before it stops
 #define CONNECTION_BACKLOG_MAX  200         // The maximum number of connections the server will support
-#define RNG_SEED_DEFAULT        42          // The seed used for the random number generator
+#define CLIENT_QUEUE_CAPACITY   1024        // How many clients can wait for a thread from the threadpool before new ones are turned away
+#define SESSION_LENGTH_GUESS    60000       // How many milliseconds a session is assumed to last until some have ended
+#define CLIENT_TOLD_TO_WAIT     (1 << 30)   // Added to a socket in the client queue when the client was told how long it will wait
+#define RNG_SEED_DEFAULT        42          // The seed used for the games' random number generators
+#define LOGIN_TIMEOUT_DEFAULT   60          // How many seconds a client has to answer each login prompt
+#define IDLE_TIMEOUT_DEFAULT    300         // How many seconds a logged in client has to make each move
+#define SESSION_TIMEOUT_DEFAULT 7200        // How many seconds a session can last
+#define CREDENTIALS_FILE        "Authentication.txt"    // The file holding the usernames and passwords of the players
+#define HISTORY_FILE_DEFAULT    "Leaderboard.log"       // The log of the results, the snapshot of the leaderboard is kept next to it
+
+// The ways the server can handle its clients. Selected at startup so the two can be compared under load.
+#define SERVER_MODE_POOL        0           // Each client is handled by a thread from the threadpool for its whole session
+#define SERVER_MODE_EPOLL       1           // Clients are handled by a few reactor threads driven by epoll events
+#define SERVER_MODE_URING       2           // Clients are handled by a few loop threads that batch their I/O with io_uring
 
 /* ================================================ GLOBAL VARIABLES ================================================ */
 
 // Determines if the server should be kept running
 int server_keep_alive = 1;           
 
+// Set when the server statistics should be printed
+int server_print_stats = 0;
+
+// How the clients are handled (see SERVER_MODE_*)
+int server_mode = SERVER_MODE_POOL;
+
 // Threadpool variables
-pthread_t threadpool[THREADPOOL_SIZE];      // Holds the individual threads that form the threadpool
-int client_queue_size = 0;                  // How many clients are waiting to connect
-struct request {
-    int request_sockfd;                     // The socket the client in the queue is connected to        
-    struct request* next;                   // Pointer to the next client in the queue
+struct threadpool threadpool;               // The threads handling the clients along with the clients waiting for them
+
+/**
+ * Limits on how many clients are let in, so the clients that are let in are served in a reasonable time
+ * rather than every client being served slowly. Clients that are over the limits are told when to come back.
+ **/
+struct admission {
+    int backlog;                            // How many connections the kernel holds until they are accepted
+    int queue_capacity;                     // How many clients can wait for a worker in pool mode
+    int max_wait;                           // Turn away clients that would wait longer than this many seconds in pool mode (0 for no limit)
+    int max_sessions;                       // How many sessions the reactor or io_uring threads can handle at once (0 for no limit)
+
+    unsigned long accepted;                 // How many clients were served straight away
+    unsigned long queued;                   // How many clients were told how long they would wait for a worker
+    unsigned long rejected;                 // How many clients were told to come back later
+} admission = {CONNECTION_BACKLOG_MAX, CLIENT_QUEUE_CAPACITY, 0, 0, 0, 0, 0};
+
+/**
+ * Session deadlines in pool mode. The workers arm the timers of their session and a timer thread expires them.
+ * The threadpool has a wheel of its own, or each shard has one with its timer thread on the shard's core, so the
+ * workers of different shards never take the same lock. A worker only goes to the wheel when its session starts,
+ * ends or moves between logging in and the other screens. Otherwise it just notes when its client was last
+ * active, and the idle timer is moved on from that once it runs out.
+ **/
+struct session_wheel {
+    struct timer_wheel wheel;
+    pthread_mutex_t mutex;
+    pthread_t thread;
+    int cpu;                                // The core the timer thread runs on, or -1 for any core
+    unsigned int stopping;                  // Set when the timer thread should stop. Also the futex it sleeps on
 };
-struct request* head_client_queue = NULL;   // HEAD of the linked list of the queue of clients
-struct request* tail_client_queue = NULL;   // TAIL of the linked list of the queue of clients
-
-// Threadpool mutex and conditions
-pthread_mutex_t client_queue_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
-pthread_cond_t client_queue_got_request = PTHREAD_COND_INITIALIZER;
-
-// File read mutex
-pthread_mutex_t file_read_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-// Mutex used to access the rand function when creating a game
-pthread_mutex_t rand_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-// Mutex used to access the leaderboard by solving the Reader-Writer problem
-pthread_mutex_t leaderboard_rmutex = PTHREAD_MUTEX_INITIALIZER;     // Mutex that controls readers
-pthread_mutex_t leaderboard_wmutex = PTHREAD_MUTEX_INITIALIZER;     // Mutex that controls writers
-pthread_mutex_t leaderboard_rcmutex = PTHREAD_MUTEX_INITIALIZER;    // Protects the rc variable
-pthread_mutex_t leaderboard_wcmutex = PTHREAD_MUTEX_INITIALIZER;    // Protects the wc variable
-int leaderboard_rc = 0; // The current number of readers of the leaderboard
-int leaderboard_wc = 0; // The current number of writers of the leaderboard
-
-// Contains the states that the game can be in when being played
-enum game_state {
-    MAIN_MENU,
-    PLAYING,
-    GAMEOVER,
-    HIGHSCORE,
-    EXIT
+struct session_wheel session_wheel;         // The wheel of the threadpool when there are no shards
+
+/**
+ * A session handled by a worker, along with the wheel its timers are on
+ **/
+struct pool_session {
+    struct session session;
+    struct session_wheel* wheel;
+};
+
+/**
+ * A shard has its own listening socket (opened with SO_REUSEPORT so the kernel spreads the connections across
+ * the shards), its own accept thread and its own workers, all pinned to the same core. Shards don't share any
+ * queues, so accepting clients scales with the number of cores.
+ **/
+struct shard {
+    pthread_t thread;
+    int index;
+    int sockfd;                             // The listening socket of this shard
+    struct threadpool pool;                 // The threads handling the clients accepted by this shard in pool mode
+    struct session_wheel wheel;             // The deadlines of the sessions handled by the shard's workers
+    unsigned long accepted;                 // How many clients this shard accepted
+    unsigned long turned_away;              // How many clients were turned away because the shard's queues were full
 };
+struct shard* shards = NULL;                // The shards, if the server was started with any
+int num_shards = 0;                         // 0 if the main thread accepts every client
 
 /* ================================================ HELPER FUNCTIONS ================================================ */
 /**
@@ -78,29 +136,35 @@ void error(char* message) {
 /**
  * Deallocate memory assigned to the queue which contains clients awaiting connections
  **/
-void client_queue_free() {
-    struct request* current;
-    while(head_client_queue != NULL) {
-        current = head_client_queue;
-        head_client_queue = head_client_queue->next;
-
-        // Tell all the clients in the queue to exit
-        send_message(current->request_sockfd, MSGC_EXIT, "Server is offline.\n");
-        close(current->request_sockfd);
-        current->next = NULL;
-        free(current);
+void client_queue_free(struct threadpool* pool) {
+    // Tell all the clients in the queue to exit
+    int client;
+    while(threadpool_pop_queued(pool, &client)) {
+        int client_sockfd = client & ~CLIENT_TOLD_TO_WAIT;
+        send_message(client_sockfd, MSGC_EXIT, "Server is offline.\n");
+        close(client_sockfd);
     }
 
-    // Make tail pointer NULL
-    tail_client_queue = NULL;
+    threadpool_free(pool);
 }
 
 /**
  * Deallocate all memory associated with the server
  **/
 void free_memory() {
-    client_queue_free();
+    if(server_mode == SERVER_MODE_POOL && num_shards == 0) {
+        client_queue_free(&threadpool);
+    }
+    for(int i = 0; i < num_shards; i++) {
+        if(server_mode == SERVER_MODE_POOL) {
+            client_queue_free(&shards[i].pool);
+        }
+    }
+    free(shards);
+    history_close();
+    window_free();
     leaderboard_free();
+    credentials_stop();
 }
 
 /**
@@ -111,700 +175,475 @@ void signal_handler(int signal_num) {
     if(signal_num == SIGINT) {
         server_keep_alive = 0;
     }
-}
-
-/**
- * Called when a thread that is handling a client has to exit prematurely. Will tell the client to exit
- * while also closing the socket
- **/
-void thread_cleanup(void *arg) {
-    // Send a message to the client to close
-    send_message(*(int *)arg, MSGC_EXIT, "\n");
-    // Close the socket connected to the client
-    close(*(int *)arg);
-}
-
-/* ======================================== LEADERBOARD READER-WRITER MUTEX ========================================= */
-/**
- * Called by the reader when entering the critical section.
- * Will attempt to get access to the leaderboard.
- **/
-void leaderboard_read_lock() {
-    pthread_mutex_lock(&leaderboard_rmutex);    // Indicate reader wants to enter the critical section
-    pthread_mutex_lock(&leaderboard_rcmutex);
-
-    leaderboard_rc++;
-    // If first reader, lock the leaderboard from being written to
-    if(leaderboard_rc == 1) {
-        pthread_mutex_lock(&leaderboard_wmutex);    
+    // Print the server statistics without stopping the server
+    if(signal_num == SIGUSR1) {
+        server_print_stats = 1;
     }
-
-    pthread_mutex_unlock(&leaderboard_rcmutex);
-    pthread_mutex_unlock(&leaderboard_rmutex);
 }
 
 /**
- * Called by the reader when exiting the critical section.
- * Will signal that other threads can access the leaderboard.
+ * Prints how much it costs the server to send the screens drawn for the clients
  **/
-void leaderboard_read_unlock() {
-    pthread_mutex_lock(&leaderboard_rcmutex);   // Reserve rc to avoid race conditions
+void print_stats() {
+    struct session_stats stats;
+    session_stats_get(&stats);
+
+    unsigned long frames = stats.frames ? stats.frames : 1;
+    printf("Screens sent: %lu. Lines: %lu. Bytes: %lu. Send syscalls: %lu.\n",
+           stats.frames, stats.segments, stats.bytes, stats.syscalls);
+    printf("Per screen: %.2f syscalls, %.1f bytes, %.2f us to build and send.\n",
+           (double)stats.syscalls / frames, (double)stats.bytes / frames, (double)stats.frame_ns / frames / 1000.0);
+    printf("Sessions timed out: %lu.\n", stats.timeouts);
+    struct credentials_stats credentials;
+    credentials_stats_get(&credentials);
+    printf("Credentials: %d users, reloaded %lu times, %lu logins checked.\n",
+           credentials.users, credentials.reloads, credentials.lookups);
+    struct auth_stats auth;
+    auth_stats_get(&auth);
+    unsigned long batches = auth.batches ? auth.batches : 1;
+    unsigned long checked = auth.requests ? auth.requests : 1;
+    printf("Authentication: %lu logins in %lu batches (%.2f per batch), %lu checked inline. High water: %d.\n",
+           auth.requests, auth.batches, (double)auth.requests / batches, auth.overflows, auth.queued_high_water);
+    printf("Login wait: %.2f ms on average, %.2f ms at most.\n",
+           (double)auth.wait_us / checked / 1000.0, (double)auth.max_wait_us / 1000.0);
+    struct history_stats history;
+    history_stats_get(&history);
+    printf("History: %lu results logged in %lu syncs, %lu snapshots written.\n",
+           history.records, history.syncs, history.snapshots);
+    struct results_stats results;
+    results_stats_get(&results);
+    unsigned long result_batches = results.batches ? results.batches : 1;
+    printf("Results: %lu games in %lu batches (%.2f per batch, %d at most), %lu added inline.\n",
+           results.results, results.batches, (double)results.results / result_batches, results.max_batch,
+           results.overflows);
+    struct boards_stats boards;
+    boards_stats_get(&boards);
+    printf("Boards: %lu made ahead (%lu wake ups), %lu games started from the pool, %lu made their own.\n",
+           boards.generated, boards.wakeups, boards.taken, boards.misses);
+    printf("Admission: %lu served straight away, %lu queued, %lu turned away. Sessions last %.1f s on average.\n",
+           __atomic_load_n(&admission.accepted, __ATOMIC_RELAXED), __atomic_load_n(&admission.queued, __ATOMIC_RELAXED),
+           __atomic_load_n(&admission.rejected, __ATOMIC_RELAXED),
+           (double)(stats.sessions ? stats.session_ms / stats.sessions : 0) / 1000.0);
+
+    if(server_mode == SERVER_MODE_POOL) {
+        // Add up the threadpools of every shard
+        struct threadpool_stats pool_stats;
+        threadpool_stats_get(&threadpool, &pool_stats);
+        for(int i = 0; i < num_shards; i++) {
+            struct threadpool_stats shard_stats;
+            threadpool_stats_get(&shards[i].pool, &shard_stats);
+            pool_stats.num_threads += shard_stats.num_threads;
+            pool_stats.peak_threads += shard_stats.peak_threads;
+            pool_stats.started += shard_stats.started;
+            pool_stats.stopped += shard_stats.stopped;
+            pool_stats.queued += shard_stats.queued;
+            pool_stats.queued_high_water += shard_stats.queued_high_water;
+            pool_stats.clients += shard_stats.clients;
+            pool_stats.steals += shard_stats.steals;
+            pool_stats.wait_us += shard_stats.wait_us;
+            if(shard_stats.max_wait_us > pool_stats.max_wait_us) {
+                pool_stats.max_wait_us = shard_stats.max_wait_us;
+            }
+        }
 
-    leaderboard_rc--;
-    // If last reader, allow the leaderboard to be written to
-    if(leaderboard_rc == 0) {
-        pthread_mutex_unlock(&leaderboard_wmutex);
+        struct threadpool* limits = (num_shards > 0) ? &shards[0].pool : &threadpool;
+        unsigned long clients = pool_stats.clients ? pool_stats.clients : 1;
+        printf("Threadpool: %d threads (%d to %d each, peak %d). Threads started: %lu. Stopped when idle: %lu.\n",
+               pool_stats.num_threads, limits->min_threads, limits->max_threads, pool_stats.peak_threads,
+               pool_stats.started, pool_stats.stopped);
+        printf("Client queue: %d waiting. High water: %d. Clients: %lu. Stolen: %lu.\n",
+               pool_stats.queued, pool_stats.queued_high_water, pool_stats.clients, pool_stats.steals);
+        printf("Queue wait: %.2f ms on average, %.2f ms at most.\n",
+               (double)pool_stats.wait_us / clients / 1000.0, (double)pool_stats.max_wait_us / 1000.0);
+    }
+
+    if(server_mode == SERVER_MODE_URING) {
+        struct uring_stats uring_stats;
+        uring_stats_get(&uring_stats);
+        unsigned long enters = uring_stats.enters ? uring_stats.enters : 1;
+        printf("io_uring: %lu enters. Requests submitted: %lu (%lu sends). Completions: %lu (%lu receives).\n",
+               uring_stats.enters, uring_stats.submitted, uring_stats.sends, uring_stats.completions,
+               uring_stats.receives);
+        printf("Per enter: %.2f requests submitted, %.2f completions.\n",
+               (double)uring_stats.submitted / enters, (double)uring_stats.completions / enters);
+    }
+
+    for(int i = 0; i < num_shards; i++) {
+        printf("Shard %d: %lu clients accepted, %lu turned away.\n", i,
+               __atomic_load_n(&shards[i].accepted, __ATOMIC_RELAXED),
+               __atomic_load_n(&shards[i].turned_away, __ATOMIC_RELAXED));
     }
-
-    pthread_mutex_unlock(&leaderboard_rcmutex);
 }
 
 /**
- * Called by the writer when entering the critical section.
- * Will attempt to gain access to the leaderboard. In this implementation, writer's have preference to the leaderboard
+ * Called when a thread that is handling a client has to exit prematurely. Will tell the client to exit
+ * while also closing the socket
  **/
-void leaderboard_write_lock() {
-    pthread_mutex_lock(&leaderboard_wcmutex);   // Reserve wc to avoid race conditions
-    
-    leaderboard_wc++;
-    // If first writer, lock the readers from accessing the leaderboard
-    if(leaderboard_wc == 1) {
-        pthread_mutex_lock(&leaderboard_rmutex);
-    }
-
-    pthread_mutex_unlock(&leaderboard_wcmutex);
-    pthread_mutex_lock(&leaderboard_wmutex);    // Reserve permission to access the leaderboard
+void thread_cleanup(void *arg) {
+    struct pool_session* pool_session = arg;
+    struct session* session = &pool_session->session;
+    // The session is going away, so its timers can't be left on the wheel
+    pthread_mutex_lock(&pool_session->wheel->mutex);
+    session_timers_stop(session, &pool_session->wheel->wheel);
+    pthread_mutex_unlock(&pool_session->wheel->mutex);
+    // Send a message to the client to close. The server is stopping and waits for this thread, so the client's
+    // acknowledgement isn't waited for.
+    shutdown(session->sockfd, SHUT_RD);
+    send_message(session->sockfd, MSGC_EXIT, "\n");
+    // Close the socket connected to the client
+    close(session->sockfd);
 }
 
+/* ================================================ ADMISSION CONTROL =============================================== */
 /**
- * Called by the writer when exiting the critical section.
- * Will signal that other threads can access the leaderboard.
- **/
-void leaderboard_write_unlock() {
-    pthread_mutex_unlock(&leaderboard_wmutex);  // Allow others to access the leaderboard if they need to
-    
-    pthread_mutex_lock(&leaderboard_wcmutex);
-    leaderboard_wc--;
-    // If last writer, allow readers to access the leaderboard
-    if(leaderboard_wc == 0) {
-        pthread_mutex_unlock(&leaderboard_rmutex);
-    }
-    pthread_mutex_unlock(&leaderboard_wcmutex);
+*   Get how long the sessions have lasted on average, in milliseconds
+**/
+long admission_session_length() {
+    struct session_stats stats;
+    session_stats_get(&stats);
+    return (stats.sessions > 0) ? (long)(stats.session_ms / stats.sessions) : SESSION_LENGTH_GUESS;
 }
 
-/* ================================================== CLIENT QUEUE ================================================== */
 /**
-*   Add the client that is attempting to connect to the queue.
-*   This is done by adding the socket the client is communicating from to a LinkedList. 
-*   The Linked List was chosen over a Queue data structure as it allows a dynamic number
-*   of clients to connect. 
-*   
-*   Returns the length of the queue
-*/
-int client_queue_add(int client_sockfd) {
-    struct request* client_request; // Pointer to the new client connect request
-    
-    // Create the client request structure
-    client_request = (struct request*)malloc(sizeof(struct request));
-    if(!client_request) {
-        error("Error adding client to queue: out of memory");
-    }
-    client_request->request_sockfd = client_sockfd;
-    client_request->next = NULL;
-
-    // Lock the mutex for the queue
-    pthread_mutex_lock(&client_queue_mutex);
-
-    // Add the new client connection request to the end of the Linked List
-    if(client_queue_size == 0) {
-        head_client_queue = client_request;
-        tail_client_queue = client_request;
-    }else {
-        tail_client_queue->next = client_request;
-        tail_client_queue = client_request;
-    }
-    int size = ++client_queue_size;
-
-    // Unlock the mutex for the queue
-    pthread_mutex_unlock(&client_queue_mutex);
-
-    // Signal the condition variable that the queue has a new request
-    pthread_cond_signal(&client_queue_got_request);
-
-    return size;
+*   Estimate how many seconds it takes num_sessions sessions to end when num_threads are handling them
+**/
+int admission_estimate_wait(int num_sessions, int num_threads) {
+    long wait_ms = admission_session_length() * num_sessions / ((num_threads > 0) ? num_threads : 1);
+    return (wait_ms + 999) / 1000;
 }
 
 /**
-*   Remove and get the client at the head of the queue. 
-*    
-*   Return: an int representing the socket number in which the client is communicating to
+*   Tell the client the server is busy and when to try again, then disconnect it. Never waits on the client.
 **/
-int client_queue_pop() {
-    struct request* client_request; // Pointer to the new client connect request
-   
-    // Lock the mutex for the queue
-    pthread_mutex_lock(&client_queue_mutex);
-
-    // Attempt to get the head of the client queue
-    if(client_queue_size > 0) {
-        client_request = head_client_queue;
-        head_client_queue = client_request->next;
-        // If the queue is now empty
-        if(head_client_queue == NULL) {
-            tail_client_queue = NULL;
-        }
-        // Decrease the total number of clients in the queue
-        client_queue_size--;
-    }else {
-        // If the client queue is empty
-        client_request = NULL;
-    }
-
-    // Unlock the mutex for the queue
-    pthread_mutex_unlock(&client_queue_mutex);
-
-    // Get the sockfd from the client and free the memory allocated to the structure
-    int client_sockfd = client_request->request_sockfd;
-    free(client_request);
-
-    // Return the socket the client is communicating at
-    if(client_request == NULL) {
-        return -1;
-    }
-    return client_sockfd;
+void admission_reject(int client_sockfd, int retry_seconds) {
+    // Don't wait on the client, it will see the message once it reads from the socket
+    if(retry_seconds < 1) {
+        retry_seconds = 1;
+    }
+    char message[MESSAGE_MAX_SIZE];
+    int message_size = snprintf(message, sizeof(message), "%cServer is busy. Try again in %d second%s.\n", MSGC_EXIT,
+                                retry_seconds, (retry_seconds == 1) ? "" : "s");
+    send(client_sockfd, message, message_size + 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(client_sockfd);
+    __atomic_add_fetch(&admission.rejected, 1, __ATOMIC_RELAXED);
 }
 
-/* ================================================== CLIENT LOGIN ================================================== */
 /**
- * Checks the Authentication text file to see if there is any username-password pair that
- * matches the one passed to this function
- * 
- * Returns a 1 if there is a match
- **/
-int client_login_verification(char* username, char* password) {
-    int successful = 0;
-    // Remove the newline character from the username and password if necessary
-    if((strlen(username)-1 > 0) && (username[strlen(username)-1] == '\n')) {
-        username[strlen(username)-1] = '\0';
-    }
-    if((strlen(password)-1 > 0) && (password[strlen(password)-1] == '\n')) {
-        password[strlen(password)-1] = '\0';
-    }
-    
-    // Temporary variables that will hold the username and password of each line in the file
-    char user[MESSAGE_MAX_SIZE];
-    char pass[MESSAGE_MAX_SIZE];
-
-    // Lock mutex in order to access the authentication file
-    pthread_mutex_lock(&file_read_mutex);
-
-    // Open the authentication file to check for usernames and passwords
-    FILE *fp=fopen("Authentication.txt", "r");
-
-    // Get rid of the header in the text file
-    fscanf(fp, "%s%s", user, pass); 
-    // Iterate through the authentication file
-    while(fscanf(fp, "%s%s", user, pass) != EOF) {
-        // Check if the username and password given match any on the file
-        if(strcmp(username, user) == 0) {
-            if(strcmp(password, pass) == 0) {
-                // Username and password matched
-                successful = 1;
-            }
+*   Let a client in if the reactor or io_uring threads aren't already handling as many sessions as allowed,
+*   otherwise turn it away.
+*
+*   Returns 1 if the client was let in
+**/
+int admission_check_sessions(int client_sockfd) {
+    if(admission.max_sessions > 0) {
+        int num_sessions = (server_mode == SERVER_MODE_URING) ? uring_num_sessions() : reactor_num_sessions();
+        if(num_sessions >= admission.max_sessions) {
+            // One of the sessions has to end before there is room
+            admission_reject(client_sockfd, admission_estimate_wait(1, num_sessions));
+            return 0;
         }
     }
 
-    // Unlock the mutex to the file so other threads can access it 
-    pthread_mutex_unlock(&file_read_mutex);
-
-    // Username and password did not match
-    return successful;
+    __atomic_add_fetch(&admission.accepted, 1, __ATOMIC_RELAXED);
+    return 1;
 }
 
+/* ================================================== CLIENT QUEUE ================================================== */
 /**
- * Displays the welcome screen and prompts the user to type their username or password
- * 
- * Returns a 1 if login was successful
- **/
-int client_login(int sockfd, char* username) {
-    // Display the welcome banner
-    send_message(sockfd, MSGC_PRINT, "===========================================================\n");
-    send_message(sockfd, MSGC_PRINT, "=     Welcome to the online Minesweeper gaming system     =\n");
-    send_message(sockfd, MSGC_PRINT, "===========================================================\n");
-    send_message(sockfd, MSGC_PRINT, "\n");
-
-    // Get the username from the user
-    send_message(sockfd, MSGC_INPUT, "Username: ");
-    int usr_size = receive_message(sockfd, username, MESSAGE_MAX_SIZE);
-
-    // Get the password from the user
-    char password[MESSAGE_MAX_SIZE];
-    send_message(sockfd, MSGC_INPUT, "Password: ");
-    int pass_size = receive_message(sockfd, password, sizeof(password));
-
-    if(usr_size == -1 || pass_size == -1) {
+*   Add the client that is attempting to connect to the queue of the threadpool.
+*   Adding a client never waits on the threads of the threadpool and nothing is allocated for each client.
+*   A client that has to wait for a worker is told how long it should take. If the queues are full or the wait
+*   would be too long, the client is told when to try again.
+*   
+*   Returns the length of the queue, or 0 if the client was turned away
+*/
+int client_queue_add(struct threadpool* pool, int client_sockfd) {
+    int position = threadpool_wait_position(pool);
+    int wait_seconds = (position > 0) ? admission_estimate_wait(position, pool->max_threads) : 0;
+    if(admission.max_wait > 0 && wait_seconds > admission.max_wait) {
+        // Come back once the wait has dropped below the limit
+        admission_reject(client_sockfd, wait_seconds - admission.max_wait);
         return 0;
     }
 
-    // Verify if the username and password matches any on the file. Return 1 if it does.
-    return client_login_verification(username+1, password+1);
-}
-
-/* =========================================== MINESWEEPER GAME FUNCTIONS =========================================== */
-/**
- * Iterates through a single row in the Minesweeper field and proceeds to join all of the information
- * of each tile in that row to a single string.
- * This string is then sent to the client as a message
- **/
-void send_minesweeper_row(int y, char row_letter, MinesweeperState *sweeper_state, int sockfd) {
-    // Make sure the y value passed isn't larger than the field bounds
-    if(y >= FIELD_HEIGHT) {
-        return;
-    }
-
-    // Iterate through each tile in the row and add the sprites to the sprite string
-    char sprite_string[FIELD_WIDTH]; 
-    for(int x = 0; x < FIELD_WIDTH; x++) {
-        // Choose the appropriate character to display depending on the current state of the tile
-        char sprite = ' ';
-        if(sweeper_state->field[x][y].revealed) {
-            if(sweeper_state->field[x][y].has_mine && !sweeper_state->field[x][y].has_flag) {
-                sprite = MINE_SPRITE;
-            } else if(sweeper_state->field[x][y].has_flag) {
-                sprite = FLAG_SPRITE;
-            } else {
-                sprite = sweeper_state->field[x][y].adjacent_mines + '0';
-            }
-        }
-
-        // Add the tile to the sprite string
-        sprite_string[x] = sprite;
-    }
-
-    // Add a space between the tile sprites so it looks better when printed to a terminal
-    char sprite_string_spaces[(FIELD_WIDTH * 2)+1];
-    int x = 0;
-    for(int i = 0; i < FIELD_WIDTH * 2; i++) {
-        // If the number is odd we want a space, otherwise add a tile sprite
-        if(i & 1) {
-            sprite_string_spaces[i] = ' ';
-        } else { 
-            sprite_string_spaces[i] = sprite_string[x++];    
-        }
+    // The worker has to know the client was sent a message, as the client's reply to it chooses the protocol
+    int size = threadpool_add(pool, client_sockfd | ((position > 0) ? CLIENT_TOLD_TO_WAIT : 0));
+    if(size == 0) {
+        admission_reject(client_sockfd, wait_seconds);
+        return 0;
     }
-    sprite_string_spaces[FIELD_WIDTH * 2] = '\0';
 
-    // This is the string that represents a row in the field that will then be sent to the client
-    char row_string[MESSAGE_MAX_SIZE];
-    // Add the sprites to the column labels 
-    snprintf(row_string, sizeof(row_string), "%c | %s\n", row_letter, sprite_string_spaces);
-    send_message(sockfd, MSGC_PRINT, row_string);
-}
-
-/**
- * Sends a series of strings to the client containing each row of the Minesweeper field. 
- **/
-void draw_minesweeper_field(MinesweeperState *sweeper_state, int sockfd) {
-    send_message(sockfd, MSGC_PRINT, "    1 2 3 4 5 6 7 8 9\n");
-    send_message(sockfd, MSGC_PRINT, "---------------------\n");
-
-    // Draw the tiles that are revealed
-    send_minesweeper_row(0, 'A', sweeper_state, sockfd);
-    send_minesweeper_row(1, 'B', sweeper_state, sockfd);
-    send_minesweeper_row(2, 'C', sweeper_state, sockfd);
-    send_minesweeper_row(3, 'D', sweeper_state, sockfd);
-    send_minesweeper_row(4, 'E', sweeper_state, sockfd);
-    send_minesweeper_row(5, 'F', sweeper_state, sockfd);
-    send_minesweeper_row(6, 'G', sweeper_state, sockfd);
-    send_minesweeper_row(7, 'H', sweeper_state, sockfd);
-    send_minesweeper_row(8, 'I', sweeper_state, sockfd);
-}
-
-/**
- * End the current Minesweeper game. Modify the leaderboard to include the user's game progress
- **/
-void minesweeper_game_end(MinesweeperState *sweeper_state, enum game_state *state, int game_won) {
-    sweeper_state->game_won = game_won;
-    sweeper_state->game_time_taken = time(NULL) - sweeper_state->game_start_time;
-    *state = GAMEOVER;
-
-    // Writer critical condition enter
-    leaderboard_write_lock();
-
-    // Add the score for the won game to the leaderboard
-    if(game_won) {
-        leaderboard_add_score(sweeper_state->username, (int)sweeper_state->game_time_taken);
+    if(position > 0) {
+        char message[MESSAGE_MAX_SIZE];
+        int message_size = snprintf(message, sizeof(message),
+                                    "%cEvery table is taken. You are number %d in line, it should take about %d second%s.\n",
+                                    MSGC_PRINT, position, wait_seconds, (wait_seconds == 1) ? "" : "s");
+        send(client_sockfd, message, message_size + 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        __atomic_add_fetch(&admission.queued, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&admission.accepted, 1, __ATOMIC_RELAXED);
     }
 
-    // Modify this user's leaderboard data to increase number of games played
-    leaderboard_update_user_games(sweeper_state->username, game_won);
-
-    // Writer critical condition exit
-    leaderboard_write_unlock();
+    return size;
 }
 
+/* ================================================= SESSION TIMERS ================================================= */
 /**
- * Prompts the user for a coordinate. The given location in the Minesweeper field will then be revealed. If the revealed 
- * tile contained a mine, the game will be lost.
- **/
-void tile_reveal_prompt(MinesweeperState *sweeper_state, enum game_state *state, int sockfd) {
-    send_message(sockfd, MSGC_INPUT, "Enter tile coordinate: ");
-    char buffer[MESSAGE_MAX_SIZE];
-    int size = receive_message(sockfd, buffer, sizeof(buffer));
-
-    // Check that only two characters where sent (MSGC + A1 + \0 = 4)
-    if(size != 4) {
-        send_message(sockfd, MSGC_PRINT, "A coordinate is only two characters. Example: A1 or 1A, B5 or 5B.\n");
-        return;
-    }
-    char coord[2] = {buffer[1], buffer[2]};
-
-    int x, y;
-    // Check if the coordinate matches to a valid number
-    if(!convert_coordinate(coord, &x, &y)) {
-        send_message(sockfd, MSGC_PRINT, "Coordinate does not exist.\n");
+*   Called by the timer thread when a timer of a client handled by a worker ran out. If the client was active
+*   since its idle timer was armed, the timer is moved on. Otherwise the client took too long: shutting the socket
+*   down makes the worker's receive fail, so the worker ends the session and moves on to the next client.
+**/
+void pool_session_timeout(struct timer* timer, void* arg) {
+    struct session_wheel* wheel = arg;
+    struct session* session = timer->data;
+    if(timer == &session->idle_timer && session_timers_extend(session, &wheel->wheel)) {
         return;
     }
-
-    // Check if the tile has already been revealed
-    if(sweeper_state->field[x][y].revealed) {
-        send_message(sockfd, MSGC_PRINT, "This tile has already been revealed");
-    } else {
-        reveal_tile(x, y, sweeper_state);
-        // Check if the tile revealed was a mine 
-        if(sweeper_state->field[x][y].has_mine) {
-            minesweeper_game_end(sweeper_state, state, 0);
-        }
-    }
+    session_timed_out(session);
+    shutdown(session->sockfd, SHUT_RDWR);
 }
 
 /**
- * Prompts the user for a coordinate. Will then match that coordinate to a location in the Minesweeper field
- * and attempt to place a flag at that location. 
- * Flags will only be placed if there's a mine at that location. The user will be notified if the attempt was 
- * successful. 
- **/
-void tile_flag_prompt(MinesweeperState *sweeper_state, int sockfd) {
-    send_message(sockfd, MSGC_INPUT, "Enter tile coordinate: ");
-    char buffer[MESSAGE_MAX_SIZE];
-    int size = receive_message(sockfd, buffer, sizeof(buffer));
-
-    // Check that only two characters where sent (MSGC + A1 + \0 = 4)
-    if(size != 4) {
-        send_message(sockfd, MSGC_PRINT, "A coordinate is only two characters. Example: A1 or 1A, B5 or 5B.\n");
-        return;
-    }
-    char coord[2] = {buffer[1], buffer[2]};
+*   The main function of a timer thread. Advances its wheel every tick until the server stops.
+**/
+void* session_wheel_loop(void* arg) {
+    struct session_wheel* wheel = arg;
+    while(!__atomic_load_n(&wheel->stopping, __ATOMIC_SEQ_CST)) {
+        ring_futex_wait(&wheel->stopping, 0, SESSION_TIMER_TICK_MS);
 
-    int x, y;
-    // Check if the coordinate matches to a valid number
-    if(!convert_coordinate(coord, &x, &y)) {
-        send_message(sockfd, MSGC_PRINT, "Coordinate does not exist.\n");
-        return;
+        pthread_mutex_lock(&wheel->mutex);
+        timer_wheel_advance(&wheel->wheel, wheel);
+        pthread_mutex_unlock(&wheel->mutex);
     }
 
-    // Place a flag at the location
-    if(!flag_tile(x, y, sweeper_state)) {
-        send_message(sockfd, MSGC_PRINT, "There is no mine at this location.\n");
-    }
+    return NULL;
 }
 
-/* ================================================= PLAYING SCREEN ================================================= */
 /**
- * Draws the screen that is shown to the user while the Minesweeper game is being played
- **/
-void draw_playing_screen(MinesweeperState *sweeper_state, int sockfd) {
-    send_message(sockfd, MSGC_PRINT, "------- Minesweeper -------\n");
-    send_message(sockfd, MSGC_PRINT, "\n");
-
-    // Send string calculating number of mines
-    char mine_string[MESSAGE_MAX_SIZE];
-    snprintf(mine_string, sizeof(mine_string), "Mines remaining: %d\n", sweeper_state->mines_remaining);
-    send_message(sockfd, MSGC_PRINT, mine_string);
-    send_message(sockfd, MSGC_PRINT, "\n");
-
-    draw_minesweeper_field(sweeper_state, sockfd);
-
-    send_message(sockfd, MSGC_PRINT, "\n");
-    send_message(sockfd, MSGC_PRINT, "Choose an option: \n");
-    send_message(sockfd, MSGC_PRINT, "(R)eveal tile\n");
-    send_message(sockfd, MSGC_PRINT, "(P)lace flag\n");
-    send_message(sockfd, MSGC_PRINT, "(Q)uit game\n");
-    send_message(sockfd, MSGC_PRINT, "\n");
-    send_message(sockfd, MSGC_INPUT, "Option (R,P,Q): ");
+*   Start the timer thread that expires the deadlines of the sessions handled by a pool's workers. If cpu isn't -1,
+*   the thread only runs on that core.
+**/
+void session_wheel_start(struct session_wheel* wheel, int cpu) {
+    timer_wheel_init(&wheel->wheel, SESSION_TIMER_TICK_MS);
+    pthread_mutex_init(&wheel->mutex, NULL);
+    wheel->cpu = cpu;
+    wheel->stopping = 0;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if(cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    if(pthread_create(&wheel->thread, &attr, session_wheel_loop, wheel) != 0) {
+        error("Error creating the timer thread");
+    }
+    pthread_attr_destroy(&attr);
 }
 
 /**
- * Receives input from the user in order to play the Minesweeper game. 
- * The main game loop.
- **/
-void update_playing_screen(int sockfd, enum game_state *state, MinesweeperState *sweeper_state, char *buffer) {
-    char input = buffer[1];
-
-    switch(input) {
-        case 'r':
-        case 'R':
-            tile_reveal_prompt(sweeper_state, state, sockfd);
-            break;
-        case 'p':
-        case 'P':
-            tile_flag_prompt(sweeper_state, sockfd);
-            break;
-        case 'q':
-        case 'Q':
-            minesweeper_game_end(sweeper_state, state, 0);
-            *state = MAIN_MENU;
-            break;
-        default:
-            send_message(sockfd, MSGC_PRINT, "Not a valid input! Choose a letter from (R, P, Q)\n");
-            break;
-    }
-
-    // Check if the game was won 
-    if(sweeper_state->mines_remaining == 0) {
-        minesweeper_game_end(sweeper_state, state, 1);
-    }
+*   Stop the timer thread of a wheel
+**/
+void session_wheel_stop(struct session_wheel* wheel) {
+    __atomic_store_n(&wheel->stopping, 1, __ATOMIC_SEQ_CST);
+    ring_futex_wake(&wheel->stopping, 1);
+    pthread_join(wheel->thread, NULL);
+    pthread_mutex_destroy(&wheel->mutex);
 }
 
-/* =================================================== MAIN MENU ==================================================== */
+/* ======================================= THREADPOOL THREADS MAIN FUNCTION ========================================= */
 /**
- * Draws a screen that shows the user the viable options to select from the Main Menu 
- **/
-void draw_main_menu(int sockfd) {
-    send_message(sockfd, MSGC_PRINT, "Welcome to the Minesweeper gaming system.\n");
-    send_message(sockfd, MSGC_PRINT, "\n");
-    send_message(sockfd, MSGC_PRINT, "Please enter a selection:\n");
-    send_message(sockfd, MSGC_PRINT, "<1> Play Minesweeper\n");
-    send_message(sockfd, MSGC_PRINT, "<2> Show Leaderboard\n");
-    send_message(sockfd, MSGC_PRINT, "<3> Quit\n");
-    send_message(sockfd, MSGC_INPUT, "Selection Option (1-3): ");
-}
+*   Called by a thread from the thread pool for each client it takes from the queue.
+*   It will start playing the game with the client until the client closes its connection.
+**/
+void handle_client(int client, void* arg) {
+    int client_sockfd = client & ~CLIENT_TOLD_TO_WAIT;
+    struct session_wheel* wheel = arg;
+
+    // Holds everything about the client's session such as their username and game
+    struct pool_session pool_session;
+    struct session* session = &pool_session.session;
+    pool_session.wheel = wheel;
+    session_init(session, client_sockfd, 0);
+
+    // Cleanup routine to disconnect from client cleanly if this thread is cancelled
+    pthread_cleanup_push(thread_cleanup, &pool_session);
+
+    // If the client takes too long the timer thread shuts the socket down, which ends the receive below
+    pthread_mutex_lock(&wheel->mutex);
+    session_timers_start(session, &wheel->wheel, pool_session_timeout);
+    pthread_mutex_unlock(&wheel->mutex);
+
+    // Display the welcome banner, then keep passing the client's messages to the game until it exits.
+    // A client that was told how long it would wait replies to that message first.
+    if((client & CLIENT_TOLD_TO_WAIT) && session_wait_reply(session) < 0) {
+        session->state = EXIT;
+    } else {
+        game_start(session);
+    }
+    while(session->state != EXIT) {
+        char buffer[MESSAGE_MAX_SIZE];
+        int size = session_receive(session, buffer, sizeof(buffer));
+        if(size < 0) {
+            break;
+        }
+        game_update(session, buffer, size);
+        if(session->state == LOGIN_VERIFYING) {
+            // The worker only drives this client, so it sleeps while the authentication stage checks the login.
+            // The stage's threads bound how many checks run at once however many workers are logging clients in.
+            game_login_verified(session, auth_wait(&session->auth));
+        }
 
-/**
- * Waits for the user to send some input. 
- * If the user sends a number between 1 and 3, the game's state will be updated accordingly
- **/
-void update_main_menu(int sockfd, enum game_state *state, MinesweeperState *sweeper_state, char* buffer) {
-    char input = buffer[1];
-
-    // Check if the selection is a number
-    if(isdigit(input)) {
-        // Convert to the proper integer, ex. '2' -> 2
-        int selection = input - '0';
-        switch(selection) {
-            case 1:
-                // Lock the rand mutex so that the rand function can be used
-                pthread_mutex_lock(&rand_mutex);
-                minesweeper_init(sweeper_state);
-                pthread_mutex_unlock(&rand_mutex);
-                *state = PLAYING;
-                break;
-            case 2:
-                *state = HIGHSCORE;
-                break;
-            case 3:
-                *state = EXIT;
-                break;
-            default:
-                send_message(sockfd, MSGC_PRINT, "Not a valid input! Choose a number between 1 and 3\n");
-                break;
+        // The wheel is only locked when the client's timeout changes, the timer thread sees the rest
+        if(session_timers_active(session)) {
+            pthread_mutex_lock(&wheel->mutex);
+            session_timers_touch(session, &wheel->wheel);
+            pthread_mutex_unlock(&wheel->mutex);
         }
-    }else {
-        send_message(sockfd, MSGC_PRINT, "Not a valid input! Choose a number between 1 and 3\n");
     }
-}
 
-/* ================================================ HIGHSCORE SCREEN ================================================ */
-/**
- * Iterates through the lists containing the scores and the user's games info and prints to the screen
- **/
-void draw_highscore_screen(MinesweeperState *sweeper_state, int sockfd) {
-    // Reader critical condition enter
-    leaderboard_read_lock();
+    pthread_mutex_lock(&wheel->mutex);
+    session_timers_stop(session, &wheel->wheel);
+    pthread_mutex_unlock(&wheel->mutex);
+    session_free(session);
 
-    if(get_gameinfo_size() < 1) {
-        send_message(sockfd, MSGC_PRINT, "---- The leaderboard is empty ----\n");
-        send_message(sockfd, MSGC_PRINT, "\n");
-    } else {
-        // Iterate through the list of won games
-        struct game* gameinfo = get_gameinfo_head();
-        while(gameinfo != NULL) {
-            int games_played, games_won;
-            get_userinfo(gameinfo->username, &games_played, &games_won);
-
-            // Print the details of the won game
-            char buffer[MESSAGE_MAX_SIZE];
-            snprintf(buffer, sizeof(buffer), "%s \t %d seconds \t %d games won, %d games played\n", gameinfo->username, gameinfo->time_taken, games_won, games_played);
-            send_message(sockfd, MSGC_PRINT, buffer);
-            gameinfo = gameinfo->next;
-        }
+    // Close the socket linking to the client, freeing this thread to connect to another client
+    close(client_sockfd);
+    if(__atomic_load_n(&session->timed_out, __ATOMIC_RELAXED)) {
+        printf("Client timed out. Socket: %d.\n", client_sockfd);
     }
+    printf("Client disconnected. Socket: %d.\n", client_sockfd);
 
-    // Reader critical condition exit
-    leaderboard_read_unlock();
-
-    send_message(sockfd, MSGC_INPUT, "Press <Enter> to continue");
+    // Remove the cleanup routine since the client has already disconnected
+    pthread_cleanup_pop(0);
 }
 
-/* ================================================ GAMEOVER SCREEN ================================================= */
+/* ==================================================== SHARDS ====================================================== */
 /**
- * Draws the screen shown to the user when the game is finished (either through winning or losing)
- **/
-void draw_gameover_screen(MinesweeperState *sweeper_state, int sockfd) {
-    send_message(sockfd, MSGC_PRINT, "------- Minesweeper -------\n");
-    send_message(sockfd, MSGC_PRINT, "\n");
+*   Open a socket listening on the given port. With reuseport set, many sockets can listen on the same port and
+*   the kernel spreads the incoming connections across them.
+*
+*   Returns the listening socket
+**/
+int server_listen(int port_num, int reuseport) {
+    int server_sockfd;                  // The socket to listen on
+    struct sockaddr_in server_addr;     // My address information 
 
-    if(sweeper_state->game_won) {
-        send_message(sockfd, MSGC_PRINT, "You've won!\n");
+    // Generate the socket
+	if((server_sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+		error("Socket generation");
+	}
 
-        // Create string with time won
-        char buffer[MESSAGE_MAX_SIZE];
-        snprintf(buffer, sizeof(buffer), "Time taken: %d seconds\n", (int)sweeper_state->game_time_taken);
-        send_message(sockfd, MSGC_PRINT, buffer);
-    } else {
-        send_message(sockfd, MSGC_PRINT, "Game Over! You've hit a mine\n");
+    if(reuseport) {
+        int enable = 1;
+        if(setsockopt(server_sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1) {
+            error("Setting SO_REUSEPORT");
+        }
     }
-    send_message(sockfd, MSGC_PRINT, "\n");
 
-    show_mines(sweeper_state, sweeper_state->game_won);
-    draw_minesweeper_field(sweeper_state, sockfd);
+    // Set all values in the buffer to 0
+    bzero((char *) &server_addr, sizeof(server_addr));
 
-    send_message(sockfd, MSGC_PRINT, "\n");
-    send_message(sockfd, MSGC_INPUT, "Press <Enter> to continue...\n");
-}
+    // Generate the end points
+    server_addr.sin_family = AF_INET;               // Host byte order
+	server_addr.sin_port = htons(port_num);         // Short, network byte order 
+	server_addr.sin_addr.s_addr = INADDR_ANY;       // Auto-fill with my IP 
 
-/* ========================================== GAME LOOP AND STATE MACHINE =========================================== */
-/**
- * Will call a draw function that depends on the current state of the game
- **/
-void draw(enum game_state *state, MinesweeperState *sweeper_state, int sockfd) {
-    send_message(sockfd, MSGC_PRINT, "\n");
-    int size = send_message(sockfd, MSGC_PRINT, "===========================================================\n");
-    send_message(sockfd, MSGC_PRINT, "\n");
-    // Check if the client is still connected
-    if(size < 0) {
-        *state = EXIT;
-    }
-
-    switch(*state) {
-        case MAIN_MENU:
-            draw_main_menu(sockfd);
-            break;
-        case PLAYING:
-            draw_playing_screen(sweeper_state, sockfd);
-            break;
-        case GAMEOVER:
-            draw_gameover_screen(sweeper_state, sockfd);
-            break;
-        case HIGHSCORE:
-            draw_highscore_screen(sweeper_state, sockfd);
-            break;
-        default:
-            break;
-    }
+    // Binds the socket to listen on to this server's address
+    if(bind(server_sockfd, (struct sockaddr *)&server_addr, sizeof(struct sockaddr)) == -1) {
+		error("Binding socket");
+	}
+
+    // Start listening
+    if(listen(server_sockfd, admission.backlog) == -1) {
+		error("Listen");
+	}
+
+    return server_sockfd;
 }
 
 /**
- * Waits for user input then calls the update function related to the current state the game is in.
- **/
-void update(enum game_state *state, MinesweeperState *sweeper_state, int sockfd) {
-    char buffer[MESSAGE_MAX_SIZE];
-    receive_message(sockfd, buffer, sizeof(buffer));
+*   The main function of each shard's accept thread. Hands every client it accepts to the shard's own workers.
+*   Nothing is printed for each client as that would serialise the shards on stdout; the counters are printed
+*   with the other statistics instead.
+**/
+void* shard_accept_loop(void* arg) {
+    struct shard* shard = arg;
 
-    switch(*state) {
-        case MAIN_MENU:
-            update_main_menu(sockfd, state, sweeper_state, buffer);
-            break;
-        case PLAYING:
-            update_playing_screen(sockfd, state, sweeper_state, buffer);
-            break;
-        case HIGHSCORE:
-        case GAMEOVER:
-            *state = MAIN_MENU;
-            break;
-        default:
+    while(server_keep_alive) {
+        int client_sockfd = accept(shard->sockfd, NULL, NULL);
+        if(client_sockfd == -1) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // The listening socket was shut down as the server is stopping
             break;
+        }
+
+        __atomic_add_fetch(&shard->accepted, 1, __ATOMIC_RELAXED);
+        if(server_mode == SERVER_MODE_POOL) {
+            if(client_queue_add(&shard->pool, client_sockfd) == 0) {
+                __atomic_add_fetch(&shard->turned_away, 1, __ATOMIC_RELAXED);
+            }
+        } else if(!admission_check_sessions(client_sockfd)) {
+            __atomic_add_fetch(&shard->turned_away, 1, __ATOMIC_RELAXED);
+        } else if(server_mode == SERVER_MODE_EPOLL) {
+            // Each shard has its own reactor thread
+            reactor_add_client_to(shard->index, client_sockfd);
+        } else {
+            // Each shard has its own io_uring loop thread
+            uring_add_client_to(shard->index, client_sockfd);
+        }
     }
+
+    return NULL;
 }
 
 /**
- * The game is played through this loop. It uses a state machine in order to decide what screen to
- * show and which function to call.
- * As this function is called by multiple threads, data relating to the game must be local.
- **/
-void game_loop(int sockfd, char* username) {
-    MinesweeperState sweeper_state; // Holds all information about the game such as mine locations, field info, etc.
-    sweeper_state.username = username+1;
-
-    enum game_state state = MAIN_MENU;
-    // Start the game loop that plays Minesweeper
-    while(state != EXIT) {
-        // Draw the screen representing the game state to the terminal
-        draw(&state, &sweeper_state, sockfd);
+*   Start num_shards shards listening on the given port. Shard i and its workers run on core i (wrapping around
+*   when there are more shards than cores).
+**/
+void shards_start(int port_num, int pool_min, int pool_max, int pool_idle) {
+    shards = calloc(num_shards, sizeof(struct shard));
+    if(!shards) {
+        error("Error creating the shards: out of memory");
+    }
+
+    int num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for(int i = 0; i < num_shards; i++) {
+        struct shard* shard = &shards[i];
+        shard->index = i;
+        shard->sockfd = server_listen(port_num, 1);
+        if(server_mode == SERVER_MODE_POOL) {
+            session_wheel_start(&shard->wheel, i % num_cpus);
+            threadpool_init(&shard->pool, pool_min, pool_max, pool_idle * 1000, admission.queue_capacity,
+                            i % num_cpus, handle_client, &shard->wheel);
+        }
 
-        // Update the game logic (including waiting for input)
-        update(&state, &sweeper_state, sockfd);
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(i % num_cpus, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        if(pthread_create(&shard->thread, &attr, shard_accept_loop, shard) != 0) {
+            error("Error creating the shards");
+        }
+        pthread_attr_destroy(&attr);
     }
 }
 
-/* ======================================= THREADPOOL THREADS MAIN FUNCTION ========================================= */
 /**
-*   The main function that each thread from the thread pool runs. 
-*   It will attempt to connect to a client and then start playing the game until the client
-*   closes its connection.
+*   Stop the accept thread of every shard and close the listening sockets
 **/
-void* handle_clients_loop() {
-    // The current username of the client connected to this thread
-    char username[MESSAGE_MAX_SIZE];
-
-    // Lock the mutex to the client queue
-    pthread_mutex_lock(&client_queue_mutex);
-
-    // Keep handling clients until server is shutdown
-    while(1) {
-        // Try to connect to a client in the queue if there are any
-        if(client_queue_size > 0) {
-            int client_sockfd = client_queue_pop();
-
-            if(client_sockfd > -1) {
-                // Unlock the mutex to the queue while this thread is connected to a client
-                pthread_mutex_unlock(&client_queue_mutex);
-
-                // Cleanup routine to disconnect from client cleanly if this thread is cancelled
-                pthread_cleanup_push(thread_cleanup, &client_sockfd);
-
-                // Display the welcome banner and check if the client's username and password are authorized to proceed
-                if(client_login(client_sockfd, username)) {
-                    // The client has authorization to play the game
-                    send_message(client_sockfd, MSGC_PRINT, "\n");
-                    send_message(client_sockfd, MSGC_PRINT, "Login successful\n");
-                    send_message(client_sockfd, MSGC_PRINT, "\n");
-                    game_loop(client_sockfd, username);
-
-                    // Send a message with a code that tells the client to exit and close the socket from their side
-                    send_message(client_sockfd, MSGC_EXIT, "Thanks for playing! Disconnecting...\n");
-                }else {
-                    // The username and password were wrong
-                    send_message(client_sockfd, MSGC_PRINT, "\n");
-                    send_message(client_sockfd, MSGC_EXIT, "Username or password is incorrect. Disconnecting...\n");
-                }
-
-                // Close the socket linking to the client, freeing this thread to connect to another client
-                close(client_sockfd);
-                printf("Client disconnected. Socket: %d.\n", client_sockfd);
-
-                // Remove the cleanup routine since the client has already disconnected
-                pthread_cleanup_pop(0);
-
-                // Lock the mutex now that the client has disconnected and this thread is waiting
-                pthread_mutex_lock(&client_queue_mutex);
-            }
-        }else {
-            // Wait for a client to connect. The client queue mutex will be unlocked while waiting
-            while(client_queue_size < 1) {
-                pthread_cond_wait(&client_queue_got_request, &client_queue_mutex);
-            }
-        }
+void shards_stop() {
+    for(int i = 0; i < num_shards; i++) {
+        // Wakes up the accept thread, which sees the error and exits
+        shutdown(shards[i].sockfd, SHUT_RDWR);
+        pthread_join(shards[i].thread, NULL);
+        close(shards[i].sockfd);
     }
 }
 
@@ -815,11 +654,114 @@ void* handle_clients_loop() {
 int main(int argc, char *argv[]) {
     int server_sockfd, newsockfd;       // Listen on server_sockfd, new connection on newsockfd 
     int port_num;                       // The port number to listen on
-    struct sockaddr_in server_addr;     // My address information 
 	struct sockaddr_in client_addr;     // Client's address information
+    int reactor_threads = sysconf(_SC_NPROCESSORS_ONLN);    // How many reactor threads to start in epoll and uring modes
+    int pool_min = THREADPOOL_MIN_DEFAULT;                  // The threadpool's size limits in pool mode
+    int pool_max = THREADPOOL_MAX_DEFAULT;
+    int pool_idle = THREADPOOL_IDLE_DEFAULT;
+    int login_timeout = LOGIN_TIMEOUT_DEFAULT;              // How long the clients can take, in seconds (0 for no limit)
+    int idle_timeout = IDLE_TIMEOUT_DEFAULT;
+    int session_timeout = SESSION_TIMEOUT_DEFAULT;
+    int auth_threads = AUTH_THREADS_DEFAULT;                // How many threads check the logins
+    char* history_file = HISTORY_FILE_DEFAULT;              // Where the leaderboard is kept across restarts
+    int pool_boards = BOARDS_POOL_DEFAULT;                  // How many fields of each size are made ahead (0 for none)
+
+    // Get the options the server should run with
+    int opt;
+    while((opt = getopt(argc, argv, "m:t:w:W:i:s:l:T:C:b:q:a:A:V:H:P:")) != -1) {
+        switch(opt) {
+            case 'm':
+                if(strcmp(optarg, "pool") == 0) {
+                    server_mode = SERVER_MODE_POOL;
+                } else if(strcmp(optarg, "epoll") == 0) {
+                    server_mode = SERVER_MODE_EPOLL;
+                } else if(strcmp(optarg, "uring") == 0) {
+                    server_mode = SERVER_MODE_URING;
+                } else {
+                    fprintf(stderr, "Unknown mode: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 't':
+                reactor_threads = atoi(optarg);
+                break;
+            case 'w':
+                pool_min = atoi(optarg);
+                break;
+            case 'W':
+                pool_max = atoi(optarg);
+                break;
+            case 'i':
+                pool_idle = atoi(optarg);
+                break;
+            case 's':
+                num_shards = atoi(optarg);
+                break;
+            case 'l':
+                login_timeout = atoi(optarg);
+                break;
+            case 'T':
+                idle_timeout = atoi(optarg);
+                break;
+            case 'C':
+                session_timeout = atoi(optarg);
+                break;
+            case 'b':
+                admission.backlog = atoi(optarg);
+                break;
+            case 'q':
+                admission.queue_capacity = atoi(optarg);
+                break;
+            case 'a':
+                admission.max_wait = atoi(optarg);
+                break;
+            case 'A':
+                admission.max_sessions = atoi(optarg);
+                break;
+            case 'V':
+                auth_threads = atoi(optarg);
+                break;
+            case 'H':
+                history_file = optarg;
+                break;
+            case 'P':
+                pool_boards = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-m pool|epoll|uring] [-t reactor_threads] [-w min_workers] [-W max_workers] "
+                                "[-i idle_seconds] [-s shards] [-l login_timeout] [-T move_timeout] [-C session_timeout] "
+                                "[-b backlog] [-q queue_capacity] [-a max_wait] [-A max_sessions] [-V auth_threads] "
+                                "[-H history_file] [-P pool_boards] [port_number]\n", argv[0]);
+                exit(1);
+        }
+    }
+    if(reactor_threads < 1) {
+        reactor_threads = 1;
+    }
+    if(pool_max < 1) {
+        pool_max = 1;
+    }
+    if(pool_min < 1 || pool_min > pool_max) {
+        pool_min = (pool_min < 1) ? 1 : pool_max;
+    }
+    if(num_shards < 0) {
+        num_shards = 0;
+    }
+    if(auth_threads < 1) {
+        auth_threads = 1;
+    }
+    if(admission.backlog < 1) {
+        admission.backlog = CONNECTION_BACKLOG_MAX;
+    }
+    if(admission.queue_capacity < 1) {
+        admission.queue_capacity = 1;
+    }
+    session_timeouts.login_ms = (login_timeout > 0) ? login_timeout * 1000 : 0;
+    session_timeouts.idle_ms = (idle_timeout > 0) ? idle_timeout * 1000 : 0;
+    session_timeouts.max_ms = (session_timeout > 0) ? session_timeout * 1000 : 0;
 
-    // Seed the random number generator
-    srand(RNG_SEED_DEFAULT);
+    // Seed the random number generators of the games
+    session_random_seed = RNG_SEED_DEFAULT;
 
     // Catch the interrupt signal and pass it to the signal handler
     struct sigaction act;
@@ -827,6 +769,7 @@ int main(int argc, char *argv[]) {
     act.sa_handler = signal_handler;
 	// act.sa_flags = SA_RESTART; - Flag is not set so that the accept() in the loop below can be interrupted
     sigaction(SIGINT, &act, NULL);
+    sigaction(SIGUSR1, &act, NULL);
 
     // Ignore the SIGPIPE signal that is sent if the client is closed while we're reading or sending data
     // This stops the server from crashing if a client is closed with ctrl+c and the server can't communicate
@@ -834,40 +777,116 @@ int main(int argc, char *argv[]) {
     // will do it for us when it realises it can't send a message to the client anymore.
     signal(SIGPIPE, SIG_IGN);
 
-    // Create the threadpool that will handle the clients
-    for(int i=0; i < THREADPOOL_SIZE; i++) {
-        pthread_create(&threadpool[i], NULL, handle_clients_loop, NULL);
+    // With shards, only the main thread handles the signals. Every thread started from here on inherits a mask
+    // that blocks them, while the main thread only unblocks them as it waits in sigsuspend.
+    sigset_t signals, old_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGUSR1);
+    if(num_shards > 0) {
+        pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+    }
+
+    // Load the usernames and passwords, the watcher thread reloads them whenever the file changes
+    if(credentials_start(CREDENTIALS_FILE) < 0) {
+        error("Error loading the credentials");
+    }
+    // Start the threads that check the logins, so a slow check never holds up the threads driving the games
+    auth_start(auth_threads);
+    // Restore the leaderboard kept from the previous runs, then start the thread that adds the games that end to it
+    if(history_open(history_file) < 0) {
+        error("Error opening the leaderboard history");
+    }
+    struct history_stats history;
+    history_stats_get(&history);
+    printf("Leaderboard restored in %ld ms: %d games won by %d users (%lu results from the snapshot, %lu from the log).\n",
+           history.load_ms, get_gameinfo_size(), get_userinfolist_size(), history.restored, history.replayed);
+    if(history.dropped > 0) {
+        printf("Dropped %lu bytes at the end of the leaderboard log that were not whole results.\n", history.dropped);
+    }
+    results_start();
+    // Start making the fields of the sizes that can be picked from the menu ahead of the games
+    if(pool_boards > 0) {
+        boards_start(pool_boards, ~(uint64_t)RNG_SEED_DEFAULT);    // Inverted to keep it apart from the sessions' seeds
+    }
+
+    if(server_mode != SERVER_MODE_POOL) {
+        // Every client holds a socket open, so allow as many as the system lets us
+        struct rlimit limit;
+        if(getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+    if(server_mode == SERVER_MODE_URING) {
+        // Create the io_uring loop threads that will handle the clients. Each shard gets its own loop thread.
+        if(uring_start((num_shards > 0) ? num_shards : reactor_threads, num_shards > 0) < 0) {
+            printf("io_uring is not supported on this system, using epoll instead.\n");
+            server_mode = SERVER_MODE_EPOLL;
+        }
+    }
+    if(server_mode == SERVER_MODE_EPOLL) {
+        // Create the reactor threads that will handle the clients. Each shard gets its own reactor thread.
+        if(num_shards > 0) {
+            reactor_start(num_shards, 1);
+        } else {
+            reactor_start(reactor_threads, 0);
+        }
+    } else if(server_mode == SERVER_MODE_POOL) {
+        if(num_shards == 0) {
+            // Create the threadpool that will handle the clients and its timer thread. Each shard creates its own.
+            session_wheel_start(&session_wheel, -1);
+            threadpool_init(&threadpool, pool_min, pool_max, pool_idle * 1000, admission.queue_capacity, -1,
+                            handle_client, &session_wheel);
+        }
     }
 
     // Get port number for server to listen on
-	if(argc != 2) {
+	if(optind >= argc) {
         port_num = PORT_DEFAULT;
 	} else {
-        port_num = atoi(argv[1]);
+        port_num = atoi(argv[optind]);
     }
 
-    // Generate the socket
-	if((server_sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-		error("Socket generation");
-	}
+    if(num_shards > 0) {
+        shards_start(port_num, pool_min, pool_max, pool_idle);
+        printf("Server is listening with %d shards...\n", num_shards);
+        printf("\n");
 
-    // Set all values in the buffer to 0
-    bzero((char *) &server_addr, sizeof(server_addr));
-
-    // Generate the end points
-    server_addr.sin_family = AF_INET;               // Host byte order
-	server_addr.sin_port = htons(port_num);         // Short, network byte order 
-	server_addr.sin_addr.s_addr = INADDR_ANY;       // Auto-fill with my IP 
+        // Sleep until a signal arrives. The signals stay blocked outside of sigsuspend so none are missed.
+        while(server_keep_alive) {
+            sigsuspend(&old_signals);
+            if(server_print_stats) {
+                server_print_stats = 0;
+                print_stats();
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+        // Clean up the program before exiting. The logins being checked are handed back before the clients go.
+        printf("\n");
+        shards_stop();
+        auth_stop();
+        if(server_mode == SERVER_MODE_EPOLL) {
+            reactor_stop();
+        } else if(server_mode == SERVER_MODE_URING) {
+            uring_stop();
+        } else {
+            for(int i = 0; i < num_shards; i++) {
+                threadpool_stop(&shards[i].pool);
+                session_wheel_stop(&shards[i].wheel);
+            }
+        }
+        results_stop();
+        boards_stop();
+        print_stats();
+        free_memory();
 
-    // Binds the socket to listen on to this server's address
-    if(bind(server_sockfd, (struct sockaddr *)&server_addr, sizeof(struct sockaddr)) == -1) {
-		error("Binding socket");
-	}
+        return 0;
+    }
 
     // Start listening
-    if(listen(server_sockfd, CONNECTION_BACKLOG_MAX) == -1) {
-		error("Listen");
-	}
+    server_sockfd = server_listen(port_num, 0);
     printf("Server is listening...\n");
     printf("\n");
 
@@ -878,29 +897,61 @@ int main(int argc, char *argv[]) {
         newsockfd = accept(server_sockfd, (struct sockaddr *)&client_addr, &sockin_size);
 
         // Error checking
-        if(errno == EINTR) {
-            // This will be thrown if accept() is interrupted by a signal like SIGINT
-            break;
+        if(newsockfd == -1 && errno == EINTR) {
+            // This will be thrown if accept() is interrupted by a signal like SIGINT or SIGUSR1
+            if(server_print_stats) {
+                server_print_stats = 0;
+                print_stats();
+            }
+            continue;
         } else if(newsockfd == -1) {
             // Something wrong happened when trying to connect to a client
             error("Accept");
         }
         
-        // Add the client to the queue
-        int queue_size = client_queue_add(newsockfd);
-        // Note that the queue length can be that of the queue before it is read by a thread and the 
-        // connection to the client established. (Ie. If the length is 1, it doesn't necessarily mean 
-        // that all threads in the pool are occupied with other connections).
-        printf("Client connected. Socket: %d. Queue length: %d\n", newsockfd, queue_size);
+        if(server_mode != SERVER_MODE_POOL && !admission_check_sessions(newsockfd)) {
+            printf("Client turned away, the server is full. Socket: %d.\n", newsockfd);
+        } else if(server_mode == SERVER_MODE_EPOLL) {
+            // Hand the client to one of the reactor threads
+            int num_sessions = reactor_add_client(newsockfd);
+            printf("Client connected. Socket: %d. Reactor sessions: %d\n", newsockfd, num_sessions);
+        } else if(server_mode == SERVER_MODE_URING) {
+            // Hand the client to one of the io_uring loop threads
+            int num_sessions = uring_add_client(newsockfd);
+            printf("Client connected. Socket: %d. io_uring sessions: %d\n", newsockfd, num_sessions);
+        } else {
+            // Add the client to the queue
+            int queue_size = client_queue_add(&threadpool, newsockfd);
+            if(queue_size == 0) {
+                printf("Client turned away, the server is busy. Socket: %d.\n", newsockfd);
+                continue;
+            }
+            // Note that the queue length can be that of the queue before it is read by a thread and the 
+            // connection to the client established. (Ie. If the length is 1, it doesn't necessarily mean 
+            // that all threads in the pool are occupied with other connections).
+            printf("Client connected. Socket: %d. Queue length: %d\n", newsockfd, queue_size);
+        }
     }
 
-    // Clean up the program before exiting
+    // Clean up the program before exiting. The logins being checked are handed back before the clients go.
     printf("\n");
-    // Cancel all threads in the threadpool
-    for(int i=0; i < THREADPOOL_SIZE; i++) {
-        pthread_cancel(threadpool[i]);
+    auth_stop();
+    if(server_mode == SERVER_MODE_EPOLL) {
+        // Stop the reactor threads, which disconnects their clients
+        reactor_stop();
+    } else if(server_mode == SERVER_MODE_URING) {
+        // Stop the io_uring loop threads, which disconnects their clients
+        uring_stop();
+    } else {
+        // Wake up the threads waiting for a client, then cancel all threads in the threadpool
+        threadpool_stop(&threadpool);
+        session_wheel_stop(&session_wheel);
     }
+    // Every game has ended, add the results still queued to the leaderboard
+    results_stop();
+    boards_stop();
     close(server_sockfd);
+    print_stats();
     free_memory();
 
     return 0;
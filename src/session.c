@@ -0,0 +1,749 @@
+#define _GNU_SOURCE // Required for MSG_NOSIGNAL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+// Sockets
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "screen.h"
+#include "session.h"
+
+#define OUTBOX_SIZE_DEFAULT     4096    // The size of the outbox when the first message is added to it
+
+// How long the clients can take. Filled in by the server from its options.
+struct session_timeouts session_timeouts = {0};
+
+// The seed the random number generators of the sessions' games are derived from
+uint64_t session_random_seed = 0;
+unsigned long session_random_count = 0;     // How many sessions have been seeded, each gets the next number
+
+// Counters summed over every session. Updated atomically as sessions are handled by many threads.
+struct session_stats session_stats_total = {0};
+
+/**
+ * Adds value to one of the session counters
+ **/
+void session_stats_add(unsigned long* counter, unsigned long value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Prepare a session for a client that just connected
+ **/
+void session_init(struct session* session, int sockfd, int nonblocking) {
+    memset(session, 0, sizeof(struct session));
+    session->sockfd = sockfd;
+    session->nonblocking = nonblocking;
+    session->state = LOGIN_USERNAME;
+    session->sweeper_state.username = session->username;
+    // Every session gets its own generator, so games start without any lock. Mixing the seed with the count of
+    // sessions keeps the fields of the nth session the same from run to run.
+    unsigned long number = __atomic_fetch_add(&session_random_count, 1, __ATOMIC_RELAXED);
+    field_random_seed(&session->sweeper_state.random, session_random_seed + number);
+    session->auth.username = session->username;
+    session->auth.password = session->password;
+    session->auth.data = session;
+    clock_gettime(CLOCK_MONOTONIC, &session->started);
+    timer_init(&session->idle_timer, NULL, session);
+    timer_init(&session->max_timer, NULL, session);
+}
+
+/**
+ * Deallocate the memory assigned to the session's buffers. Does not close the socket.
+ **/
+void session_free(struct session* session) {
+    if(session->started.tv_sec != 0) {
+        // Count how long the session lasted, once
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - session->started.tv_sec) * 1000L + (now.tv_nsec - session->started.tv_nsec) / 1000000L;
+        session_stats_add(&session_stats_total.sessions, 1);
+        session_stats_add(&session_stats_total.session_ms, elapsed);
+        session->started.tv_sec = 0;
+    }
+
+    screen_free(&session->screen);
+    free(session->outbox);
+    session->outbox = NULL;
+    session->outbox_len = 0;
+    session->outbox_pos = 0;
+    session->outbox_cap = 0;
+}
+
+/**
+ * Returns 1 if the client has to reply with an ACK after receiving a message with this code
+ **/
+int message_needs_ack(char msg_code) {
+    // MSGC_ACK and MSGC_DATA don't actually contain a string message to print so we don't need to wait
+    return (msg_code != MSGC_ACK) && (msg_code != MSGC_DATA);
+}
+
+/**
+ * Removes the message at the front of the inbox and copies it into buffer (message code first).
+ *
+ * With protocol v1, an ACK is a single character, a hello is two characters and data sent by the client ends
+ * with a new line. If the inbox is full, everything in it is treated as a single message so that a client can't
+ * stall the session by never sending a new line. With protocol v2 each message is a frame, and a frame too large
+ * for the inbox is truncated the same way: what fits is the message and the rest is thrown away as it arrives.
+ *
+ * Returns the size of the message, 0 if the message hasn't been completely received yet or -1 if the
+ * client broke the protocol.
+ **/
+int inbox_pop(struct session* session, char* buffer, int buffer_size) {
+    int size = 0;       // How many bytes the message takes up in the inbox
+    int offset = 0;     // Where the message code is in the inbox
+
+    if(session->protocol == PROTOCOL_V2) {
+        if(session->inbox_skip > 0) {
+            // Throw away the rest of the last frame that didn't fit
+            int skip = (session->inbox_skip < session->inbox_len) ? session->inbox_skip : session->inbox_len;
+            session->inbox_skip -= skip;
+            session->inbox_len -= skip;
+            memmove(session->inbox, session->inbox + skip, session->inbox_len);
+        }
+        size = frame_size(session->inbox, session->inbox_len);
+        if(size == 0 && session->inbox_len == sizeof(session->inbox)) {
+            // The frame is larger than anything a client should send, only what fits is kept
+            session->inbox_skip = FRAME_HEADER_SIZE + frame_msg_size(session->inbox) - session->inbox_len;
+            size = session->inbox_len;
+        }
+        if(size <= 0) {
+            return size;
+        }
+        // The message code is the last byte of the header and the message follows it
+        offset = FRAME_HEADER_SIZE - 1;
+    } else {
+        while(session->inbox_len > 0) {
+            char code = session->inbox[0];
+
+            if(code == MSGC_ACK) {
+                size = 1;
+            } else if(code == MSGC_HELLO) {
+                size = 2;
+            } else if(code == MSGC_DATA) {
+                char* end = memchr(session->inbox, '\n', session->inbox_len);
+                if(end != NULL) {
+                    size = end - session->inbox + 1;
+                } else if(session->inbox_len == sizeof(session->inbox)) {
+                    size = session->inbox_len;
+                }
+            } else {
+                // Throw away anything that isn't a message the server understands
+                memmove(session->inbox, session->inbox + 1, --session->inbox_len);
+                continue;
+            }
+            break;
+        }
+
+        if(size == 0 || size > session->inbox_len) {
+            // Wait for the rest of the message
+            return 0;
+        }
+    }
+
+    // Copy the message to the buffer. Messages larger than the buffer are truncated.
+    int msg_size = size - offset;
+    int copy_size = (msg_size < buffer_size) ? msg_size : buffer_size - 1;
+    memcpy(buffer, session->inbox + offset, copy_size);
+    buffer[copy_size] = '\0';
+
+    session->inbox_len -= size;
+    memmove(session->inbox, session->inbox + size, session->inbox_len);
+    return copy_size;
+}
+
+/**
+ * Reads more bytes from the socket into the inbox. Will block if the session is blocking.
+ *
+ * Return   >0  Bytes were read
+ *          0   Nothing is waiting at a non-blocking socket
+ *          -1  The client has disconnected
+ **/
+int inbox_recv(struct session* session) {
+    int space = sizeof(session->inbox) - session->inbox_len;
+    if(space == 0) {
+        // The inbox is full, so the next call to inbox_pop() is guaranteed to free some space
+        return 1;
+    }
+
+    int size = recv(session->sockfd, session->inbox + session->inbox_len, space, 0);
+    if(size > 0) {
+        session->inbox_len += size;
+        return size;
+    }
+    if(size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * Makes sure the outbox has space for size more bytes
+ **/
+void outbox_reserve(struct session* session, size_t size) {
+    if(session->outbox_len + size <= session->outbox_cap) {
+        return;
+    }
+
+    size_t cap = session->outbox_cap ? session->outbox_cap : OUTBOX_SIZE_DEFAULT;
+    while(session->outbox_len + size > cap) {
+        cap *= 2;
+    }
+
+    char* outbox = realloc(session->outbox, cap);
+    if(!outbox) {
+        perror("Error adding message to the outbox: out of memory");
+        exit(1);
+    }
+    session->outbox = outbox;
+    session->outbox_cap = cap;
+}
+
+/**
+ * Adds a message to the end of the outbox in the format used by the session's protocol
+ **/
+void outbox_add(struct session* session, char msg_code, const char* msg) {
+    size_t msg_size = strlen(msg);
+
+    if(session->protocol == PROTOCOL_V2) {
+        outbox_reserve(session, FRAME_HEADER_SIZE + msg_size);
+        frame_header(session->outbox + session->outbox_len, msg_code, msg_size);
+        memcpy(session->outbox + session->outbox_len + FRAME_HEADER_SIZE, msg, msg_size);
+        session->outbox_len += FRAME_HEADER_SIZE + msg_size;
+    } else {
+        // Message code + string + '\0'
+        outbox_reserve(session, msg_size + 2);
+        session->outbox[session->outbox_len] = msg_code;
+        memcpy(session->outbox + session->outbox_len + 1, msg, msg_size + 1);
+        session->outbox_len += msg_size + 2;
+    }
+}
+
+/**
+ * Called when the client replies to the first message sent to it. If the client asked for protocol v2,
+ * the server agrees by sending the hello back and switches to sending frames.
+ **/
+void session_negotiate(struct session* session, int version) {
+    session->awaiting_ack = 0;
+    if(session->protocol != 0) {
+        // The protocol can only be chosen once
+        return;
+    }
+    if(version < PROTOCOL_V2) {
+        session->protocol = PROTOCOL_V1;
+        return;
+    }
+    session->protocol = PROTOCOL_V2;
+
+    // The reply to the hello is the last message sent without a frame
+    char reply[2] = {MSGC_HELLO, '0' + PROTOCOL_V2};
+    if(!session->nonblocking) {
+        send(session->sockfd, reply, sizeof(reply), MSG_NOSIGNAL);
+        return;
+    }
+
+    // Put the reply in front of the messages that are still waiting to be sent, which are turned into frames
+    char* old_outbox = session->outbox;
+    size_t old_pos = session->outbox_pos;
+    size_t old_len = session->outbox_len;
+    session->outbox = NULL;
+    session->outbox_len = 0;
+    session->outbox_pos = 0;
+    session->outbox_cap = 0;
+
+    outbox_reserve(session, sizeof(reply));
+    memcpy(session->outbox, reply, sizeof(reply));
+    session->outbox_len = sizeof(reply);
+    while(old_pos < old_len) {
+        char* msg = old_outbox + old_pos;
+        outbox_add(session, msg[0], msg + 1);
+        old_pos += strlen(msg) + 1;
+    }
+    free(old_outbox);
+}
+
+/**
+ * Blocks until the client of a blocking session acknowledges the last message sent to it.
+ * If the client has already sent data instead, it has moved on and the ACK is not waited on.
+ **/
+int session_wait_ack(struct session* session) {
+    while(session->awaiting_ack) {
+        if(session->inbox_len == 0 || (session->inbox[0] == MSGC_HELLO && session->inbox_len < 2)) {
+            if(inbox_recv(session) < 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        char code = session->inbox[0];
+        if(code == MSGC_HELLO) {
+            session_negotiate(session, session->inbox[1] - '0');
+            session->inbox_len -= 2;
+            memmove(session->inbox, session->inbox + 2, session->inbox_len);
+        } else {
+            if(code == MSGC_ACK) {
+                session->inbox_len--;
+                memmove(session->inbox, session->inbox + 1, session->inbox_len);
+            }
+            session_negotiate(session, PROTOCOL_V1);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Sends a single protocol v1 message to the client of a blocking session and waits for the ACK.
+ *
+ * Returns the size of the message or -1 if the client can't be reached.
+ **/
+int session_send_blocking(struct session* session, char msg_code, const char* msg) {
+    // Concatenate the msg code and the message then transmit to the client
+    char buffer[MESSAGE_MAX_SIZE];
+    snprintf(buffer, sizeof buffer, "%c%s", msg_code, msg);
+    int size = send(session->sockfd, buffer, strlen(buffer), MSG_NOSIGNAL);
+    session_stats_add(&session_stats_total.syscalls, 1);
+    if(size < 0) {
+        return -1;
+    }
+    session_stats_add(&session_stats_total.bytes, size);
+
+    // Wait for ACK from client
+    if(message_needs_ack(msg_code)) {
+        session->awaiting_ack = 1;
+        if(session_wait_ack(session) < 0) {
+            return -1;
+        }
+    }
+
+    return size;
+}
+
+/**
+ * Writes the buffers to the client with as few system calls as possible. If a non-blocking socket can't
+ * take everything, the rest is copied to the outbox to be written by session_flush.
+ *
+ * Returns -1 if the client can't be reached.
+ **/
+int session_writev(struct session* session, struct iovec* iov, int iovcnt) {
+    // Anything already waiting in the outbox has to be sent first. Deferred sessions leave all the writing to
+    // whoever owns them.
+    int queued = session->deferred || (session->nonblocking && (session->outbox_pos < session->outbox_len));
+
+    while(!queued && iovcnt > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (iovcnt < IOV_MAX) ? iovcnt : IOV_MAX;
+
+        ssize_t sent = sendmsg(session->sockfd, &msg, MSG_NOSIGNAL);
+        session_stats_add(&session_stats_total.syscalls, 1);
+        if(sent < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(session->nonblocking && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            return -1;
+        }
+        session_stats_add(&session_stats_total.bytes, sent);
+
+        // Skip over everything that was written
+        while(iovcnt > 0 && (size_t)sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+
+    // Keep what couldn't be written for when the socket is writable again
+    for(int i = 0; i < iovcnt; i++) {
+        outbox_reserve(session, iov[i].iov_len);
+        memcpy(session->outbox + session->outbox_len, iov[i].iov_base, iov[i].iov_len);
+        session->outbox_len += iov[i].iov_len;
+    }
+    if(queued && !session->deferred) {
+        return session_flush(session);
+    }
+
+    return 0;
+}
+
+/**
+ * Sends the lines of the screen from start onwards as protocol v2 frames. Consecutive lines with the same
+ * message code are joined into a single frame and everything is written with one writev().
+ **/
+int session_present_frames(struct session* session, int start) {
+    struct screen* screen = &session->screen;
+    int num_segments = screen->num_segments - start;
+
+    // At worst every line needs its own frame header
+    screen_reserve_scratch(screen, num_segments * 2, num_segments, FRAME_HEADER_SIZE);
+
+    int iovcnt = 0;
+    int num_headers = 0;
+    int i = start;
+    while(i < screen->num_segments) {
+        char msg_code = screen->segments[i].msg_code;
+        int header_index = iovcnt++;
+        size_t msg_size = 0;
+
+        // The lines are referenced, not copied, so constant lines go straight from where they are to the socket
+        while(i < screen->num_segments && screen->segments[i].msg_code == msg_code &&
+              msg_size + screen->segments[i].size <= FRAME_MAX_SIZE) {
+            screen->iov[iovcnt].iov_base = (char*)screen_segment_text(screen, i);
+            screen->iov[iovcnt].iov_len = screen->segments[i].size;
+            msg_size += screen->segments[i].size;
+            iovcnt++;
+            i++;
+        }
+
+        char* header = screen->headers + (num_headers++ * FRAME_HEADER_SIZE);
+        frame_header(header, msg_code, msg_size);
+        screen->iov[header_index].iov_base = header;
+        screen->iov[header_index].iov_len = FRAME_HEADER_SIZE;
+    }
+
+    return session_writev(session, screen->iov, iovcnt);
+}
+
+/**
+ * Sends the lines of the screen from start onwards as protocol v1 messages, one line per message.
+ * If the client asks for protocol v2 in reply to the first message, the rest of the lines are sent as frames.
+ **/
+int session_present_messages(struct session* session, int start) {
+    struct screen* screen = &session->screen;
+
+    for(int i = start; i < screen->num_segments; i++) {
+        char msg_code = screen->segments[i].msg_code;
+        const char* msg = screen_segment_text(screen, i);
+
+        if(session->nonblocking) {
+            // The messages are sent from the outbox as the client's ACKs arrive
+            outbox_add(session, msg_code, msg);
+        } else if(session->protocol == PROTOCOL_V2) {
+            return session_present_frames(session, i);
+        } else if(session_send_blocking(session, msg_code, msg) < 0) {
+            return -1;
+        }
+    }
+
+    if(session->nonblocking) {
+        return session_flush(session);
+    }
+    return 0;
+}
+
+/**
+ * Add a constant line to the screen that will be sent to the client. The string is not copied.
+ **/
+void session_puts(struct session* session, char msg_code, const char* msg) {
+    screen_puts(&session->screen, msg_code, msg);
+}
+
+/**
+ * Add a formatted line to the screen that will be sent to the client
+ **/
+void session_printf(struct session* session, char msg_code, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    screen_vprintf(&session->screen, msg_code, format, args);
+    va_end(args);
+}
+
+/**
+ * Send every line on the session's screen to the client and clear the screen.
+ *
+ * With protocol v2 the whole screen is written with a single writev(). With protocol v1 each line is still
+ * sent on its own and acknowledged by the client. Blocking sessions wait until everything is sent, while
+ * non-blocking sessions keep whatever the socket couldn't take in the outbox for session_flush.
+ *
+ * Returns -1 if the client can't be reached.
+ **/
+int session_present(struct session* session) {
+    struct screen* screen = &session->screen;
+    if(screen->num_segments == 0) {
+        return 0;
+    }
+
+    int result;
+    if(session->protocol == PROTOCOL_V2) {
+        result = session_present_frames(session, 0);
+    } else {
+        result = session_present_messages(session, 0);
+    }
+
+    // Measure how long it took to draw and send the screen
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed = (now.tv_sec - screen->started.tv_sec) * 1000000000L + (now.tv_nsec - screen->started.tv_nsec);
+    session_stats_add(&session_stats_total.frames, 1);
+    session_stats_add(&session_stats_total.segments, screen->num_segments);
+    session_stats_add(&session_stats_total.frame_ns, elapsed);
+
+    screen_clear(screen);
+    return result;
+}
+
+/**
+ * Get the bytes of the outbox that can be sent now. With protocol v1 that is the rest of the current message,
+ * but only once the previous one has been acknowledged. With protocol v2 it is everything in the outbox.
+ *
+ * Returns how many bytes can be sent, 0 if there is nothing to send at the moment
+ **/
+size_t session_outbox_next(struct session* session, char** data) {
+    if(session->awaiting_ack || (session->outbox_pos == session->outbox_len)) {
+        return 0;
+    }
+
+    char* msg = session->outbox + session->outbox_pos;
+    size_t size = (session->protocol == PROTOCOL_V2) ? session->outbox_len - session->outbox_pos : strlen(msg);
+    *data = msg + session->msg_sent;
+    return size - session->msg_sent;
+}
+
+/**
+ * Removes sent bytes from the front of what session_outbox_next returned
+ **/
+void session_outbox_sent(struct session* session, size_t sent) {
+    session_stats_add(&session_stats_total.bytes, sent);
+
+    if(session->protocol == PROTOCOL_V2) {
+        session->outbox_pos += sent;
+    } else {
+        char* msg = session->outbox + session->outbox_pos;
+        size_t size = strlen(msg);
+        session->msg_sent += sent;
+        if(session->msg_sent == size) {
+            // The whole message was written, move on to the next one
+            session->msg_sent = 0;
+            session->outbox_pos += size + 1;
+            session->awaiting_ack = message_needs_ack(msg[0]);
+        }
+    }
+
+    // Reuse the outbox from the start once everything has been sent
+    if(session->outbox_pos == session->outbox_len) {
+        session->outbox_pos = 0;
+        session->outbox_len = 0;
+    }
+}
+
+/**
+ * Write as many messages from the outbox as the socket (and the client's ACKs) allow without blocking.
+ * With protocol v1 a message is only sent once the previous one has been acknowledged so the client receives
+ * each line separately. With protocol v2 the frames are written out all at once.
+ *
+ * Returns -1 if the client can't be reached.
+ **/
+int session_flush(struct session* session) {
+    if(session->deferred) {
+        // The owner of the session writes the outbox itself
+        return 0;
+    }
+
+    char* data;
+    size_t size;
+    while((size = session_outbox_next(session, &data)) > 0) {
+        int sent = send(session->sockfd, data, size, MSG_NOSIGNAL);
+        session_stats_add(&session_stats_total.syscalls, 1);
+        if(sent < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                // The reactor will call this function again once the socket is writable
+                return 0;
+            }
+            return -1;
+        }
+        session_outbox_sent(session, sent);
+    }
+
+    return 0;
+}
+
+/**
+ * Read all of the bytes waiting at a non-blocking socket into the inbox.
+ *
+ * Return   >0  Bytes were read and there may be more waiting
+ *          0   There is nothing left to read at the moment
+ *          -1  The client has disconnected
+ **/
+int session_fill(struct session* session) {
+    return inbox_recv(session);
+}
+
+/**
+ * Copy bytes that were received from the client by someone else into the inbox.
+ *
+ * Returns how many bytes fit in the inbox. The rest should be fed again once messages have been removed.
+ **/
+int session_feed(struct session* session, const char* data, int size) {
+    int space = sizeof(session->inbox) - session->inbox_len;
+    if(size > space) {
+        size = space;
+    }
+
+    memcpy(session->inbox + session->inbox_len, data, size);
+    session->inbox_len += size;
+    return size;
+}
+
+/**
+ * Remove the next complete message (other than an ACK) sent by the client from the inbox and place it in buffer.
+ * ACKs and the hello met along the way are consumed.
+ *
+ * Returns the size of the message, 0 if there is no complete message yet or -1 if the client broke the protocol.
+ **/
+int session_next_message(struct session* session, char* buffer, int buffer_size) {
+    int size;
+    while((size = inbox_pop(session, buffer, buffer_size)) > 0) {
+        if(buffer[0] == MSGC_HELLO) {
+            session_negotiate(session, buffer[1] - '0');
+        } else if(buffer[0] == MSGC_ACK) {
+            session_negotiate(session, PROTOCOL_V1);
+        } else {
+            return size;
+        }
+    }
+
+    return size;
+}
+
+/**
+ * Waits until the client of a blocking session sends a message and places it in buffer.
+ *
+ * Returns the size of the message or -1 if the client has disconnected.
+ **/
+int session_receive(struct session* session, char* buffer, int buffer_size) {
+    int size;
+    while((size = session_next_message(session, buffer, buffer_size)) == 0) {
+        if(inbox_recv(session) < 0) {
+            return -1;
+        }
+    }
+
+    return size;
+}
+
+/**
+ * Waits for the client of a blocking session to reply to a message that was sent to it before the session
+ * started (eg. while it was waiting for a worker). As with any first message, the reply chooses the protocol.
+ *
+ * Returns -1 if the client has disconnected.
+ **/
+int session_wait_reply(struct session* session) {
+    session->awaiting_ack = 1;
+    return session_wait_ack(session);
+}
+
+/**
+ * Returns 1 once the session has exited and everything has been sent to the client
+ **/
+int session_finished(struct session* session) {
+    return (session->state == EXIT) && (session->outbox_len == 0) && !session->awaiting_ack;
+}
+
+/**
+ * Arm the session's timers on the wheel. expire is called with the session as the timer's data once the client
+ * has taken too long.
+ **/
+void session_timers_start(struct session* session, struct timer_wheel* wheel, void (*expire)(struct timer* timer, void* arg)) {
+    timer_init(&session->idle_timer, expire, session);
+    timer_init(&session->max_timer, expire, session);
+    if(session_timeouts.max_ms > 0) {
+        timer_arm(wheel, &session->max_timer, session_timeouts.max_ms);
+    }
+    session_timers_touch(session, wheel);
+}
+
+/**
+ * Returns 1 if the client is on one of the login screens, which have their own timeout
+ **/
+int session_logging_in(struct session* session) {
+    return (session->state == LOGIN_USERNAME) || (session->state == LOGIN_PASSWORD) ||
+           (session->state == LOGIN_VERIFYING);
+}
+
+/**
+ * Give the client a fresh deadline to answer the screen it is on. Called every time a message was handled.
+ **/
+void session_timers_touch(struct session* session, struct timer_wheel* wheel) {
+    session->idle_login = session_logging_in(session);
+    __atomic_store_n(&session->active_ms, timer_clock_ms(), __ATOMIC_RELAXED);
+    int timeout_ms = session->idle_login ? session_timeouts.login_ms : session_timeouts.idle_ms;
+    if(timeout_ms > 0) {
+        timer_arm(wheel, &session->idle_timer, timeout_ms);
+    } else {
+        timer_cancel(wheel, &session->idle_timer);
+    }
+}
+
+/**
+ * Note that a message was handled without going to the wheel, for wheels shared between threads. The idle timer
+ * keeps its deadline and session_timers_extend moves it on once it runs out. The wheel only has to be touched
+ * when the client moved between logging in and the other screens, as they have different timeouts.
+ *
+ * Returns 1 if session_timers_touch has to be called
+ **/
+int session_timers_active(struct session* session) {
+    __atomic_store_n(&session->active_ms, timer_clock_ms(), __ATOMIC_RELAXED);
+    return session_logging_in(session) != session->idle_login;
+}
+
+/**
+ * Called once the idle timer ran out. If the client was active after the timer was armed, the timer is armed
+ * again for what is left of the timeout counted from then.
+ *
+ * Returns 1 if the timer was armed again, so the client hasn't timed out
+ **/
+int session_timers_extend(struct session* session, struct timer_wheel* wheel) {
+    int timeout_ms = session->idle_login ? session_timeouts.login_ms : session_timeouts.idle_ms;
+    long remaining_ms = __atomic_load_n(&session->active_ms, __ATOMIC_RELAXED) + timeout_ms - timer_clock_ms();
+    if(timeout_ms <= 0 || remaining_ms <= 0) {
+        return 0;
+    }
+    timer_arm(wheel, &session->idle_timer, (int)remaining_ms);
+    return 1;
+}
+
+/**
+ * Disarm the session's timers. Must be called before the session is freed.
+ **/
+void session_timers_stop(struct session* session, struct timer_wheel* wheel) {
+    timer_cancel(wheel, &session->idle_timer);
+    timer_cancel(wheel, &session->max_timer);
+}
+
+/**
+ * Mark the session as timed out and count it
+ **/
+void session_timed_out(struct session* session) {
+    __atomic_store_n(&session->timed_out, 1, __ATOMIC_RELAXED);
+    session_stats_add(&session_stats_total.timeouts, 1);
+}
+
+/**
+ * Get a copy of the counters of all sessions
+ **/
+void session_stats_get(struct session_stats* stats) {
+    stats->frames = __atomic_load_n(&session_stats_total.frames, __ATOMIC_RELAXED);
+    stats->segments = __atomic_load_n(&session_stats_total.segments, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&session_stats_total.bytes, __ATOMIC_RELAXED);
+    stats->syscalls = __atomic_load_n(&session_stats_total.syscalls, __ATOMIC_RELAXED);
+    stats->frame_ns = __atomic_load_n(&session_stats_total.frame_ns, __ATOMIC_RELAXED);
+    stats->timeouts = __atomic_load_n(&session_stats_total.timeouts, __ATOMIC_RELAXED);
+    stats->sessions = __atomic_load_n(&session_stats_total.sessions, __ATOMIC_RELAXED);
+    stats->session_ms = __atomic_load_n(&session_stats_total.session_ms, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,268 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "message.h"
+#include "minesweeper.h"
+#include "screen.h"
+#include "timer.h"
+#include "auth.h"
+
+#define SESSION_TIMER_TICK_MS   100     // How long a tick of the wheels keeping the session deadlines lasts
+#define SESSION_TIMEOUT_MESSAGE "You took too long to answer. Disconnecting...\n"
+
+/**
+ * Contains the states that the game can be in when being played
+ **/
+enum game_state {
+    LOGIN_USERNAME,     // Waiting on the client to send their username
+    LOGIN_PASSWORD,     // Waiting on the client to send their password
+    LOGIN_VERIFYING,    // Waiting on the authentication stage to check the username and password
+    MAIN_MENU,
+    NEW_GAME,           // Waiting on the size of the field for a new game
+    NEW_GAME_CUSTOM,    // Waiting on the width, height and number of mines of a custom field
+    PLAYING,
+    PLAYING_REVEAL,     // Waiting on the coordinate of the tile to reveal
+    PLAYING_FLAG,       // Waiting on the coordinate of the tile to flag
+    GAMEOVER,
+    HIGHSCORE,
+    EXIT
+};
+
+/**
+ * How long a client can take before it is disconnected. Set from the server's options, 0 means no limit.
+ **/
+struct session_timeouts {
+    int login_ms;                           // To answer each of the login prompts
+    int idle_ms;                            // To make each move once logged in
+    int max_ms;                             // For the whole session
+};
+extern struct session_timeouts session_timeouts;
+
+// The seed the random number generators of the sessions' games are derived from. Set by the server.
+extern uint64_t session_random_seed;
+
+/**
+ * Where the page around the user's best game in a view started when it was last looked up. It stays right until
+ * the leaderboard changes or a game leaves the view's window, so the leaderboard is only locked to look it up again
+ * then.
+ **/
+struct highscore_around {
+    int cached;                 // Set once it has been looked up
+    int view;
+    int first_rank;             // 0 if the user hadn't won a game in the view
+    unsigned long version;      // The version of the leaderboard it was looked up in
+    long expires;               // When a game leaves the view's window (0 for never)
+};
+
+/**
+ * Everything the server knows about a single connected client. This includes the state of the game being
+ * played as well as the buffers used to talk to the client.
+ *
+ * A session can either be blocking (a worker thread from the threadpool waits on the socket) or non-blocking
+ * (the session is driven by the reactor whenever the socket becomes readable or writable). A deferred session is
+ * non-blocking but never touches the socket: the io_uring backend receives and sends for it.
+ **/
+struct session {
+    int sockfd;                             // The socket the client is communicating from
+    int nonblocking;                        // Set if the socket is non-blocking and driven by the reactor
+    int deferred;                           // Set if the session never writes to the socket itself (see session_outbox_next)
+    int protocol;                           // The protocol version used with the client, 0 until it replies to the first message
+
+    enum game_state state;                  // The screen the client is currently on
+    MinesweeperState sweeper_state;         // Holds all information about the game such as mine locations, field info, etc.
+    int highscore_view;                     // Which leaderboard is shown on the highscore screen (see leaderboard.h)
+    int highscore_page;                     // The page of the leaderboard shown on the highscore screen
+    struct highscore_around highscore_around;   // Where the page around the user's best game starts
+    char username[MESSAGE_MAX_SIZE];        // The username the client logged in with
+    char password[MESSAGE_MAX_SIZE];        // The password the client sent, kept until it has been checked
+    struct auth_request auth;               // Hands the username and password to the authentication stage
+
+    // The lines that will be sent to the client the next time the session is presented
+    struct screen screen;
+
+    // Bytes received from the client that have not been handled yet
+    char inbox[MESSAGE_MAX_SIZE];
+    int inbox_len;
+    int inbox_skip;         // How many bytes of a frame too large for the inbox are still to be thrown away
+
+    // Messages waiting to be sent to the client. Only used by non-blocking sessions as they can't wait on the client.
+    // With protocol v1 each message is stored as its message code followed by the string and a '\0', so they can
+    // be sent one at a time as the ACKs arrive. With protocol v2 the outbox holds the frames ready to be written.
+    char* outbox;
+    size_t outbox_len;                      // How many bytes of the outbox are in use
+    size_t outbox_pos;                      // Where the next message to send starts
+    size_t outbox_cap;                      // How many bytes are allocated to the outbox
+    size_t msg_sent;                        // How much of the current message has already been written to the socket
+    int awaiting_ack;                       // Set while the client hasn't acknowledged the last message sent
+
+    // Deadlines armed on the wheel of whoever drives the session
+    struct timer idle_timer;                // Runs out if the client doesn't answer the current screen in time
+    struct timer max_timer;                 // Runs out once the session has lasted too long
+    int timed_out;                          // Set once one of the timers ran out
+    long active_ms;                         // When the client was last active, by timer_clock_ms
+    int idle_login;                         // Set if the idle timer was armed with the login timeout
+    struct timespec started;                // When the client connected
+
+    struct session* next;                   // Used by the reactor to keep a list of the sessions it owns
+    struct session* prev;
+};
+
+/**
+ * Prepare a session for a client that just connected
+ **/
+void session_init(struct session* session, int sockfd, int nonblocking);
+
+/**
+ * Deallocate the memory assigned to the session's buffers. Does not close the socket.
+ **/
+void session_free(struct session* session);
+
+/**
+ * Add a constant line to the screen that will be sent to the client. The string is not copied.
+ **/
+void session_puts(struct session* session, char msg_code, const char* msg);
+
+/**
+ * Add a formatted line to the screen that will be sent to the client
+ **/
+void session_printf(struct session* session, char msg_code, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+/**
+ * Send every line on the session's screen to the client and clear the screen.
+ *
+ * With protocol v2 the whole screen is written with a single writev(). With protocol v1 each line is still
+ * sent on its own and acknowledged by the client. Blocking sessions wait until everything is sent, while
+ * non-blocking sessions keep whatever the socket couldn't take in the outbox for session_flush.
+ *
+ * Returns -1 if the client can't be reached.
+ **/
+int session_present(struct session* session);
+
+/**
+ * Write as many messages from the outbox as the socket (and the client's ACKs) allow without blocking.
+ *
+ * Returns -1 if the client can't be reached.
+ **/
+int session_flush(struct session* session);
+
+/**
+ * Get the bytes of the outbox that can be sent now. With protocol v1 that is the rest of the current message,
+ * but only once the previous one has been acknowledged. With protocol v2 it is everything in the outbox.
+ *
+ * Used instead of session_flush by the owners of deferred sessions, which do the writing themselves.
+ *
+ * Returns how many bytes can be sent, 0 if there is nothing to send at the moment
+ **/
+size_t session_outbox_next(struct session* session, char** data);
+
+/**
+ * Removes sent bytes from the front of what session_outbox_next returned
+ **/
+void session_outbox_sent(struct session* session, size_t sent);
+
+/**
+ * Read all of the bytes waiting at a non-blocking socket into the inbox.
+ *
+ * Return   >0  Bytes were read and there may be more waiting
+ *          0   There is nothing left to read at the moment
+ *          -1  The client has disconnected
+ **/
+int session_fill(struct session* session);
+
+/**
+ * Copy bytes that were received from the client by someone else into the inbox.
+ *
+ * Returns how many bytes fit in the inbox. The rest should be fed again once messages have been removed.
+ **/
+int session_feed(struct session* session, const char* data, int size);
+
+/**
+ * Remove the next complete message (other than an ACK) sent by the client from the inbox and place it in buffer.
+ * ACKs met along the way are consumed.
+ *
+ * Returns the size of the message, 0 if there is no complete message yet or -1 if the client broke the protocol.
+ **/
+int session_next_message(struct session* session, char* buffer, int buffer_size);
+
+/**
+ * Waits until the client of a blocking session sends a message and places it in buffer.
+ *
+ * Returns the size of the message or -1 if the client has disconnected.
+ **/
+int session_receive(struct session* session, char* buffer, int buffer_size);
+
+/**
+ * Waits for the client of a blocking session to reply to a message that was sent to it before the session
+ * started (eg. while it was waiting for a worker). As with any first message, the reply chooses the protocol.
+ *
+ * Returns -1 if the client has disconnected.
+ **/
+int session_wait_reply(struct session* session);
+
+/**
+ * Returns 1 once the session has exited and everything has been sent to the client
+ **/
+int session_finished(struct session* session);
+
+/**
+ * Arm the session's timers on the wheel. expire is called with the session as the timer's data once the client
+ * has taken too long.
+ **/
+void session_timers_start(struct session* session, struct timer_wheel* wheel, void (*expire)(struct timer* timer, void* arg));
+
+/**
+ * Give the client a fresh deadline to answer the screen it is on. Called every time a message was handled.
+ **/
+void session_timers_touch(struct session* session, struct timer_wheel* wheel);
+
+/**
+ * Note that a message was handled without going to the wheel, for wheels shared between threads. The idle timer
+ * keeps its deadline and session_timers_extend moves it on once it runs out. The wheel only has to be touched
+ * when the client moved between logging in and the other screens, as they have different timeouts.
+ *
+ * Returns 1 if session_timers_touch has to be called
+ **/
+int session_timers_active(struct session* session);
+
+/**
+ * Called once the idle timer ran out. If the client was active after the timer was armed, the timer is armed
+ * again for what is left of the timeout counted from then.
+ *
+ * Returns 1 if the timer was armed again, so the client hasn't timed out
+ **/
+int session_timers_extend(struct session* session, struct timer_wheel* wheel);
+
+/**
+ * Disarm the session's timers. Must be called before the session is freed.
+ **/
+void session_timers_stop(struct session* session, struct timer_wheel* wheel);
+
+/**
+ * Mark the session as timed out and count it
+ **/
+void session_timed_out(struct session* session);
+
+/**
+ * Counters that measure the cost of sending screens to the clients, summed over all sessions
+ **/
+struct session_stats {
+    unsigned long frames;           // How many screens were presented
+    unsigned long segments;         // How many lines were in those screens
+    unsigned long bytes;            // How many bytes were sent
+    unsigned long syscalls;         // How many system calls were used to send them
+    unsigned long frame_ns;         // The total time from the first line being added to the screen being sent
+    unsigned long timeouts;         // How many sessions were disconnected for taking too long
+    unsigned long sessions;         // How many sessions have ended
+    unsigned long session_ms;       // How long those sessions lasted in total
+};
+
+/**
+ * Get a copy of the counters of all sessions
+ **/
+void session_stats_get(struct session_stats* stats);
+
+#endif // SESSION_H
@@ -0,0 +1,392 @@
+#define _GNU_SOURCE // Required to pin threads to a core
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+// Threads
+#include <pthread.h>
+
+#include "ring.h"
+#include "threadpool.h"
+
+/**
+ * Get the current time in microseconds. Only the lower 32 bits are kept, which is enough to measure
+ * waits of up to an hour.
+ **/
+unsigned int threadpool_now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned int)((now.tv_sec * 1000000UL) + (now.tv_nsec / 1000));
+}
+
+/**
+ * Adds value to one of the pool's counters
+ **/
+void threadpool_stats_add(unsigned long* counter, unsigned long value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Raise one of the pool's counters to value if it is lower
+ **/
+void threadpool_stats_max(unsigned long* counter, unsigned long value) {
+    unsigned long current = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    while(value > current &&
+          !__atomic_compare_exchange_n(counter, &current, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * Same as threadpool_stats_max but for the counters that are ints
+ **/
+void threadpool_stats_max_int(int* counter, int value) {
+    int current = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    while(value > current &&
+          !__atomic_compare_exchange_n(counter, &current, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * Puts the socket of a client and the time it was queued at into a single value that can be stored in a ring
+ **/
+long threadpool_task(int client_sockfd) {
+    return (long)(((unsigned long)threadpool_now_us() << 32) | (unsigned int)client_sockfd);
+}
+
+/**
+ * Records that a client was taken off one of the queues and how long it waited.
+ *
+ * Returns the socket of the client
+ **/
+int threadpool_task_taken(struct threadpool* pool, long task, int stolen) {
+    unsigned int queued_at = (unsigned long)task >> 32;
+    unsigned int waited_us = threadpool_now_us() - queued_at;
+
+    __atomic_sub_fetch(&pool->stats.queued, 1, __ATOMIC_RELAXED);
+    threadpool_stats_add(&pool->stats.clients, 1);
+    threadpool_stats_add(&pool->stats.wait_us, waited_us);
+    threadpool_stats_max(&pool->stats.max_wait_us, waited_us);
+    if(stolen) {
+        threadpool_stats_add(&pool->stats.steals, 1);
+    }
+
+    return (int)(task & 0xFFFFFFFF);
+}
+
+/**
+ * Take the next client for a worker. Its own queue is tried first, then the shared queue and finally the
+ * queues of the other workers.
+ *
+ * Returns 1 if a client was taken
+ **/
+int threadpool_take(struct threadpool* pool, struct threadpool_worker* worker, int* client_sockfd) {
+    long task;
+    if(ring_pop(&worker->local, &task) || ring_pop(&pool->shared, &task)) {
+        *client_sockfd = threadpool_task_taken(pool, task, 0);
+        return 1;
+    }
+
+    // Steal from the other workers, starting with the next one so the same worker isn't always robbed first
+    for(int i = 1; i < pool->max_threads; i++) {
+        struct threadpool_worker* victim = &pool->workers[(worker->index + i) % pool->max_threads];
+        if(ring_pop(&victim->local, &task)) {
+            *client_sockfd = threadpool_task_taken(pool, task, 1);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Stop the thread of a worker that has been idle for too long, unless the pool is at its minimum size.
+ *
+ * Returns 1 if the thread should exit
+ **/
+int threadpool_shrink(struct threadpool* pool, struct threadpool_worker* worker) {
+    int shrink = 0;
+
+    pthread_mutex_lock(&pool->resize_mutex);
+    if(!pool->closed && (pool->stats.num_threads > pool->min_threads)) {
+        // Anything still queued on this worker will be taken by the others
+        __atomic_store_n(&worker->alive, 0, __ATOMIC_SEQ_CST);
+        __atomic_sub_fetch(&pool->stats.num_threads, 1, __ATOMIC_RELAXED);
+        threadpool_stats_add(&pool->stats.stopped, 1);
+        shrink = 1;
+    }
+    pthread_mutex_unlock(&pool->resize_mutex);
+
+    return shrink;
+}
+
+/**
+ * Handles clients until the pool is stopped or the thread has been idle for longer than the idle timeout
+ **/
+void threadpool_worker_run(struct threadpool_worker* worker) {
+    struct threadpool* pool = worker->pool;
+
+    while(1) {
+        int client_sockfd;
+        if(threadpool_take(pool, worker, &client_sockfd)) {
+            pool->handle_client(client_sockfd, pool->arg);
+            continue;
+        }
+
+        // Let the pool know this worker is idle, then look again in case a client was added in between.
+        // Reading the futex first means a client added after that point stops the wait from sleeping.
+        unsigned int futex = __atomic_load_n(&pool->futex, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&worker->idle, 1, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&pool->num_idle, 1, __ATOMIC_SEQ_CST);
+
+        int found = threadpool_take(pool, worker, &client_sockfd);
+        if(!found && !__atomic_load_n(&pool->closed, __ATOMIC_SEQ_CST)) {
+            ring_futex_wait(&pool->futex, futex, pool->idle_timeout_ms);
+        }
+
+        __atomic_sub_fetch(&pool->num_idle, 1, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&worker->idle, 0, __ATOMIC_SEQ_CST);
+
+        if(found) {
+            pool->handle_client(client_sockfd, pool->arg);
+        } else if(__atomic_load_n(&pool->closed, __ATOMIC_SEQ_CST)) {
+            break;
+        } else if(__atomic_load_n(&pool->futex, __ATOMIC_SEQ_CST) == futex && threadpool_shrink(pool, worker)) {
+            // Nothing was added before the idle timeout ran out
+            return;
+        }
+    }
+
+    // The pool is stopping. Mark the slot while holding the resize mutex so the thread isn't cancelled after it exits.
+    pthread_mutex_lock(&pool->resize_mutex);
+    __atomic_store_n(&worker->alive, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->resize_mutex);
+}
+
+/**
+ * Lets the pool know a thread has exited, either on its own or by being cancelled. It is the last thing the thread
+ * does with the pool.
+ **/
+void threadpool_worker_exit(void* arg) {
+    struct threadpool* pool = arg;
+    __atomic_sub_fetch(&pool->num_running, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * The main function that each thread from the pool runs
+ **/
+void* threadpool_worker_loop(void* arg) {
+    struct threadpool_worker* worker = arg;
+    pthread_cleanup_push(threadpool_worker_exit, worker->pool);
+    threadpool_worker_run(worker);
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+/**
+ * Start another thread in the pool if it hasn't reached its maximum size
+ **/
+void threadpool_grow(struct threadpool* pool) {
+    pthread_mutex_lock(&pool->resize_mutex);
+
+    if(!pool->closed && (pool->stats.num_threads < pool->max_threads)) {
+        // Find a slot that doesn't have a thread running in it
+        for(int i = 0; i < pool->max_threads; i++) {
+            struct threadpool_worker* worker = &pool->workers[i];
+            if(worker->alive) {
+                continue;
+            }
+
+            // The threads are detached as they stop on their own when idle
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            if(pool->cpu >= 0) {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(pool->cpu, &cpus);
+                pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+            }
+            // Counted before it starts so it can't exit before being counted
+            __atomic_store_n(&worker->alive, 1, __ATOMIC_SEQ_CST);
+            __atomic_add_fetch(&pool->num_running, 1, __ATOMIC_SEQ_CST);
+            if(pthread_create(&worker->thread, &attr, threadpool_worker_loop, worker) != 0) {
+                perror("Error starting a thread in the threadpool");
+                __atomic_store_n(&worker->alive, 0, __ATOMIC_SEQ_CST);
+                __atomic_sub_fetch(&pool->num_running, 1, __ATOMIC_SEQ_CST);
+            } else {
+                int num_threads = __atomic_add_fetch(&pool->stats.num_threads, 1, __ATOMIC_RELAXED);
+                threadpool_stats_max_int(&pool->stats.peak_threads, num_threads);
+                threadpool_stats_add(&pool->stats.started, 1);
+            }
+            pthread_attr_destroy(&attr);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->resize_mutex);
+}
+
+/**
+ * Start a pool with min_threads threads that can grow to max_threads. Each client added to the pool is passed
+ * to handle_client by one of the threads, along with arg. shared_capacity is how many clients can wait on top of
+ * the ones queued on each worker. If cpu isn't -1, the threads only run on that core.
+ **/
+void threadpool_init(struct threadpool* pool, int min_threads, int max_threads, int idle_timeout_ms,
+                     int shared_capacity, int cpu, void (*handle_client)(int client_sockfd, void* arg), void* arg) {
+    memset(pool, 0, sizeof(struct threadpool));
+    pool->min_threads = min_threads;
+    pool->max_threads = max_threads;
+    pool->idle_timeout_ms = idle_timeout_ms;
+    pool->cpu = cpu;
+    pool->handle_client = handle_client;
+    pool->arg = arg;
+    pthread_mutex_init(&pool->resize_mutex, NULL);
+
+    pool->workers = calloc(max_threads, sizeof(struct threadpool_worker));
+    if(!pool->workers) {
+        perror("Error creating the threadpool: out of memory");
+        exit(1);
+    }
+    for(int i = 0; i < max_threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        ring_init(&pool->workers[i].local, THREADPOOL_LOCAL_CAPACITY);
+    }
+    ring_init(&pool->shared, shared_capacity);
+
+    for(int i = 0; i < min_threads; i++) {
+        threadpool_grow(pool);
+    }
+}
+
+/**
+ * Queue a client to be handled by one of the threads. Starts another thread if the pool is backed up.
+ * Never blocks.
+ *
+ * Returns how many clients are waiting for a thread, or 0 if the queues are full and the client was not added
+ **/
+int threadpool_add(struct threadpool* pool, int client_sockfd) {
+    long task = threadpool_task(client_sockfd);
+
+    // Give the client to an idle worker if there is one, otherwise spread the clients across the busy workers
+    struct threadpool_worker* target = NULL;
+    for(int i = 0; i < pool->max_threads && target == NULL; i++) {
+        struct threadpool_worker* worker = &pool->workers[i];
+        if(__atomic_load_n(&worker->alive, __ATOMIC_RELAXED) && __atomic_load_n(&worker->idle, __ATOMIC_RELAXED)) {
+            target = worker;
+        }
+    }
+    for(int i = 0; i < pool->max_threads && target == NULL; i++) {
+        struct threadpool_worker* worker = &pool->workers[pool->next_worker++ % pool->max_threads];
+        if(__atomic_load_n(&worker->alive, __ATOMIC_RELAXED)) {
+            target = worker;
+        }
+    }
+
+    // Count the client before it can be taken so the count never goes below 0
+    int queued = __atomic_add_fetch(&pool->stats.queued, 1, __ATOMIC_RELAXED);
+    if(!(target != NULL && ring_push(&target->local, task)) && !ring_push(&pool->shared, task)) {
+        __atomic_sub_fetch(&pool->stats.queued, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    threadpool_stats_max_int(&pool->stats.queued_high_water, queued);
+
+    // Wake an idle worker up. Any of them will do as they take clients from each other.
+    __atomic_add_fetch(&pool->futex, 1, __ATOMIC_SEQ_CST);
+    int num_idle = __atomic_load_n(&pool->num_idle, __ATOMIC_SEQ_CST);
+    if(num_idle > 0) {
+        ring_futex_wake(&pool->futex, 1);
+    }
+
+    // More clients are waiting than there are idle threads to take them
+    if(queued > num_idle) {
+        threadpool_grow(pool);
+    }
+
+    return queued;
+}
+
+/**
+ * Get the place a client added now would have in line: the clients already waiting, plus this one, minus the
+ * ones the idle threads and the threads that can still be started will take straight away.
+ *
+ * Returns 0 if a client added now would be taken straight away
+ **/
+int threadpool_wait_position(struct threadpool* pool) {
+    int queued = __atomic_load_n(&pool->stats.queued, __ATOMIC_RELAXED);
+    int num_idle = __atomic_load_n(&pool->num_idle, __ATOMIC_RELAXED);
+    int num_threads = __atomic_load_n(&pool->stats.num_threads, __ATOMIC_RELAXED);
+
+    int position = queued + 1 - num_idle - (pool->max_threads - num_threads);
+    return (position > 0) ? position : 0;
+}
+
+/**
+ * Stop the pool. Idle threads exit and the threads handling a client are cancelled. Returns once every thread
+ * has exited, so the pool can be freed. The clients that are still queued can be taken with threadpool_pop_queued.
+ **/
+void threadpool_stop(struct threadpool* pool) {
+    pthread_mutex_lock(&pool->resize_mutex);
+
+    __atomic_store_n(&pool->closed, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&pool->futex, 1, __ATOMIC_SEQ_CST);
+    ring_futex_wake(&pool->futex, __INT_MAX__);
+
+    for(int i = 0; i < pool->max_threads; i++) {
+        if(pool->workers[i].alive) {
+            pthread_cancel(pool->workers[i].thread);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->resize_mutex);
+
+    // The threads are detached, so they can't be joined. They only take as long as their cancellation handlers.
+    while(__atomic_load_n(&pool->num_running, __ATOMIC_SEQ_CST) > 0) {
+        sched_yield();
+    }
+}
+
+/**
+ * Take a client that is still queued once the pool has been stopped.
+ *
+ * Returns 1 if a client was taken
+ **/
+int threadpool_pop_queued(struct threadpool* pool, int* client_sockfd) {
+    long task;
+    int found = ring_pop(&pool->shared, &task);
+    for(int i = 0; i < pool->max_threads && !found; i++) {
+        found = ring_pop(&pool->workers[i].local, &task);
+    }
+
+    if(found) {
+        *client_sockfd = (int)(task & 0xFFFFFFFF);
+    }
+    return found;
+}
+
+/**
+ * Deallocate the memory assigned to the pool
+ **/
+void threadpool_free(struct threadpool* pool) {
+    for(int i = 0; i < pool->max_threads; i++) {
+        ring_free(&pool->workers[i].local);
+    }
+    ring_free(&pool->shared);
+    free(pool->workers);
+    pool->workers = NULL;
+}
+
+/**
+ * Get a copy of the pool's counters
+ **/
+void threadpool_stats_get(struct threadpool* pool, struct threadpool_stats* stats) {
+    stats->num_threads = __atomic_load_n(&pool->stats.num_threads, __ATOMIC_RELAXED);
+    stats->peak_threads = __atomic_load_n(&pool->stats.peak_threads, __ATOMIC_RELAXED);
+    stats->started = __atomic_load_n(&pool->stats.started, __ATOMIC_RELAXED);
+    stats->stopped = __atomic_load_n(&pool->stats.stopped, __ATOMIC_RELAXED);
+    stats->queued = __atomic_load_n(&pool->stats.queued, __ATOMIC_RELAXED);
+    stats->queued_high_water = __atomic_load_n(&pool->stats.queued_high_water, __ATOMIC_RELAXED);
+    stats->clients = __atomic_load_n(&pool->stats.clients, __ATOMIC_RELAXED);
+    stats->steals = __atomic_load_n(&pool->stats.steals, __ATOMIC_RELAXED);
+    stats->wait_us = __atomic_load_n(&pool->stats.wait_us, __ATOMIC_RELAXED);
+    stats->max_wait_us = __atomic_load_n(&pool->stats.max_wait_us, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,120 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+
+#include "ring.h"
+
+/**
+ * An elastic pool of worker threads that each handle one client at a time for the client's whole session.
+ *
+ * The pool starts with its minimum number of threads and starts more, up to its maximum, whenever clients are
+ * waiting and no thread is idle. Threads that stay idle for longer than the idle timeout stop, as long as the
+ * pool keeps its minimum.
+ *
+ * Every worker has its own queue of clients. A client is handed to an idle worker if there is one, otherwise
+ * it is queued on one of the busy workers (or on the shared queue if that worker's queue is full). A worker
+ * that runs out of clients takes them from the other workers' queues, so no client waits while a thread is idle.
+ **/
+
+#define THREADPOOL_LOCAL_CAPACITY   16      // How many clients can be queued on a single worker
+
+/**
+ * A slot for a worker thread. Slots are kept when their thread stops so the clients queued on it can be taken
+ * by the other workers and so the slot can be reused when the pool grows again.
+ **/
+struct threadpool_worker {
+    pthread_t thread;
+    struct threadpool* pool;
+    int index;
+    struct ring local;          // Clients queued on this worker
+    int alive;                  // Set while a thread is running in this slot. Protected by the pool's resize mutex
+    int idle;                   // Set while the thread is waiting for a client
+};
+
+/**
+ * Counters that show how the pool is coping with its clients
+ **/
+struct threadpool_stats {
+    int num_threads;            // How many threads are running
+    int peak_threads;           // The most threads that were running at once
+    unsigned long started;      // How many threads were started
+    unsigned long stopped;      // How many threads stopped after being idle
+    int queued;                 // How many clients are waiting for a thread
+    int queued_high_water;      // The most clients that have waited at once
+    unsigned long clients;      // How many clients were taken off the queues
+    unsigned long steals;       // How many clients were taken from another worker's queue
+    unsigned long wait_us;      // The total time clients waited in the queues
+    unsigned long max_wait_us;  // The longest a client waited in the queues
+};
+
+struct threadpool {
+    int min_threads;
+    int max_threads;
+    int idle_timeout_ms;
+    int cpu;                                    // The core the threads are pinned to, or -1 if they can run on any core
+    void (*handle_client)(int client_sockfd, void* arg);    // Called by a worker for each client it takes
+    void* arg;                                  // Passed to handle_client along with the client
+
+    struct threadpool_worker* workers;          // max_threads slots
+    struct ring shared;                         // Clients that didn't fit in the queue of the worker they were given to
+    unsigned int next_worker;                   // The worker the next client is queued on when none are idle
+
+    pthread_mutex_t resize_mutex;               // Held while threads are started or stopped
+    int closed;                                 // Set when the workers should stop
+    int num_running;                            // How many threads haven't exited yet, whether alive or cancelled
+
+    unsigned int futex;                         // Changes every time a client is added, so idle workers can sleep on it
+    int num_idle;                               // How many workers are waiting for a client
+
+    struct threadpool_stats stats;
+};
+
+/**
+ * Start a pool with min_threads threads that can grow to max_threads. Each client added to the pool is passed
+ * to handle_client by one of the threads, along with arg. shared_capacity is how many clients can wait on top of
+ * the ones queued on each worker. If cpu isn't -1, the threads only run on that core.
+ **/
+void threadpool_init(struct threadpool* pool, int min_threads, int max_threads, int idle_timeout_ms,
+                     int shared_capacity, int cpu, void (*handle_client)(int client_sockfd, void* arg), void* arg);
+
+/**
+ * Queue a client to be handled by one of the threads. Starts another thread if the pool is backed up.
+ * Never blocks.
+ *
+ * Returns how many clients are waiting for a thread, or 0 if the queues are full and the client was not added
+ **/
+int threadpool_add(struct threadpool* pool, int client_sockfd);
+
+/**
+ * Get the place a client added now would have in line: the clients already waiting, plus this one, minus the
+ * ones the idle threads and the threads that can still be started will take straight away.
+ *
+ * Returns 0 if a client added now would be taken straight away
+ **/
+int threadpool_wait_position(struct threadpool* pool);
+
+/**
+ * Stop the pool. Idle threads exit and the threads handling a client are cancelled. Returns once every thread
+ * has exited, so the pool can be freed. The clients that are still queued can be taken with threadpool_pop_queued.
+ **/
+void threadpool_stop(struct threadpool* pool);
+
+/**
+ * Take a client that is still queued once the pool has been stopped.
+ *
+ * Returns 1 if a client was taken
+ **/
+int threadpool_pop_queued(struct threadpool* pool, int* client_sockfd);
+
+/**
+ * Deallocate the memory assigned to the pool
+ **/
+void threadpool_free(struct threadpool* pool);
+
+/**
+ * Get a copy of the pool's counters
+ **/
+void threadpool_stats_get(struct threadpool* pool, struct threadpool_stats* stats);
+
+#endif // THREADPOOL_H
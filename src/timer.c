@@ -0,0 +1,175 @@
+#include <string.h>
+#include <time.h>
+
+#include "timer.h"
+
+#define TIMER_SLOT_MASK     (TIMER_SLOTS - 1)
+#define TIMER_MAX_TICKS     ((1UL << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)   // The furthest a timer can be armed
+
+/**
+ * Returns the time in milliseconds from a clock that never jumps
+ **/
+long timer_clock_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+
+/**
+ * Returns the tick the wheel is at according to the clock, which can be ahead of the last tick handled
+ **/
+unsigned long timer_wheel_clock(struct timer_wheel* wheel) {
+    return (unsigned long)(timer_clock_ms() - wheel->start_ms) / wheel->tick_ms;
+}
+
+/**
+ * Link the timer into the slot matching its deadline. Timers due within TIMER_SLOTS ticks go in the first
+ * level, which has a slot per tick, and the rest go in the level whose slots are just wide enough.
+ **/
+void timer_place(struct timer_wheel* wheel, struct timer* timer) {
+    unsigned long delta = timer->expires - wheel->now;
+    int level = 0;
+    while(level < TIMER_LEVELS - 1 && delta >= (1UL << ((level + 1) * TIMER_SLOT_BITS))) {
+        level++;
+    }
+
+    struct timer** slot = &wheel->slots[level][(timer->expires >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK];
+    timer->next = *slot;
+    if(*slot != NULL) {
+        (*slot)->pprev = &timer->next;
+    }
+    *slot = timer;
+    timer->pprev = slot;
+}
+
+/**
+ * Unlink the timer from whichever slot it is in
+ **/
+void timer_unlink(struct timer* timer) {
+    *timer->pprev = timer->next;
+    if(timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * Move every timer in a slot of a coarser level down to the level that matches how close it now is
+ **/
+void timer_cascade(struct timer_wheel* wheel, int level, int index) {
+    struct timer* timer = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+
+    while(timer != NULL) {
+        struct timer* next = timer->next;
+        timer_place(wheel, timer);
+        timer = next;
+    }
+}
+
+/**
+ * Prepare an empty wheel whose ticks last tick_ms milliseconds
+ **/
+void timer_wheel_init(struct timer_wheel* wheel, int tick_ms) {
+    memset(wheel, 0, sizeof(struct timer_wheel));
+    wheel->tick_ms = (tick_ms > 0) ? tick_ms : 1;
+    wheel->start_ms = timer_clock_ms();
+}
+
+/**
+ * Prepare a timer that calls expire once it is due. The timer starts out disarmed.
+ **/
+void timer_init(struct timer* timer, void (*expire)(struct timer* timer, void* arg), void* data) {
+    timer->expires = 0;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expire = expire;
+    timer->data = data;
+}
+
+/**
+ * Arm the timer to expire in timeout_ms milliseconds (rounded up to the next tick). If the timer was already
+ * armed its old deadline is forgotten.
+ **/
+void timer_arm(struct timer_wheel* wheel, struct timer* timer, int timeout_ms) {
+    timer_cancel(wheel, timer);
+
+    // Count from the clock rather than the last tick handled, so a wheel that is behind doesn't fire early
+    unsigned long ticks = ((unsigned long)(timeout_ms > 0 ? timeout_ms : 0) + wheel->tick_ms - 1) / wheel->tick_ms;
+    ticks += timer_wheel_clock(wheel) - wheel->now;
+    if(ticks < 1) {
+        ticks = 1;
+    }
+    if(ticks > TIMER_MAX_TICKS) {
+        ticks = TIMER_MAX_TICKS;
+    }
+
+    timer->expires = wheel->now + ticks;
+    timer_place(wheel, timer);
+    wheel->num_timers++;
+}
+
+/**
+ * Disarm the timer. Does nothing if it isn't armed.
+ **/
+void timer_cancel(struct timer_wheel* wheel, struct timer* timer) {
+    if(timer->pprev != NULL) {
+        timer_unlink(timer);
+        wheel->num_timers--;
+    }
+}
+
+/**
+ * Returns 1 if the timer is armed
+ **/
+int timer_armed(struct timer* timer) {
+    return timer->pprev != NULL;
+}
+
+/**
+ * Handle every tick that has passed since the last call, calling the expire function of the timers that are
+ * due with arg. A timer is disarmed before its expire function is called, so the function can arm it again.
+ *
+ * Returns how many timers expired
+ **/
+int timer_wheel_advance(struct timer_wheel* wheel, void* arg) {
+    unsigned long target = timer_wheel_clock(wheel);
+    int expired = 0;
+
+    while(wheel->now < target) {
+        if(wheel->num_timers == 0) {
+            // Nothing can expire, so skip straight to the current tick
+            wheel->now = target;
+            break;
+        }
+        wheel->now++;
+
+        // Each time a level wraps around, the next slot of the level above it is due to be moved down
+        for(int level = 1; level < TIMER_LEVELS; level++) {
+            if(((wheel->now >> ((level - 1) * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK) != 0) {
+                break;
+            }
+            timer_cascade(wheel, level, (wheel->now >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK);
+        }
+
+        // Every timer left in the current slot of the first level is due now
+        struct timer** slot = &wheel->slots[0][wheel->now & TIMER_SLOT_MASK];
+        while(*slot != NULL) {
+            struct timer* timer = *slot;
+            timer_unlink(timer);
+            wheel->num_timers--;
+            expired++;
+            timer->expire(timer, arg);
+        }
+    }
+
+    return expired;
+}
+
+/**
+ * Get how many timers are armed
+ **/
+int timer_wheel_size(struct timer_wheel* wheel) {
+    return wheel->num_timers;
+}
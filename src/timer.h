@@ -0,0 +1,85 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+/**
+ * A hierarchical timer wheel that keeps track of many deadlines (eg. one per session) cheaply.
+ *
+ * Time is counted in ticks. The wheel has TIMER_LEVELS levels of TIMER_SLOTS slots each: a timer due within
+ * TIMER_SLOTS ticks goes straight into the slot of the tick it is due at, while timers further away go into
+ * the coarser levels and are moved down as their time gets closer. Arming and cancelling a timer is O(1) no
+ * matter how many timers are armed, and each tick only looks at the timers that are due.
+ *
+ * A wheel is not thread safe. Its owner either only uses it from one thread or protects it with a lock.
+ **/
+
+#define TIMER_SLOT_BITS     6
+#define TIMER_SLOTS         (1 << TIMER_SLOT_BITS)  // How many slots each level of the wheel has
+#define TIMER_LEVELS        4                       // With 100 ms ticks the wheel covers about 19 days
+
+struct timer_wheel;
+
+/**
+ * A deadline that can be armed on a wheel. Timers are linked into the slots of the wheel, so arming one never
+ * allocates.
+ **/
+struct timer {
+    unsigned long expires;                          // The tick the timer is due at
+    struct timer* next;                             // The next timer in the same slot
+    struct timer** pprev;                           // Whatever points to this timer, NULL if the timer isn't armed
+    void (*expire)(struct timer* timer, void* arg); // Called once the timer is due, with the arg given to the wheel
+    void* data;                                     // Whatever the timer belongs to
+};
+
+struct timer_wheel {
+    int tick_ms;                                    // How long a tick lasts
+    long start_ms;                                  // When tick 0 was
+    unsigned long now;                              // The last tick that was handled
+    int num_timers;                                 // How many timers are armed
+    struct timer* slots[TIMER_LEVELS][TIMER_SLOTS];
+};
+
+/**
+ * Returns the time in milliseconds from a clock that never jumps, the one the wheels count their ticks on
+ **/
+long timer_clock_ms();
+
+/**
+ * Prepare an empty wheel whose ticks last tick_ms milliseconds
+ **/
+void timer_wheel_init(struct timer_wheel* wheel, int tick_ms);
+
+/**
+ * Prepare a timer that calls expire once it is due. The timer starts out disarmed.
+ **/
+void timer_init(struct timer* timer, void (*expire)(struct timer* timer, void* arg), void* data);
+
+/**
+ * Arm the timer to expire in timeout_ms milliseconds (rounded up to the next tick). If the timer was already
+ * armed its old deadline is forgotten.
+ **/
+void timer_arm(struct timer_wheel* wheel, struct timer* timer, int timeout_ms);
+
+/**
+ * Disarm the timer. Does nothing if it isn't armed.
+ **/
+void timer_cancel(struct timer_wheel* wheel, struct timer* timer);
+
+/**
+ * Returns 1 if the timer is armed
+ **/
+int timer_armed(struct timer* timer);
+
+/**
+ * Handle every tick that has passed since the last call, calling the expire function of the timers that are
+ * due with arg. A timer is disarmed before its expire function is called, so the function can arm it again.
+ *
+ * Returns how many timers expired
+ **/
+int timer_wheel_advance(struct timer_wheel* wheel, void* arg);
+
+/**
+ * Get how many timers are armed
+ **/
+int timer_wheel_size(struct timer_wheel* wheel);
+
+#endif // TIMER_H
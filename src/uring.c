@@ -0,0 +1,928 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+// Threads
+#include <pthread.h>
+// Sockets
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+// io_uring
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "message.h"
+#include "session.h"
+#include "game.h"
+#include "timer.h"
+#include "auth.h"
+#include "uring.h"
+
+#define URING_ENTRIES           1024    // How many requests can be waiting to be submitted by a loop
+#define URING_BUFFERS           512     // How many receive buffers each loop provides to the kernel (a power of 2)
+#define URING_BUFFER_SIZE       2048    // The size of each receive buffer
+#define URING_BUFFER_GROUP      0       // The id the receive buffers are registered under
+#define URING_HELD_MAX          65536   // How many bytes a client can send while its login is being checked
+
+// What a completion is for. Stored in the low bits of the user data, the rest is the session it belongs to.
+#define URING_OP_WAKE           0       // The eventfd was written to
+#define URING_OP_RECV           1
+#define URING_OP_SEND           2
+#define URING_OP_TICK           3       // The loop's timeout for the next tick of its wheel
+#define URING_OP_MASK           3
+
+/**
+ * A session owned by a loop, along with the requests the loop has submitted for it
+ **/
+struct uring_session {
+    struct session session;
+    char* send_buffer;                  // The bytes being sent, which must stay put until the send completes
+    size_t send_cap;                    // How many bytes are allocated to the send buffer
+    int sending;                        // Set while a send is submitted
+    int receiving;                      // Set while the multishot receive is submitted
+    int closing;                        // Set once the socket was shut down and the session waits for its requests to end
+    int dirty;                          // Set while the session is on the loop's dirty list
+    char* held;                         // What the client sent while its login was being checked that wasn't handled
+    int held_size;
+
+    struct uring_session* dirty_next;   // The next session that may have something to send
+    struct uring_session* next;         // The list of sessions owned by the loop
+    struct uring_session* prev;
+};
+
+/**
+ * A single loop thread along with its io_uring instance and the sessions it owns
+ **/
+struct uring_loop {
+    pthread_t thread;
+    int fd;                             // The io_uring instance
+
+    // Submission queue, shared with the kernel
+    void* sq_ring;
+    size_t sq_ring_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned sq_local_tail;             // Where the next request is written. Only shown to the kernel when submitting
+    unsigned to_submit;                 // How many requests were written since the last submit
+
+    // Completion queue, shared with the kernel
+    void* cq_ring;
+    size_t cq_ring_size;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // Buffers the kernel picks from when data is received
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    char* buffers;
+    unsigned short buf_tail;
+
+    int eventfd;                        // Wakes the loop up when a client is handed to it or the server is stopping
+    uint64_t eventfd_value;             // Where the read of the eventfd is placed
+
+    int num_sessions;                   // How many sessions are owned by this loop
+    pthread_mutex_t incoming_mutex;     // Protects the incoming list
+    struct uring_session* incoming;     // Sessions handed over by the acceptor that haven't been registered yet
+    struct auth_request* verified;      // Logins the authentication stage has checked. Protected by the incoming mutex
+    struct uring_session* sessions;     // HEAD of the list of sessions owned by this loop
+    struct uring_session* dirty;        // HEAD of the list of sessions to check for something to send
+
+    struct timer_wheel wheel;           // The deadlines of the sessions owned by this loop
+    struct __kernel_timespec tick;      // How long the tick timeout waits
+    int ticking;                        // Set while the tick timeout is submitted
+
+    struct uring_stats stats;
+};
+
+struct uring_loop* uring_loops = NULL;  // The loop threads
+int uring_loops_size = 0;               // How many loop threads were started
+unsigned int uring_next = 0;            // The loop the next client will be handed to
+int uring_keep_alive = 1;               // Cleared when the loop threads should stop
+struct uring_stats uring_stopped_stats; // The counters of the loops that were stopped
+
+/* ==== RINGS ==== */
+
+/**
+ * Give the waiting requests to the kernel and, if wait is set, sleep until at least one of them has completed
+ *
+ * Returns -1 if io_uring_enter failed
+ **/
+int uring_enter(struct uring_loop* loop, int wait) {
+    __atomic_store_n(loop->sq_tail, loop->sq_local_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    int result = syscall(__NR_io_uring_enter, loop->fd, loop->to_submit, wait ? 1 : 0, flags, NULL, 0);
+    __atomic_add_fetch(&loop->stats.enters, 1, __ATOMIC_RELAXED);
+    if(result < 0) {
+        return -1;
+    }
+
+    __atomic_add_fetch(&loop->stats.submitted, result, __ATOMIC_RELAXED);
+    loop->to_submit -= result;
+    return 0;
+}
+
+/**
+ * Get a free request in the submission queue. Submits the waiting requests first if the queue is full.
+ **/
+struct io_uring_sqe* uring_get_sqe(struct uring_loop* loop) {
+    unsigned head = __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE);
+    if(loop->sq_local_tail - head >= loop->sq_entries) {
+        // Make room by handing what is already there to the kernel
+        uring_enter(loop, 0);
+    }
+
+    unsigned index = loop->sq_local_tail & *loop->sq_mask;
+    struct io_uring_sqe* sqe = &loop->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    loop->sq_array[index] = index;
+    loop->sq_local_tail++;
+    loop->to_submit++;
+    return sqe;
+}
+
+/**
+ * Hand a receive buffer back to the kernel once its data has been handled
+ **/
+void uring_buffer_recycle(struct uring_loop* loop, unsigned short bid) {
+    struct io_uring_buf* buf = &loop->buf_ring->bufs[loop->buf_tail & (URING_BUFFERS - 1)];
+    buf->addr = (unsigned long)(loop->buffers + (size_t)bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    loop->buf_tail++;
+    __atomic_store_n(&loop->buf_ring->tail, loop->buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Submit a multishot receive, which keeps completing with data placed in the provided buffers until it fails
+ **/
+void uring_prep_recv(struct uring_loop* loop, int sockfd, uint64_t user_data) {
+    struct io_uring_sqe* sqe = uring_get_sqe(loop);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sockfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = user_data;
+}
+
+/**
+ * Submit a read of the eventfd, which completes when a client is handed to the loop or the server is stopping
+ **/
+void uring_prep_wake(struct uring_loop* loop) {
+    struct io_uring_sqe* sqe = uring_get_sqe(loop);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = loop->eventfd;
+    sqe->addr = (unsigned long)&loop->eventfd_value;
+    sqe->len = sizeof(loop->eventfd_value);
+    sqe->user_data = URING_OP_WAKE;
+}
+
+/**
+ * Submit a timeout that completes after a tick of the wheel, so the loop wakes up to handle it
+ **/
+void uring_prep_tick(struct uring_loop* loop) {
+    struct io_uring_sqe* sqe = uring_get_sqe(loop);
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)&loop->tick;
+    sqe->len = 1;
+    sqe->user_data = URING_OP_TICK;
+    loop->ticking = 1;
+}
+
+/**
+ * Check that the kernel supports multishot receives into provided buffers by receiving a byte through a socket pair
+ *
+ * Returns 1 if it does
+ **/
+int uring_probe(struct uring_loop* loop) {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        return 0;
+    }
+
+    uring_prep_recv(loop, fds[0], URING_OP_RECV);
+    if(uring_enter(loop, 0) < 0 || write(fds[1], "", 1) != 1) {
+        close(fds[0]);
+        close(fds[1]);
+        return 0;
+    }
+    // Closing the other end ends the receive, so there is a last completion without IORING_CQE_F_MORE
+    close(fds[1]);
+
+    int supported = 0;
+    int more = 1;
+    while(more) {
+        if(*loop->cq_head == __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE) && uring_enter(loop, 1) < 0) {
+            break;
+        }
+        unsigned head = *loop->cq_head;
+        while(more && head != __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &loop->cqes[head & *loop->cq_mask];
+            if(cqe->res == 1 && (cqe->flags & IORING_CQE_F_MORE)) {
+                supported = 1;
+            }
+            if(cqe->flags & IORING_CQE_F_BUFFER) {
+                uring_buffer_recycle(loop, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            }
+            more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+            head++;
+        }
+        __atomic_store_n(loop->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    close(fds[0]);
+    return supported;
+}
+
+/**
+ * Undo whatever uring_loop_init managed to set up
+ **/
+void uring_loop_free(struct uring_loop* loop) {
+    if(loop->fd >= 0) {
+        close(loop->fd);
+    }
+    if(loop->eventfd >= 0) {
+        close(loop->eventfd);
+    }
+    if(loop->sqes != NULL) {
+        munmap(loop->sqes, loop->sqes_size);
+    }
+    if(loop->cq_ring != NULL && loop->cq_ring != loop->sq_ring) {
+        munmap(loop->cq_ring, loop->cq_ring_size);
+    }
+    if(loop->sq_ring != NULL) {
+        munmap(loop->sq_ring, loop->sq_ring_size);
+    }
+    if(loop->buf_ring != NULL) {
+        munmap(loop->buf_ring, loop->buf_ring_size);
+    }
+    free(loop->buffers);
+    pthread_mutex_destroy(&loop->incoming_mutex);
+}
+
+/**
+ * Set up the io_uring instance of a loop, map its queues and register its receive buffers
+ *
+ * Returns -1 if io_uring can't be used
+ **/
+int uring_loop_init(struct uring_loop* loop) {
+    pthread_mutex_init(&loop->incoming_mutex, NULL);
+    loop->eventfd = -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    loop->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if(loop->fd < 0) {
+        return -1;
+    }
+
+    // Map the queues. Newer kernels put both queues in a single mapping.
+    loop->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    loop->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(loop->cq_ring_size > loop->sq_ring_size) {
+            loop->sq_ring_size = loop->cq_ring_size;
+        }
+        loop->cq_ring_size = loop->sq_ring_size;
+    }
+    loop->sq_ring = mmap(NULL, loop->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         loop->fd, IORING_OFF_SQ_RING);
+    if(loop->sq_ring == MAP_FAILED) {
+        loop->sq_ring = NULL;
+        return -1;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        loop->cq_ring = loop->sq_ring;
+    } else {
+        loop->cq_ring = mmap(NULL, loop->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             loop->fd, IORING_OFF_CQ_RING);
+        if(loop->cq_ring == MAP_FAILED) {
+            loop->cq_ring = NULL;
+            return -1;
+        }
+    }
+    loop->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    loop->sqes = mmap(NULL, loop->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      loop->fd, IORING_OFF_SQES);
+    if(loop->sqes == MAP_FAILED) {
+        loop->sqes = NULL;
+        return -1;
+    }
+
+    char* sq = loop->sq_ring;
+    loop->sq_head = (unsigned*)(sq + params.sq_off.head);
+    loop->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    loop->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    loop->sq_array = (unsigned*)(sq + params.sq_off.array);
+    loop->sq_entries = params.sq_entries;
+    loop->sq_local_tail = *loop->sq_tail;
+
+    char* cq = loop->cq_ring;
+    loop->cq_head = (unsigned*)(cq + params.cq_off.head);
+    loop->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    loop->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    loop->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // Register the receive buffers. The ring of buffers has to be page aligned, which mmap guarantees.
+    loop->buf_ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+    loop->buf_ring = mmap(NULL, loop->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(loop->buf_ring == MAP_FAILED) {
+        loop->buf_ring = NULL;
+        return -1;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)loop->buf_ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+    if(syscall(__NR_io_uring_register, loop->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return -1;
+    }
+
+    loop->buffers = malloc((size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+    if(!loop->buffers) {
+        perror("Error creating the io_uring loop: out of memory");
+        exit(1);
+    }
+    loop->buf_tail = 0;
+    for(int i = 0; i < URING_BUFFERS; i++) {
+        uring_buffer_recycle(loop, i);
+    }
+
+    if(uring_probe(loop) != 1) {
+        return -1;
+    }
+
+    loop->eventfd = eventfd(0, 0);
+    if(loop->eventfd == -1) {
+        return -1;
+    }
+
+    timer_wheel_init(&loop->wheel, SESSION_TIMER_TICK_MS);
+    loop->tick.tv_sec = SESSION_TIMER_TICK_MS / 1000;
+    loop->tick.tv_nsec = (long long)(SESSION_TIMER_TICK_MS % 1000) * 1000000;
+
+    // The probe's requests shouldn't show up in the counters
+    memset(&loop->stats, 0, sizeof(loop->stats));
+    return 0;
+}
+
+/* ==== SESSIONS ==== */
+
+/**
+ * Add a session to the list of sessions the loop checks for something to send
+ **/
+void uring_mark_dirty(struct uring_loop* loop, struct uring_session* us) {
+    if(!us->dirty) {
+        us->dirty = 1;
+        us->dirty_next = loop->dirty;
+        loop->dirty = us;
+    }
+}
+
+/**
+ * Removes a session from the loop, closes the socket and frees its memory.
+ * Only called once the kernel is done with every request of the session.
+ **/
+void uring_free_session(struct uring_loop* loop, struct uring_session* us) {
+    // Unlink the session from the loop's list
+    if(us->prev != NULL) {
+        us->prev->next = us->next;
+    } else {
+        loop->sessions = us->next;
+    }
+    if(us->next != NULL) {
+        us->next->prev = us->prev;
+    }
+    __atomic_sub_fetch(&loop->num_sessions, 1, __ATOMIC_RELAXED);
+    session_timers_stop(&us->session, &loop->wheel);
+
+    close(us->session.sockfd);
+    printf("Client disconnected. Socket: %d.\n", us->session.sockfd);
+
+    session_free(&us->session);
+    free(us->send_buffer);
+    free(us->held);
+    free(us);
+}
+
+/**
+ * Start closing a session. Shutting the socket down makes its receive and send complete, and the session is
+ * freed once they have and the authentication stage has handed it back.
+ **/
+void uring_close_session(struct uring_loop* loop, struct uring_session* us) {
+    if(!us->closing) {
+        us->closing = 1;
+        session_timers_stop(&us->session, &loop->wheel);
+        shutdown(us->session.sockfd, SHUT_RDWR);
+    }
+    // Sessions on the dirty list are checked again once the completions have been handled
+    if(!us->sending && !us->receiving && !us->dirty && !us->session.auth.pending) {
+        uring_free_session(loop, us);
+    }
+}
+
+/**
+ * Submit whatever the session can send now, or close it once it has exited and everything was sent
+ **/
+void uring_send_session(struct uring_loop* loop, struct uring_session* us) {
+    if(us->closing) {
+        uring_close_session(loop, us);
+        return;
+    }
+    if(us->sending) {
+        // The next send is submitted once the current one completes
+        return;
+    }
+    if(session_finished(&us->session)) {
+        uring_close_session(loop, us);
+        return;
+    }
+
+    char* data;
+    size_t size = session_outbox_next(&us->session, &data);
+    if(size == 0) {
+        return;
+    }
+
+    // The outbox can move while the send is in flight, so the kernel is given a copy
+    if(size > us->send_cap) {
+        free(us->send_buffer);
+        us->send_buffer = malloc(size);
+        if(!us->send_buffer) {
+            perror("Error sending to the client: out of memory");
+            exit(1);
+        }
+        us->send_cap = size;
+    }
+    memcpy(us->send_buffer, data, size);
+
+    struct io_uring_sqe* sqe = uring_get_sqe(loop);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = us->session.sockfd;
+    sqe->addr = (unsigned long)us->send_buffer;
+    sqe->len = size;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t)(uintptr_t)us | URING_OP_SEND;
+    us->sending = 1;
+    __atomic_add_fetch(&loop->stats.sends, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Called by an authentication thread once a login was checked. Hands the session back to its loop.
+ **/
+void uring_auth_done(struct auth_request* request) {
+    struct uring_loop* loop = request->owner;
+
+    pthread_mutex_lock(&loop->incoming_mutex);
+    int wake = (loop->verified == NULL);
+    request->next = loop->verified;
+    loop->verified = request;
+    pthread_mutex_unlock(&loop->incoming_mutex);
+
+    // The loop is already due to wake up if other logins were waiting to be handed back
+    if(wake) {
+        uint64_t value = 1;
+        if(write(loop->eventfd, &value, sizeof(value)) < 0) {
+            perror("io_uring loop eventfd");
+        }
+    }
+}
+
+/**
+ * Passes each complete message in the inbox to the game. Stops at a login, the messages after it are handled once
+ * the authentication stage has checked it.
+ **/
+void uring_handle_messages(struct uring_loop* loop, struct uring_session* us) {
+    char buffer[MESSAGE_MAX_SIZE];
+    int msg_size = 0;
+    while(!us->session.auth.pending && (msg_size = session_next_message(&us->session, buffer, sizeof(buffer))) > 0) {
+        game_update(&us->session, buffer, msg_size);
+        session_timers_touch(&us->session, &loop->wheel);
+
+        if(us->session.state == LOGIN_VERIFYING && !us->session.auth.pending) {
+            // Check the login on the authentication stage, the session is handed back once it has been
+            us->session.auth.done = uring_auth_done;
+            us->session.auth.owner = loop;
+            auth_submit(&us->session.auth);
+        }
+    }
+    if(msg_size < 0) {
+        // The client sent something that doesn't follow the protocol
+        uring_close_session(loop, us);
+    }
+}
+
+/**
+ * Keep bytes the client sent while its login is being checked, the receive buffer they are in is given back
+ **/
+void uring_hold(struct uring_loop* loop, struct uring_session* us, const char* data, int size) {
+    if(us->held_size + size > URING_HELD_MAX) {
+        // Nothing a client should send before it knows whether it is logged in
+        uring_close_session(loop, us);
+        return;
+    }
+    us->held = realloc(us->held, us->held_size + size);
+    if(!us->held) {
+        perror("Error receiving from the client: out of memory");
+        exit(1);
+    }
+    memcpy(us->held + us->held_size, data, size);
+    us->held_size += size;
+}
+
+/**
+ * Passes the bytes the client sent to the session and each complete message to the game
+ **/
+void uring_receive_session(struct uring_loop* loop, struct uring_session* us, const char* data, int size) {
+    // The inbox is smaller than a receive buffer, so it is emptied as it fills up
+    while(size > 0 && !us->closing) {
+        if(us->session.auth.pending) {
+            uring_hold(loop, us, data, size);
+            return;
+        }
+        int fed = session_feed(&us->session, data, size);
+        data += fed;
+        size -= fed;
+        uring_handle_messages(loop, us);
+    }
+}
+
+/**
+ * Shows the clients whose login was checked whether they are logged in, then carries on with whatever they sent
+ * while it was being checked
+ **/
+void uring_handle_verified(struct uring_loop* loop) {
+    pthread_mutex_lock(&loop->incoming_mutex);
+    struct auth_request* request = loop->verified;
+    loop->verified = NULL;
+    pthread_mutex_unlock(&loop->incoming_mutex);
+
+    while(request != NULL) {
+        struct auth_request* next = request->next;
+        struct uring_session* us = (struct uring_session*)request->data;
+        request->pending = 0;
+
+        if(us->closing) {
+            // The client left or timed out while its login was being checked
+            uring_close_session(loop, us);
+        } else {
+            game_login_verified(&us->session, request->verified);
+            session_timers_touch(&us->session, &loop->wheel);
+            if(us->session.state != EXIT) {
+                uring_handle_messages(loop, us);
+                char* held = us->held;
+                int held_size = us->held_size;
+                us->held = NULL;
+                us->held_size = 0;
+                uring_receive_session(loop, us, held, held_size);
+                free(held);
+            }
+            uring_mark_dirty(loop, us);
+        }
+
+        request = next;
+    }
+}
+
+/**
+ * Called by the loop's wheel when a client took too long. The client is told why, unless a send is already in
+ * flight, before being disconnected.
+ **/
+void uring_session_timeout(struct timer* timer, void* arg) {
+    struct uring_loop* loop = arg;
+    struct uring_session* us = (struct uring_session*)timer->data;
+
+    session_timed_out(&us->session);
+    printf("Client timed out. Socket: %d.\n", us->session.sockfd);
+    if(!us->sending) {
+        us->session.deferred = 0;
+        us->session.awaiting_ack = 0;
+        session_puts(&us->session, MSGC_EXIT, SESSION_TIMEOUT_MESSAGE);
+        session_present(&us->session);
+    }
+    uring_close_session(loop, us);
+}
+
+/**
+ * Registers the sessions handed over by the acceptor: draws their welcome screen and starts receiving from them
+ **/
+void uring_register_incoming(struct uring_loop* loop) {
+    pthread_mutex_lock(&loop->incoming_mutex);
+    struct uring_session* us = loop->incoming;
+    loop->incoming = NULL;
+    pthread_mutex_unlock(&loop->incoming_mutex);
+
+    while(us != NULL) {
+        struct uring_session* next = us->next;
+
+        // Add the session to the list owned by this loop
+        us->prev = NULL;
+        us->next = loop->sessions;
+        if(loop->sessions != NULL) {
+            loop->sessions->prev = us;
+        }
+        loop->sessions = us;
+
+        // Display the welcome banner
+        game_start(&us->session);
+        session_timers_start(&us->session, &loop->wheel, uring_session_timeout);
+        if(us->session.state != EXIT) {
+            uring_prep_recv(loop, us->session.sockfd, (uint64_t)(uintptr_t)us | URING_OP_RECV);
+            us->receiving = 1;
+        }
+        uring_mark_dirty(loop, us);
+
+        us = next;
+    }
+}
+
+/**
+ * Handles a single completion
+ **/
+void uring_handle_completion(struct uring_loop* loop, uint64_t user_data, int res, unsigned flags) {
+    int op = user_data & URING_OP_MASK;
+    struct uring_session* us = (struct uring_session*)(uintptr_t)(user_data & ~(uint64_t)URING_OP_MASK);
+
+    if(op == URING_OP_WAKE) {
+        // A client was handed over, a login was checked or the server is stopping
+        if(uring_keep_alive) {
+            uring_prep_wake(loop);
+        }
+        uring_register_incoming(loop);
+        uring_handle_verified(loop);
+        return;
+    }
+
+    if(op == URING_OP_TICK) {
+        // The wheel is advanced after every batch of completions
+        loop->ticking = 0;
+        return;
+    }
+
+    if(op == URING_OP_RECV) {
+        if(res > 0) {
+            __atomic_add_fetch(&loop->stats.receives, 1, __ATOMIC_RELAXED);
+            unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            if(!us->closing) {
+                uring_receive_session(loop, us, loop->buffers + (size_t)bid * URING_BUFFER_SIZE, res);
+            }
+            uring_buffer_recycle(loop, bid);
+        }
+
+        if(!(flags & IORING_CQE_F_MORE)) {
+            us->receiving = 0;
+            if(!us->closing && (res > 0 || res == -ENOBUFS)) {
+                // The receive stopped without the client leaving, eg. because every buffer was in use
+                uring_prep_recv(loop, us->session.sockfd, (uint64_t)(uintptr_t)us | URING_OP_RECV);
+                us->receiving = 1;
+            } else {
+                // The client disconnected
+                uring_close_session(loop, us);
+                return;
+            }
+        }
+    } else if(op == URING_OP_SEND) {
+        us->sending = 0;
+        if(res < 0) {
+            uring_close_session(loop, us);
+            return;
+        }
+        session_outbox_sent(&us->session, res);
+    }
+
+    uring_mark_dirty(loop, us);
+}
+
+/**
+ * The main function of each loop thread. Submits the requests of every session it owns and handles their
+ * completions, making one system call per batch.
+ **/
+void* uring_loop_run(void* arg) {
+    struct uring_loop* loop = arg;
+    uring_prep_wake(loop);
+
+    while(uring_keep_alive) {
+        if(uring_enter(loop, 1) < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            perror("io_uring_enter");
+            break;
+        }
+
+        unsigned head = *loop->cq_head;
+        while(head != __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &loop->cqes[head & *loop->cq_mask];
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            // Give the slot back before handling the completion as that can submit more requests
+            head++;
+            __atomic_store_n(loop->cq_head, head, __ATOMIC_RELEASE);
+            __atomic_add_fetch(&loop->stats.completions, 1, __ATOMIC_RELAXED);
+
+            uring_handle_completion(loop, user_data, res, flags);
+        }
+
+        timer_wheel_advance(&loop->wheel, loop);
+
+        // Queue up everything the game wants to send, to be submitted with the next wait
+        while(loop->dirty != NULL) {
+            struct uring_session* us = loop->dirty;
+            loop->dirty = us->dirty_next;
+            us->dirty = 0;
+            uring_send_session(loop, us);
+        }
+
+        // Only wake up for the ticks of the wheel while some session has a deadline
+        if(!loop->ticking && timer_wheel_size(&loop->wheel) > 0) {
+            uring_prep_tick(loop);
+        }
+    }
+
+    // Tell all of the clients still connected to exit. Sessions with a send in flight are just disconnected.
+    for(struct uring_session* us = loop->sessions; us != NULL; us = us->next) {
+        if(!us->closing && !us->sending) {
+            us->session.deferred = 0;
+            us->session.awaiting_ack = 0;
+            session_puts(&us->session, MSGC_EXIT, "Server is offline.\n");
+            session_present(&us->session);
+        }
+        shutdown(us->session.sockfd, SHUT_RDWR);
+    }
+
+    return NULL;
+}
+
+/* ==== PUBLIC ==== */
+
+/**
+ * Create the loop threads that will handle the clients. If pin is set, loop thread i only runs on core i
+ * (wrapping around when there are more threads than cores).
+ *
+ * Returns -1 if io_uring can't be used on this system, in which case nothing was started
+ **/
+int uring_start(int num_threads, int pin) {
+    uring_loops = calloc(num_threads, sizeof(struct uring_loop));
+    if(!uring_loops) {
+        perror("Error creating the io_uring loop: out of memory");
+        exit(1);
+    }
+
+    for(int i = 0; i < num_threads; i++) {
+        if(uring_loop_init(&uring_loops[i]) < 0) {
+            for(int j = 0; j <= i; j++) {
+                uring_loop_free(&uring_loops[j]);
+            }
+            free(uring_loops);
+            uring_loops = NULL;
+            return -1;
+        }
+    }
+    uring_loops_size = num_threads;
+
+    for(int i = 0; i < num_threads; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if(pin) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+        if(pthread_create(&uring_loops[i].thread, &attr, uring_loop_run, &uring_loops[i]) != 0) {
+            perror("Error creating the io_uring loop");
+            exit(1);
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    return 0;
+}
+
+/**
+ * Hand a newly connected client to one of the loop threads
+ *
+ * Returns the number of sessions handled by the loop thread that received the client
+ **/
+int uring_add_client(int client_sockfd) {
+    // Spread the clients across the loop threads
+    return uring_add_client_to(uring_next++ % uring_loops_size, client_sockfd);
+}
+
+/**
+ * Hand a newly connected client to a specific loop thread
+ *
+ * Returns the number of sessions handled by the loop thread
+ **/
+int uring_add_client_to(int loop_index, int client_sockfd) {
+    // The socket is only written to directly when the server is stopping, which must not block
+    int flags = fcntl(client_sockfd, F_GETFL, 0);
+    fcntl(client_sockfd, F_SETFL, flags | O_NONBLOCK);
+
+    struct uring_session* us = calloc(1, sizeof(struct uring_session));
+    if(!us) {
+        perror("Error adding client to the io_uring loop: out of memory");
+        exit(1);
+    }
+    session_init(&us->session, client_sockfd, 1);
+    us->session.deferred = 1;
+
+    struct uring_loop* loop = &uring_loops[loop_index % uring_loops_size];
+    int size = __atomic_add_fetch(&loop->num_sessions, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&loop->incoming_mutex);
+    us->next = loop->incoming;
+    loop->incoming = us;
+    pthread_mutex_unlock(&loop->incoming_mutex);
+
+    // Wake the loop up so it registers the session
+    uint64_t value = 1;
+    if(write(loop->eventfd, &value, sizeof(value)) < 0) {
+        perror("io_uring loop eventfd");
+    }
+
+    return size;
+}
+
+/**
+ * Get how many sessions all of the loop threads are handling
+ **/
+int uring_num_sessions() {
+    int num_sessions = 0;
+    for(int i = 0; i < uring_loops_size; i++) {
+        num_sessions += __atomic_load_n(&uring_loops[i].num_sessions, __ATOMIC_RELAXED);
+    }
+    return num_sessions;
+}
+
+/**
+ * Stop all the loop threads. Every client still connected is told the server is offline and disconnected.
+ * The authentication stage must be stopped first.
+ **/
+void uring_stop() {
+    uring_keep_alive = 0;
+
+    // Wake up every loop so it notices it has to stop
+    for(int i = 0; i < uring_loops_size; i++) {
+        uint64_t value = 1;
+        if(write(uring_loops[i].eventfd, &value, sizeof(value)) < 0) {
+            perror("io_uring loop eventfd");
+        }
+    }
+
+    for(int i = 0; i < uring_loops_size; i++) {
+        struct uring_loop* loop = &uring_loops[i];
+        pthread_join(loop->thread, NULL);
+
+        // Tearing the ring down cancels whatever is still in flight, after which the sessions can be freed
+        close(loop->fd);
+        loop->fd = -1;
+        while(loop->sessions != NULL) {
+            uring_free_session(loop, loop->sessions);
+        }
+        while(loop->incoming != NULL) {
+            struct uring_session* us = loop->incoming;
+            loop->incoming = us->next;
+            close(us->session.sockfd);
+            session_free(&us->session);
+            free(us);
+        }
+        uring_loop_free(loop);
+    }
+
+    // Keep the counters so they can still be reported
+    uring_stats_get(&uring_stopped_stats);
+
+    free(uring_loops);
+    uring_loops = NULL;
+    uring_loops_size = 0;
+}
+
+/**
+ * Get a copy of the counters of all loops
+ **/
+void uring_stats_get(struct uring_stats* stats) {
+    *stats = uring_stopped_stats;
+    for(int i = 0; i < uring_loops_size; i++) {
+        struct uring_stats* loop_stats = &uring_loops[i].stats;
+        stats->enters += __atomic_load_n(&loop_stats->enters, __ATOMIC_RELAXED);
+        stats->submitted += __atomic_load_n(&loop_stats->submitted, __ATOMIC_RELAXED);
+        stats->completions += __atomic_load_n(&loop_stats->completions, __ATOMIC_RELAXED);
+        stats->sends += __atomic_load_n(&loop_stats->sends, __ATOMIC_RELAXED);
+        stats->receives += __atomic_load_n(&loop_stats->receives, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef URING_H
+#define URING_H
+
+/**
+ * The io_uring backend is an alternative to the reactor. Each loop thread owns an io_uring instance and the
+ * sessions handed to it. Every session has a single multishot receive that keeps delivering whatever the
+ * client sends into buffers provided by the loop, and everything the game wants to send is queued as send
+ * requests. The requests from every session are submitted together with the wait for completions, so a loop
+ * makes one system call per batch of events rather than one per message.
+ *
+ * The rings are set up with raw system calls, so liburing is not needed. If the kernel doesn't support
+ * io_uring (or multishot receives with provided buffers), uring_start fails and the server should fall back
+ * to the reactor.
+ **/
+
+/**
+ * Counters that show how well the submissions are being batched, summed over every loop
+ **/
+struct uring_stats {
+    unsigned long enters;           // How many times io_uring_enter was called
+    unsigned long submitted;        // How many requests were submitted
+    unsigned long completions;      // How many completions were handled
+    unsigned long sends;            // How many of the requests were sends
+    unsigned long receives;         // How many completions were received data
+};
+
+/**
+ * Create the loop threads that will handle the clients. If pin is set, loop thread i only runs on core i
+ * (wrapping around when there are more threads than cores).
+ *
+ * Returns -1 if io_uring can't be used on this system, in which case nothing was started
+ **/
+int uring_start(int num_threads, int pin);
+
+/**
+ * Hand a newly connected client to one of the loop threads
+ *
+ * Returns the number of sessions handled by the loop thread that received the client
+ **/
+int uring_add_client(int client_sockfd);
+
+/**
+ * Hand a newly connected client to a specific loop thread
+ *
+ * Returns the number of sessions handled by the loop thread
+ **/
+int uring_add_client_to(int loop_index, int client_sockfd);
+
+/**
+ * Get how many sessions all of the loop threads are handling
+ **/
+int uring_num_sessions();
+
+/**
+ * Stop all the loop threads. Every client still connected is told the server is offline and disconnected.
+ * The authentication stage must be stopped first.
+ **/
+void uring_stop();
+
+/**
+ * Get a copy of the counters of all loops
+ **/
+void uring_stats_get(struct uring_stats* stats);
+
+#endif // URING_H
@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "leaderboard.h"
+#include "window.h"
+
+/**
+ * What a user did in the slices still in a window
+ **/
+struct window_user {
+    int games_played;
+    int games_won;
+    struct game* first;             // The games the user won in the window, oldest first, linked by user_next
+    struct game* last;
+    struct game* best;              // The best of them, NULL if it left the window and hasn't been looked for since
+};
+
+/**
+ * A ring of buckets covering a window of time, along with everything in its live buckets merged together
+ **/
+struct window {
+    int num_buckets;
+    int slice_seconds;              // How long each bucket's slice is
+    long latest;                    // The latest slice the window reaches, older buckets are emptied as it moves on
+    struct window_bucket* buckets;  // The bucket of a slice is at the slice modulo the number of buckets
+    struct game_list games;         // Every game won in the window, ranked. The buckets point to them.
+    struct window_user* users;      // What each user did in the window, by user id
+    int users_cap;
+};
+
+// The windows by view, the all-time leaderboard has none
+struct window windows[LEADERBOARD_VIEWS] = {
+    [LEADERBOARD_PAST_HOUR] = {WINDOW_HOUR_BUCKETS, WINDOW_HOUR_SECONDS, -1, NULL, {NULL, NULL, 1, 0}, NULL, 0},
+    [LEADERBOARD_PAST_DAY] = {WINDOW_DAY_BUCKETS, WINDOW_DAY_SECONDS, -1, NULL, {NULL, NULL, 1, 0}, NULL, 0},
+    [LEADERBOARD_PAST_WEEK] = {WINDOW_WEEK_BUCKETS, WINDOW_WEEK_SECONDS, -1, NULL, {NULL, NULL, 1, 0}, NULL, 0},
+};
+unsigned long window_game_ids = 0;  // The id of the next game won, shared by every window
+
+/**
+ * Get what a user did in a window, making room for the user if needed
+ **/
+struct window_user* window_user_get(struct window* window, int user_id) {
+    if(user_id >= window->users_cap) {
+        int capacity = window->users_cap ? window->users_cap : 64;
+        while(capacity <= user_id) {
+            capacity *= 2;
+        }
+        window->users = realloc(window->users, capacity * sizeof(struct window_user));
+        if(!window->users) {
+            perror("Error adding to the leaderboard: out of memory");
+            exit(1);
+        }
+        memset(window->users + window->users_cap, 0, (capacity - window->users_cap) * sizeof(struct window_user));
+        window->users_cap = capacity;
+    }
+    return &window->users[user_id];
+}
+
+/**
+ * Take a game that is leaving the window off the list of games its user won there. The games nearly always leave
+ * oldest first, so it is nearly always the first one.
+ **/
+void window_user_unlink(struct window_user* user, struct game* game) {
+    struct game* before = NULL;
+    for(struct game* other = user->first; other != game; other = other->user_next) {
+        before = other;
+    }
+    if(before == NULL) {
+        user->first = game->user_next;
+    } else {
+        before->user_next = game->user_next;
+    }
+    if(user->last == game) {
+        user->last = before;
+    }
+    if(user->best == game) {
+        // Looked for again the next time it is needed
+        user->best = NULL;
+    }
+}
+
+/**
+ * Take everything in a bucket out of the window's merged games and counts, and empty it. Each game is unlinked
+ * from the ranked list one at a time, which is paid for once by every game that was added.
+ **/
+void window_expire_bucket(struct window* window, struct window_bucket* bucket) {
+    for(int i = 0; i < bucket->num_games; i++) {
+        struct game* game = bucket->games[i];
+        game_list_remove(&window->games, game);
+        window_user_unlink(&window->users[game->user_id], game);
+        free(game);
+    }
+    for(unsigned int i = 0; bucket->num_counts > 0 && i <= bucket->counts_mask; i++) {
+        struct window_count* count = &bucket->counts[i];
+        if(count->user != 0) {
+            struct window_user* user = &window->users[count->user - 1];
+            user->games_played -= count->games_played;
+            user->games_won -= count->games_won;
+        }
+    }
+
+    // The memory is kept for the slice that takes the bucket next
+    bucket->slice = -1;
+    bucket->num_games = 0;
+    if(bucket->num_counts > 0) {
+        memset(bucket->counts, 0, (bucket->counts_mask + 1) * sizeof(struct window_count));
+        bucket->num_counts = 0;
+    }
+}
+
+/**
+ * Move a window on so that it ends with a slice, expiring the buckets of the slices that fall out of it. Each
+ * bucket is expired once, so this costs nothing until a slice leaves the window.
+ **/
+void window_advance_to(struct window* window, long slice) {
+    if(slice <= window->latest) {
+        return;
+    }
+    for(int i = 0; window->buckets != NULL && i < window->num_buckets; i++) {
+        struct window_bucket* bucket = &window->buckets[i];
+        if(bucket->slice >= 0 && bucket->slice <= slice - window->num_buckets) {
+            window_expire_bucket(window, bucket);
+        }
+    }
+    window->latest = slice;
+}
+
+/**
+ * Get the bucket a slice goes in, moving the window on to it if it is the latest
+ *
+ * Returns NULL if the slice has already fallen out of the window
+ **/
+struct window_bucket* window_bucket_get(struct window* window, long slice) {
+    if(window->buckets == NULL) {
+        window->buckets = calloc(window->num_buckets, sizeof(struct window_bucket));
+        if(!window->buckets) {
+            perror("Error adding to the leaderboard: out of memory");
+            exit(1);
+        }
+        for(int i = 0; i < window->num_buckets; i++) {
+            window->buckets[i].slice = -1;
+        }
+    }
+    if(slice <= window->latest - window->num_buckets) {
+        return NULL;
+    }
+    window_advance_to(window, slice);
+
+    // Any other slice that shared the bucket has left the window, so the bucket is empty if it isn't this slice's
+    struct window_bucket* bucket = &window->buckets[slice % window->num_buckets];
+    bucket->slice = slice;
+    return bucket;
+}
+
+/**
+ * Find the slot of a bucket's table that holds a user, or the empty slot it would go in
+ **/
+struct window_count* window_count_slot(struct window_bucket* bucket, int user_id) {
+    unsigned int i = (unsigned int)user_id & bucket->counts_mask;
+    while(bucket->counts[i].user != 0 && bucket->counts[i].user != user_id + 1) {
+        i = (i + 1) & bucket->counts_mask;
+    }
+    return &bucket->counts[i];
+}
+
+/**
+ * Get how many games a user played and won in a bucket, or NULL if they played none
+ **/
+struct window_count* window_count_find(struct window_bucket* bucket, int user_id) {
+    if(bucket->counts == NULL) {
+        return NULL;
+    }
+    struct window_count* slot = window_count_slot(bucket, user_id);
+    return (slot->user != 0) ? slot : NULL;
+}
+
+/**
+ * Get the counts of a user in a bucket, adding them if the user has none yet
+ **/
+struct window_count* window_count_add(struct window_bucket* bucket, int user_id) {
+    // The table is never more than half full
+    if(2 * (bucket->num_counts + 1) > (int)(bucket->counts_mask + 1) || bucket->counts == NULL) {
+        unsigned int capacity = bucket->counts ? (bucket->counts_mask + 1) * 2 : 16;
+        struct window_count* old = bucket->counts;
+        unsigned int old_capacity = bucket->counts ? bucket->counts_mask + 1 : 0;
+        bucket->counts = calloc(capacity, sizeof(struct window_count));
+        if(!bucket->counts) {
+            perror("Error adding to the leaderboard: out of memory");
+            exit(1);
+        }
+        bucket->counts_mask = capacity - 1;
+        for(unsigned int i = 0; i < old_capacity; i++) {
+            if(old[i].user != 0) {
+                *window_count_slot(bucket, old[i].user - 1) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    struct window_count* slot = window_count_slot(bucket, user_id);
+    if(slot->user == 0) {
+        slot->user = user_id + 1;
+        bucket->num_counts++;
+    }
+    return slot;
+}
+
+/**
+ * Add a won game to a bucket and to the window's merged games
+ **/
+void window_add_game(struct window* window, struct window_bucket* bucket, struct game* game) {
+    if(bucket->num_games == bucket->games_cap) {
+        bucket->games_cap = bucket->games_cap ? bucket->games_cap * 2 : 64;
+        bucket->games = realloc(bucket->games, bucket->games_cap * sizeof(struct game*));
+        if(!bucket->games) {
+            perror("Error adding to the leaderboard: out of memory");
+            exit(1);
+        }
+    }
+    bucket->games[bucket->num_games++] = game;
+    game_list_insert(&window->games, game);
+
+    struct window_user* user = window_user_get(window, game->user_id);
+    game->user_next = NULL;
+    if(user->first == NULL) {
+        user->first = game;
+        user->best = game;
+    } else {
+        user->last->user_next = game;
+        if(user->best != NULL && leaderboard_compare(game, user->best) < 0) {
+            user->best = game;
+        }
+    }
+    user->last = game;
+}
+
+/**
+ * Add the result of a game that ended at a time to every window it is still in. A won game is only ranked if
+ * ranked is set, otherwise it only counts as a game won. Must be called with the leaderboard locked.
+ **/
+void window_add_result(int user_id, int time_taken, int game_won, int ranked, long ended) {
+    unsigned long id = window_game_ids++;
+    for(int view = 0; view < LEADERBOARD_VIEWS; view++) {
+        struct window* window = &windows[view];
+        if(window->num_buckets == 0) {
+            continue;
+        }
+        struct window_bucket* bucket = window_bucket_get(window, ended / window->slice_seconds);
+        if(bucket == NULL) {
+            continue;
+        }
+
+        // Ties are broken by how many games the user had won in the window so far
+        struct window_user* user = window_user_get(window, user_id);
+        if(game_won && ranked) {
+            window_add_game(window, bucket, game_new(user_id, time_taken, user->games_won, id));
+        }
+        struct window_count* count = window_count_add(bucket, user_id);
+        count->games_played++;
+        count->games_won += game_won;
+        user->games_played++;
+        user->games_won += game_won;
+    }
+}
+
+/**
+ * Move a view's window on to a time, taking out the games and counts of the slices that left it.
+ * Must be called with the leaderboard locked.
+ **/
+void window_advance(int view, long now) {
+    window_advance_to(&windows[view], now / windows[view].slice_seconds);
+}
+
+/**
+ * Get when what a view's window holds at a time changes next, as its oldest slice leaves it
+ **/
+long window_expires(int view, long now) {
+    return (now / windows[view].slice_seconds + 1) * windows[view].slice_seconds;
+}
+
+/**
+ * Get the ranked list of the games won in a view's window
+ **/
+struct game_list* window_games(int view) {
+    return &windows[view].games;
+}
+
+/**
+ * Get how many games a user won and played in a view's window
+ **/
+void window_user_stats(int view, int user_id, int* games_won, int* games_played) {
+    struct window* window = &windows[view];
+    *games_won = (user_id < window->users_cap) ? window->users[user_id].games_won : 0;
+    *games_played = (user_id < window->users_cap) ? window->users[user_id].games_played : 0;
+}
+
+/**
+ * Get the best game a user won in a view's window, or NULL if they won none. If the best one left the window, the
+ * user's remaining games there are looked through for the next best.
+ **/
+struct game* window_user_best(int view, int user_id) {
+    struct window* window = &windows[view];
+    if(user_id >= window->users_cap) {
+        return NULL;
+    }
+    struct window_user* user = &window->users[user_id];
+    if(user->best == NULL) {
+        for(struct game* game = user->first; game != NULL; game = game->user_next) {
+            if(user->best == NULL || leaderboard_compare(game, user->best) < 0) {
+                user->best = game;
+            }
+        }
+    }
+    return user->best;
+}
+
+/**
+ * Get how many buckets a view's window has, 0 if the view isn't a window
+ **/
+int window_num_buckets(int view) {
+    return windows[view].buckets ? windows[view].num_buckets : 0;
+}
+
+/**
+ * Get one of the buckets of a view's window, to save it
+ **/
+struct window_bucket* window_bucket_at(int view, int i) {
+    return &windows[view].buckets[i];
+}
+
+/**
+ * Put a game back in the bucket of a slice, as it was saved. Must be called before any result is added.
+ **/
+void window_restore_game(int view, long slice, struct window_game* game) {
+    struct window_bucket* bucket = window_bucket_get(&windows[view], slice);
+    if(bucket != NULL) {
+        window_add_game(&windows[view], bucket, game_new(game->user_id, game->time_taken, game->games_won, game->id));
+    }
+    if(game->id >= window_game_ids) {
+        window_game_ids = game->id + 1;
+    }
+}
+
+/**
+ * Put back how many games a user played and won in the bucket of a slice, as it was saved.
+ * Must be called before any result is added.
+ **/
+void window_restore_count(int view, long slice, int user_id, int games_played, int games_won) {
+    struct window_bucket* bucket = window_bucket_get(&windows[view], slice);
+    if(bucket != NULL) {
+        struct window_count* count = window_count_add(bucket, user_id);
+        count->games_played += games_played;
+        count->games_won += games_won;
+        struct window_user* user = window_user_get(&windows[view], user_id);
+        user->games_played += games_played;
+        user->games_won += games_won;
+    }
+}
+
+/**
+ * Deallocate the buckets of every window
+ **/
+void window_free() {
+    for(int view = 0; view < LEADERBOARD_VIEWS; view++) {
+        struct window* window = &windows[view];
+        for(int i = 0; window->buckets != NULL && i < window->num_buckets; i++) {
+            free(window->buckets[i].games);
+            free(window->buckets[i].counts);
+        }
+        free(window->buckets);
+        window->buckets = NULL;
+        window->latest = -1;
+        // The buckets only pointed to the games, which the list owns
+        game_list_free(&window->games);
+        free(window->users);
+        window->users = NULL;
+        window->users_cap = 0;
+    }
+    window_game_ids = 0;
+}
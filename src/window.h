@@ -0,0 +1,120 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+/**
+ * The windows keep the leaderboards of the games won recently: in the past hour, day and week.
+ *
+ * Each window is a ring of buckets, each holding the games that ended in one slice of time along with how many
+ * games every user played and won in it. A result is added to the bucket of the slice it ended in, and also merged
+ * into the window's ranked list of games and its totals for each user. When a slice falls out of the window its
+ * bucket's games and counts are taken back out of them, and it is emptied for the slice that takes it next. A window
+ * therefore covers the current slice and the ones before it, eg. the past hour is anywhere between 55 and 60 minutes.
+ *
+ * Expiring a bucket is not free: each of its k games is unlinked from the ranked list, O(k log n) for the bucket.
+ * Every game is removed once though, so it adds O(log n) to the result that added it and nothing grows with the
+ * age of the server. Only skipping the expired buckets would make expiry O(1), but then no list would hold the
+ * window's games in order, and every page would have to merge the ranked lists of all its buckets to find a rank.
+ *
+ * The windows are only changed and read with the leaderboard locked. Their leaderboards are shown a page at a time
+ * like the all-time one, straight from the ranked list of games.
+ **/
+
+#define WINDOW_HOUR_BUCKETS     12      // The past hour is kept in buckets of 5 minutes
+#define WINDOW_HOUR_SECONDS     300
+#define WINDOW_DAY_BUCKETS      24      // The past day is kept in buckets of an hour
+#define WINDOW_DAY_SECONDS      3600
+#define WINDOW_WEEK_BUCKETS     7       // The past week is kept in buckets of a day
+#define WINDOW_WEEK_SECONDS     86400
+
+/**
+ * A game won during a window
+ **/
+struct window_game {
+    int user_id;
+    int time_taken;
+    int games_won;              // How many games the user had won in the window before this one, which breaks ties
+    unsigned long id;           // Breaks the remaining ties, a later game ranks above an equal earlier one
+};
+
+/**
+ * A slot of a bucket's table of how many games each user played in its slice. Empty slots have no user.
+ **/
+struct window_count {
+    int user;                   // The id of the user plus 1, 0 for an empty slot
+    int games_played;
+    int games_won;
+};
+
+/**
+ * The results of the games that ended in one slice of time
+ **/
+struct window_bucket {
+    long slice;                 // Which slice it holds, the time the games ended divided by the length of a slice
+    struct game** games;        // The games won in the slice, in the order they ended. The window's list owns them.
+    int num_games;
+    int games_cap;
+    struct window_count* counts;    // Open addressing table, searched linearly from the slot the user id points to
+    unsigned int counts_mask;       // The number of slots minus 1 (it is a power of 2), or 0 before it is allocated
+    int num_counts;
+};
+
+/**
+ * Add the result of a game that ended at a time to every window it is still in. A won game is only ranked if
+ * ranked is set, otherwise it only counts as a game won. Must be called with the leaderboard locked.
+ **/
+void window_add_result(int user_id, int time_taken, int game_won, int ranked, long ended);
+
+/**
+ * Move a view's window on to a time, taking out the games and counts of the slices that left it.
+ * Must be called with the leaderboard locked.
+ **/
+void window_advance(int view, long now);
+
+/**
+ * Get when what a view's window holds at a time changes next, as its oldest slice leaves it
+ **/
+long window_expires(int view, long now);
+
+/**
+ * Get the ranked list of the games won in a view's window
+ **/
+struct game_list* window_games(int view);
+
+/**
+ * Get how many games a user won and played in a view's window
+ **/
+void window_user_stats(int view, int user_id, int* games_won, int* games_played);
+
+/**
+ * Get the best game a user won in a view's window, or NULL if they won none. If the best one left the window, the
+ * user's remaining games there are looked through for the next best.
+ **/
+struct game* window_user_best(int view, int user_id);
+
+/**
+ * Get how many buckets a view's window has, 0 if the view isn't a window
+ **/
+int window_num_buckets(int view);
+
+/**
+ * Get one of the buckets of a view's window, to save it
+ **/
+struct window_bucket* window_bucket_at(int view, int i);
+
+/**
+ * Put a game back in the bucket of a slice, as it was saved. Must be called before any result is added.
+ **/
+void window_restore_game(int view, long slice, struct window_game* game);
+
+/**
+ * Put back how many games a user played and won in the bucket of a slice, as it was saved.
+ * Must be called before any result is added.
+ **/
+void window_restore_count(int view, long slice, int user_id, int games_played, int games_won);
+
+/**
+ * Deallocate the buckets of every window
+ **/
+void window_free();
+
+#endif // WINDOW_H